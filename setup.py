@@ -66,18 +66,21 @@ class build_prog(_build_clib):
             'arg-sample',
             {
                 'sources': lib_src + ['src/arg-sample.cpp'],
+                'libraries': ['z', 'pthread'],
             }
         ),
         (
             'arg-summarize',
             {
                 'sources': lib_src + ['src/arg-summarize.cpp'],
+                'libraries': ['z', 'pthread'],
             }
         ),
         (
             'smc2bed',
             {
                 'sources': lib_src + ['src/smc2bed.cpp'],
+                'libraries': ['z'],
             }
         ),
     ]
@@ -129,6 +132,8 @@ class build_prog(_build_clib):
                                             debug=self.debug)
             self.compiler.link_executable(objects, prog_name,
                                           output_dir=self.build_bin,
+                                          libraries=build_info.get(
+                                              'libraries'),
                                           debug=self.debug)
 
 
@@ -154,6 +159,7 @@ setup(
         Extension(
             'libargweaver',
             lib_src,
+            libraries=['z', 'pthread'],
         )
     ],
 )
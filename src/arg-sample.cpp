@@ -7,6 +7,7 @@
 #include <unistd.h>
 
 // arghmm includes
+#include "argweaver/arg_archive.h"
 #include "argweaver/compress.h"
 #include "argweaver/ConfigParam.h"
 #include "argweaver/emit.h"
@@ -15,6 +16,7 @@
 #include "argweaver/mem.h"
 #include "argweaver/parsing.h"
 #include "argweaver/sample_arg.h"
+#include "argweaver/sample_thread.h"
 #include "argweaver/sequences.h"
 #include "argweaver/total_prob.h"
 #include "argweaver/track.h"
@@ -33,7 +35,10 @@ Sampler for large ancestral recombination graphs\n\
 
 // file extensions
 const char *SMC_SUFFIX = ".smc";
+const char *ARGB_SUFFIX = ".argb";
+const char *ARGA_SUFFIX = ".arga";
 const char *SITES_SUFFIX = ".sites";
+const char *THREAD_POST_SUFFIX = ".thread_post.bed";
 const char *STATS_SUFFIX = ".stats";
 const char *LOG_SUFFIX = ".log";
 
@@ -57,6 +62,7 @@ public:
 
         resample_region[0] = -1;
         resample_region[1] = -1;
+        archive = NULL;
     }
 
     void make_parser()
@@ -76,7 +82,7 @@ public:
                     "prefix for all output filenames (default='arg-sample')"));
         config.add(new ConfigParam<string>
                    ("-a", "--arg", "<SMC file>", &arg_file, "",
-                    "initial ARG file (*.smc) for resampling (optional)"));
+                    "initial ARG file (*.smc or *.argb) for resampling (optional)"));
         config.add(new ConfigParam<string>
                    ("", "--region", "<start>-<end>",
                     &subregion_str, "",
@@ -150,6 +156,21 @@ public:
  	config.add(new ConfigSwitch
 		   ("", "--no-compress-output", &no_compress_output,
                     "do not use compressed output"));
+        config.add(new ConfigSwitch
+                   ("", "--binary-output", &binary_output,
+                    "write ARGs in indexed binary format (*.argb)"));
+        config.add(new ConfigSwitch
+                   ("", "--archive-output", &archive_output,
+                    "write all sampled ARGs to one indexed archive"
+                    " (*.arga)"));
+        config.add(new ConfigParam<int>
+                   ("", "--thread-posterior", "<# of paths>",
+                    &thread_posterior, 0,
+                    "with each sample, write a Monte Carlo estimate of the"
+                    " posterior of each chromosome's coalescence time from"
+                    " <# of paths> sampled paths per forward pass. Costs one"
+                    " forward pass per chromosome for each logged sample"
+                    " (*.thread_post.bed, default=0)"));
         config.add(new ConfigParam<int>
                    ("-x", "--randseed", "<random seed>", &randseed, 0,
                     "seed for random number generator (default=current time)"));
@@ -188,6 +209,46 @@ public:
                    ("", "--resample-window-iters", "<iterations>",
                     &resample_window_iters, 10,
                     "number of iterations per sliding window for resampling (default=10)", DEBUG_OPT));
+        config.add(new ConfigParam<double>
+                   ("", "--prune", "<probability>", &prune_threshold, 0.0,
+                    "prune forward states whose probability stays below "
+                    "<probability> (default=0, no pruning)", DEBUG_OPT));
+        config.add(new ConfigParam<int>
+                   ("", "--prune-run", "<sites>", &prune_runlen, 100,
+                    "number of sites a state must stay below the pruning "
+                    "threshold (default=100)", DEBUG_OPT));
+        config.add(new ConfigParam<double>
+                   ("", "--prune-tol", "<probability>", &prune_tolerance, 1e-3,
+                    "disable pruning if a forward pass discards more than "
+                    "this fraction of its probability, compounded over "
+                    "pruned columns (default=1e-3)", DEBUG_OPT));
+        config.add(new ConfigParam<int>
+                   ("", "--prune-iters", "<iterations>", &prune_iters, 0,
+                    "number of resampling iterations that use pruning, "
+                    "after building the initial ARG (default=0)", DEBUG_OPT));
+        config.add(new ConfigParam<int>
+                   ("", "--forward-threads", "<threads>", &forward_threads, 1,
+                    "run the forward algorithm over segments of the region "
+                    "in parallel. Produces the same samples as the serial "
+                    "algorithm (experimental, default=1)",
+                    DEBUG_OPT));
+        config.add(new ConfigParam<double>
+                   ("", "--forward-tol", "<tolerance>", &forward_tol, 0.0,
+                    "relative tolerance at which the parallel forward "
+                    "algorithm stops correcting a segment. Above 0, it is "
+                    "faster but samples may differ from the serial "
+                    "algorithm (experimental, default=0)",
+                    DEBUG_OPT));
+        config.add(new ConfigSwitch
+                   ("", "--no-likelihood-cache", &no_likelihood_cache,
+                    "recompute the likelihoods of unchanged local trees for"
+                    " each statistic. Always done for unphased data",
+                    DEBUG_OPT));
+        config.add(new ConfigParam<int>
+                   ("", "--archive-chunk", "<bases>", &archive_chunk,
+                    DEFAULT_ARCHIVE_CHUNK_SIZE,
+                    "size of the chunks compared between samples of an ARG"
+                    " archive (default=10000)", DEBUG_OPT));
 
 
         // help information
@@ -273,11 +334,24 @@ public:
     int resample_window;
     int resample_window_iters;
     bool gibbs;
+    double prune_threshold;
+    int prune_runlen;
+    double prune_tolerance;
+    int prune_iters;
+    int forward_threads;
+    double forward_tol;
+    bool no_likelihood_cache;
+    ForwardPruning pruning;
 
     // misc
     int compress_seq;
     int sample_step;
     bool no_compress_output;
+    bool binary_output;
+    bool archive_output;
+    int thread_posterior;
+    int archive_chunk;
+    ArgArchiveWriter *archive;
     int randseed;
     double prob_path_switch;
     bool infsites;
@@ -366,6 +440,22 @@ void log_model(const ArgModel &model)
 }
 
 
+// log and reset statistics of the approximate forward algorithm
+void log_pruning(ArgModel *model)
+{
+    ForwardPruning *pruning = model->pruning;
+    if (!pruning || pruning->npasses == 0)
+        return;
+
+    printLog(LOG_LOW, "forward pruning: %ld states pruned, "
+             "discarded fraction mean=%e max=%e\n",
+             pruning->nstates_pruned,
+             pruning->total_discarded / pruning->npasses,
+             pruning->max_discarded);
+    pruning->reset_stats();
+}
+
+
 //=============================================================================
 // alignment compression
 
@@ -471,9 +561,11 @@ void print_stats(FILE *stats_file, const char *stage, int iter,
     if (sites_mapping)
         uncompress_local_trees(trees, sites_mapping);
 
-    double prior = calc_arg_prior(&config->model, trees);
-    double likelihood = calc_arg_likelihood(&config->model, sequences, trees,
-                                            sites_mapping);
+    double prior = calc_arg_prior_cached(&config->model, trees);
+    double likelihood = config->no_likelihood_cache ?
+        calc_arg_likelihood(&config->model, sequences, trees, sites_mapping) :
+        calc_arg_likelihood_cached(&config->model, sequences, trees,
+                                   sites_mapping);
     double joint = prior + likelihood;
     double arglen = get_arglen(trees, config->model.times);
 
@@ -508,7 +600,14 @@ string get_out_arg_file(const Config &config, int iter)
 {
     char iterstr[10];
     snprintf(iterstr, 10, ".%d", iter);
-    return config.out_prefix + iterstr + SMC_SUFFIX;
+    return config.out_prefix + iterstr +
+        (config.binary_output ? ARGB_SUFFIX : SMC_SUFFIX);
+}
+
+// Returns the filename of the ARG archive
+string get_out_archive_file(const Config &config)
+{
+    return config.out_prefix + ARGA_SUFFIX;
 }
 
 string get_out_sites_file(const Config &config, int iter)
@@ -537,12 +636,43 @@ bool log_sequences(string chrom, const Sequences *sequences,
     return true;
 }
 
+// Appends an ARG to the archive
+bool log_arg_archive(
+    const ArgModel *model, const Sequences *sequences, LocalTrees *trees,
+    const SitesMapping* sites_mapping, const Config *config, int iter)
+{
+    ArgArchiveWriter *archive = config->archive;
+
+    // write local trees uncompressed
+    if (sites_mapping)
+        uncompress_local_trees(trees, sites_mapping);
+
+    bool result = true;
+    if (!archive->is_open()) {
+        string filename = get_out_archive_file(*config);
+        result = archive->open(filename.c_str(), trees, *sequences,
+                               model->times, model->ntimes, config->resume);
+    }
+    if (result)
+        result = archive->write_sample(trees, iter);
+
+    if (sites_mapping)
+        compress_local_trees(trees, sites_mapping);
+
+    return result;
+}
+
+
 bool log_local_trees(
     const ArgModel *model, const Sequences *sequences, LocalTrees *trees,
     const SitesMapping* sites_mapping, const Config *config, int iter)
 {
+    if (config->archive)
+        return log_arg_archive(model, sequences, trees, sites_mapping,
+                               config, iter);
+
     string out_arg_file = get_out_arg_file(*config, iter);
-    if (!config->no_compress_output)
+    if (!config->no_compress_output && !config->binary_output)
         out_arg_file += ".gz";
 
     // write local trees uncompressed
@@ -557,7 +687,11 @@ bool log_local_trees(
     }
 
 
-    write_local_trees(stream.stream, trees, sequences, model->times);
+    if (config->binary_output)
+        write_local_trees_binary(stream.stream, trees, *sequences,
+                                 model->times, model->ntimes);
+    else
+        write_local_trees(stream.stream, trees, sequences, model->times);
 
     if (sites_mapping)
         compress_local_trees(trees, sites_mapping);
@@ -566,6 +700,72 @@ bool log_local_trees(
 }
 
 
+// Writes the posterior coalescence times of each chromosome's thread
+bool log_thread_posterior(
+    const ArgModel *model, const Sequences *sequences, LocalTrees *trees,
+    const SitesMapping* sites_mapping, const Config *config, int iter)
+{
+    char iterstr[10];
+    snprintf(iterstr, 10, ".%d", iter);
+    string filename = config->out_prefix + iterstr + THREAD_POST_SUFFIX;
+    if (!config->no_compress_output)
+        filename += ".gz";
+
+    CompressStream stream(filename.c_str(), "w");
+    if (!stream.stream) {
+        printError("cannot write '%s'", filename.c_str());
+        return false;
+    }
+
+    // draw paths from a separate generator, so that logging does not
+    // change the samples that follow
+    unsigned int seed = config->randseed + iter;
+
+    fprintf(stream.stream, "##times=");
+    for (int j=0; j<model->ntimes; j++)
+        fprintf(stream.stream, j == 0 ? "%f" : ",%f", model->times[j]);
+    fprintf(stream.stream, "\n#chrom\tstart\tend\tname\tmean_time\tprobs\n");
+
+    for (unsigned int i=0; i<trees->seqids.size(); i++) {
+        const int chrom = trees->seqids[i];
+        ThreadTimePosterior posterior;
+        sample_thread_time_posterior(model, sequences, trees, chrom,
+                                     config->thread_posterior, &seed,
+                                     &posterior);
+
+        // get run coordinates in the uncompressed alignment
+        const int nruns = posterior.get_num_runs();
+        vector<int> runlens, runlens2;
+        for (int r=0; r<nruns; r++)
+            runlens.push_back(posterior.get_run_end(r) -
+                              posterior.get_run_start(r));
+        int start = posterior.start_coord;
+        if (sites_mapping) {
+            sites_mapping->uncompress_blocks(runlens, runlens2);
+            start = sites_mapping->old_start;
+        } else {
+            runlens2 = runlens;
+        }
+
+        for (int r=0; r<nruns; r++) {
+            double mean = 0.0;
+            for (int j=0; j<model->ntimes; j++)
+                mean += posterior.get_prob(r, j) * model->times[j];
+            fprintf(stream.stream, "%s\t%d\t%d\t%s\t%f\t",
+                    trees->chrom.c_str(), start, start + runlens2[r],
+                    sequences->names[chrom].c_str(), mean);
+            for (int j=0; j<model->ntimes; j++)
+                fprintf(stream.stream, j == 0 ? "%g" : ",%g",
+                        posterior.get_prob(r, j));
+            fprintf(stream.stream, "\n");
+            start += runlens2[r];
+        }
+    }
+
+    return true;
+}
+
+
 //=============================================================================
 
 
@@ -586,9 +786,30 @@ bool read_doubles(const char *filename, vector<double> &values) {
 }
 
 
+// Reads the initial ARG.  For an ARG archive, the sample of iteration
+// 'iter' is read, or the last sample if iter is -1.
 bool read_init_arg(const char *arg_file, const ArgModel *model,
-                   LocalTrees *trees, vector<string> &seqnames)
+                   LocalTrees *trees, vector<string> &seqnames, int iter=-1)
 {
+    if (is_arg_archive(arg_file)) {
+        ArgArchiveReader reader;
+        if (!reader.open(arg_file, model->times, model->ntimes))
+            return false;
+        int sample = (iter == -1 ? reader.get_num_samples() - 1 :
+                      reader.find_sample(iter));
+        if (sample < 0) {
+            printError("ARG archive '%s' has no sample for iteration %d",
+                       arg_file, iter);
+            return false;
+        }
+        seqnames = reader.seqnames;
+        return reader.read_sample(sample, trees);
+    }
+
+    if (is_local_trees_binary(arg_file))
+        return read_local_trees_binary(arg_file, model->times, model->ntimes,
+                                       trees, seqnames);
+
     CompressStream stream(arg_file, "r");
     if (!stream.stream) {
         printError("cannot read '%s'", arg_file);
@@ -613,6 +834,7 @@ void seq_sample_arg(ArgModel *model, Sequences *sequences, LocalTrees *trees,
                  sequences->get_num_seqs());
         printLog(LOG_LOW, "------------------------------------------------\n");
         sample_arg_seq(model, sequences, trees, true);
+        log_pruning(model);
         print_stats(config->stats_file, "seq", trees->get_num_leaves(),
                     model, sequences, trees, sites_mapping, config);
     }
@@ -631,6 +853,7 @@ void climb_arg(ArgModel *model, Sequences *sequences, LocalTrees *trees,
     for (int i=0; i<config->nclimb; i++) {
         printLog(LOG_LOW, "climb %d\n", i+1);
         resample_arg_climb(model, sequences, trees, recomb_preference);
+        log_pruning(model);
         print_stats(config->stats_file, "climb", i, model, sequences, trees,
                     sites_mapping, config);
     }
@@ -659,6 +882,9 @@ void resample_arg_all(ArgModel *model, Sequences *sequences, LocalTrees *trees,
         print_stats(config->stats_file, "resample", 0, model, sequences, trees,
                     sites_mapping, config);
         log_local_trees(model, sequences, trees, sites_mapping, config, 0);
+        if (config->thread_posterior > 0)
+            log_thread_posterior(model, sequences, trees, sites_mapping,
+                                 config, 0);
     }
 
 
@@ -668,12 +894,20 @@ void resample_arg_all(ArgModel *model, Sequences *sequences, LocalTrees *trees,
     for (int i=iter; i<=config->niters; i++) {
         printLog(LOG_LOW, "sample %d\n", i);
         Timer timer;
+
+        // switch to the exact forward algorithm after burn-in
+        if (model->pruning && i > config->prune_iters) {
+            printLog(LOG_LOW, "disabling forward pruning\n");
+            model->pruning = NULL;
+        }
+
         if (config->gibbs)
             resample_arg(model, sequences, trees);
         else
             resample_arg_mcmc_all(model, sequences, trees, frac_leaf,
                                   window, step, niters);
         printTimerLog(timer, LOG_LOW, "sample time:");
+        log_pruning(model);
 
 
         // logging
@@ -681,8 +915,12 @@ void resample_arg_all(ArgModel *model, Sequences *sequences, LocalTrees *trees,
                     sites_mapping, config);
 
         // sample saving
-        if (i % config->sample_step == 0)
+        if (i % config->sample_step == 0) {
             log_local_trees(model, sequences, trees, sites_mapping, config, i);
+            if (config->thread_posterior > 0)
+                log_thread_posterior(model, sequences, trees, sites_mapping,
+                                     config, i);
+        }
 
         if (config->sample_phase > 0 && i%config->sample_phase == 0)
             log_sequences(trees->chrom, sequences, config, sites_mapping, i);
@@ -733,7 +971,8 @@ void sample_arg(ArgModel *model, Sequences *sequences, LocalTrees *trees,
 //=============================================================================
 
 bool parse_status_line(const char* line, const Config &config,
-                       string &stage, int &iter, string &arg_file)
+                       string &stage, int &iter, string &arg_file,
+                       const ArgArchiveReader *archive=NULL)
 {
     // parse stage and last iter
     vector<string> tokens;
@@ -754,6 +993,16 @@ bool parse_status_line(const char* line, const Config &config,
     if (stage2 != "resample")
         return true;
 
+    // see if ARG archive has the sample
+    if (archive) {
+        if (archive->find_sample(iter2) != -1) {
+            stage = stage2;
+            iter = iter2;
+            arg_file = get_out_archive_file(config);
+        }
+        return true;
+    }
+
     // see if ARG file exists
     string out_arg_file = get_out_arg_file(config, iter2);
     struct stat st;
@@ -806,11 +1055,22 @@ bool setup_resume(Config &config)
     }
     delete [] line;
 
+    // samples of ARG archive
+    ArgArchiveReader archive;
+    if (config.archive_output) {
+        string archive_file = get_out_archive_file(config);
+        struct stat st;
+        if (stat(archive_file.c_str(), &st) == 0 &&
+            !archive.open(archive_file.c_str()))
+            return false;
+    }
+
     // loop through status lines
     string arg_file = "";
     while ((line = fgetline(stats_file))) {
         if (!parse_status_line(
-            line, config, config.resume_stage, config.resume_iter, arg_file)) {
+            line, config, config.resume_stage, config.resume_iter, arg_file,
+            config.archive_output ? &archive : NULL)) {
             delete [] line;
             return false;
         }
@@ -1089,6 +1349,33 @@ int main(int argc, char **argv)
 	c.model.unphased = true;
     c.model.sample_phase = c.sample_phase;
 
+    // setup approximate forward algorithm
+    if (c.prune_threshold > 0.0) {
+        c.pruning = ForwardPruning(c.prune_threshold, c.prune_runlen,
+                                   c.prune_tolerance);
+        c.model.pruning = &c.pruning;
+    }
+    if (c.thread_posterior < 0) {
+        printError("--thread-posterior must be non-negative");
+        return EXIT_ERROR;
+    }
+    if (c.forward_threads < 1) {
+        printError("--forward-threads must be at least 1");
+        return EXIT_ERROR;
+    }
+    if (c.forward_tol < 0.0) {
+        printError("--forward-tol must be non-negative");
+        return EXIT_ERROR;
+    }
+    c.model.forward_threads = c.forward_threads;
+    c.model.forward_tol = c.forward_tol;
+    if (c.archive_output)
+        c.archive = new ArgArchiveWriter(c.archive_chunk);
+    // phases of unphased data are resampled with every thread, which
+    // changes the alignment that cached likelihoods were computed from
+    if (c.model.unphased)
+        c.no_likelihood_cache = true;
+
     // read model parameter maps if given
     if (c.mutmap != "") {
         CompressStream stream(c.mutmap.c_str(), "r");
@@ -1127,7 +1414,8 @@ int main(int argc, char **argv)
         trees = new LocalTrees();
         trees_ptr = auto_ptr<LocalTrees>(trees);
         vector<string> seqnames;
-        if (!read_init_arg(c.arg_file.c_str(), &c.model, trees, seqnames)) {
+        if (!read_init_arg(c.arg_file.c_str(), &c.model, trees, seqnames,
+                           c.resume ? c.resume_iter : -1)) {
             printError("could not read ARG");
             return EXIT_ERROR;
         }
@@ -1196,6 +1484,12 @@ int main(int argc, char **argv)
     printLog(LOG_LOW, "\n");
     sample_arg(&model, &sequences, trees, sites_mapping, &c);
 
+    if (c.archive) {
+        printLog(LOG_LOW, "ARG archive: %d samples, %ld chunks written\n",
+                 c.archive->nsamples, c.archive->nchunks_written);
+        delete c.archive;
+    }
+
     // final log message
     maxrss = get_max_memory_usage() / 1000.0;
     printTimerLog(timer, LOG_LOW, "sampling time: ");
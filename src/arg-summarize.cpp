@@ -4,6 +4,7 @@
 #include <memory>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <iostream>
 #include <fstream>
 #include <getopt.h>
@@ -15,6 +16,7 @@
 #include <map>
 
 // argweaver includes
+#include "argweaver/arg_archive.h"
 #include "argweaver/ConfigParam.h"
 #include "argweaver/logging.h"
 #include "argweaver/parsing.h"
@@ -62,7 +64,9 @@ public:
                     "Bed file containing args sampled by ARGweaver. Should"
                     " be created with smc2bed and sorted with sort-bed. If"
                     " using --region or --bedfile, also needs to be gzipped"
-                    " and tabix'd"));
+                    " and tabix'd (smc2bed --output does all of this)."
+                    " Alternatively, an ARG archive (*.arga)"
+                    " written by arg-sample --archive-output"));
         config.add(new ConfigParam<string>
                    ("-r", "--region", "<chr:start-end>", &region,
                     "region to retrieve statistics from (1-based coords)"));
@@ -152,10 +156,21 @@ public:
         config.add(new ConfigParam<string>
                    ("-Q", "--quantile", "<q1,q2,q3,...>", &quantile,
                     "return the requested quantiles for each samples"));
+        config.add(new ConfigSwitch
+                   ("", "--streaming", &streaming,
+                    "summarize with constant memory per region instead of"
+                    " keeping all values. Means are exact, standard"
+                    " deviations agree up to rounding, and quantiles are"
+                    " exact up to 1000 samples and approximated by a"
+                    " t-digest beyond"));
 
         config.add(new ConfigParamComment("Misceallaneous"));
         config.add(new ConfigSwitch
                    ("-n", "--no-header", &noheader, "Do not output header"));
+        config.add(new ConfigParam<int>
+                   ("-p", "--threads", "<n>", &nthreads, 1,
+                    "number of threads. MCMC samples are split among the"
+                    " threads (not used with --snp-file; default=1)"));
         config.add(new ConfigParam<string>
                    ("-t", "--tabix-dir", "<tabix dir>", &tabix_dir,
                     "Specify the directory of the tabix executable"));
@@ -207,8 +222,10 @@ public:
     bool mean;
     bool stdev;
     string quantile;
+    bool streaming;
 
     bool noheader;
+    int nthreads;
     string tabix_dir;
     bool version;
     bool help;
@@ -255,12 +272,67 @@ void checkResults(IntervalIterator<vector<double> > *results) {
     }
 }
 
+void checkResults(IntervalIterator<vector<double>, IntervalSummary> *results) {
+    IntervalSummary summary=results->next();
+    while (summary.start != summary.end) {
+        cout << summary.chrom << "\t" << summary.start << "\t"
+             << summary.end;
+        if (summary.num_score() > 0) {
+            int numscore = summary.num_stats();
+            assert(numscore > 0);
+            for (int i=0; i < numscore; i++) {
+                if (i==0 && getNumSample > 0)
+                    printf("\t%i", summary.num_score());
+                for (int j=1; j <= summarize; j++) {
+                    if (getMean==j) {
+                        printf("\t%g", summary.mean(i));
+                    } else if (getStdev==j) {
+                        if (summary.num_score() <= 1)
+                            printError("Error: trying to get stdev with %i"
+                                       " scores\n", summary.num_score());
+                        printf("\t%g", summary.stdev(i));
+                    } else if (getQuantiles==j) {
+                        vector<double> q = summary.quantiles(i, quantiles);
+                        for (unsigned int k=0; k < quantiles.size(); k++) {
+                            printf("\t%g", q[k]);
+                        }
+                    }
+                }
+            }
+            printf("\n");
+        }
+        summary = results->next();
+    }
+}
+
+// Leaf bitsets and SNP individuals of the leaves of a local tree.  These
+// are computed once per tree and shared by all the SNPs that fall within it.
+class SnpTreeIndex {
+public:
+    SnpTreeIndex(Tree *tree, const map<string,int> &ind_index) :
+        tree(tree), leafsets(tree), leaf_ind(tree->nnodes, -1)
+    {
+        for (map<string,int>::iterator it=tree->nodename_map.begin();
+             it != tree->nodename_map.end(); ++it) {
+            if (!tree->nodes[it->second]->isLeaf()) continue;
+            map<string,int>::const_iterator it2 = ind_index.find(it->first);
+            if (it2 != ind_index.end())
+                leaf_ind[it->second] = it2->second;
+        }
+    }
+
+    Tree *tree;
+    LeafSets leafsets;
+    vector<int> leaf_ind;  // SNP individual of each leaf (-1 if none)
+};
+
+
 class BedLine {
 public:
     BedLine(char *chr, int start, int end, int sample, char *nwk,
             SprPruned *trees=NULL) :
-        start(start), end(end), sample(sample),
-        trees(trees) {
+        start(start), end(end), sample(sample), rank(0),
+        trees(trees), snp_index(NULL) {
         chrom = new char[strlen(chr)+1];
         strcpy(chrom, chr);
         if (nwk != NULL) {
@@ -274,13 +346,38 @@ public:
         delete [] chrom;
         if (newick != NULL)
             free(newick);
+        if (snp_index != NULL)
+            delete snp_index;
         //        delete trees;
     }
+
+    // Returns the SNP index of the current tree
+    SnpTreeIndex *get_snp_index(Tree *tree, const map<string,int> &ind_index)
+    {
+        if (snp_index == NULL || snp_index->tree != tree) {
+            if (snp_index != NULL)
+                delete snp_index;
+            snp_index = new SnpTreeIndex(tree, ind_index);
+        }
+        return snp_index;
+    }
+
+    // Drops statistics and indexes of the previous tree
+    void tree_changed()
+    {
+        stats.clear();
+        if (snp_index != NULL)
+            delete snp_index;
+        snp_index = NULL;
+    }
+
     char *chrom;
     int start;
     int end;
     int sample;
+    long rank; // order among lines with the same start
     SprPruned *trees;
+    SnpTreeIndex *snp_index;
     char *newick;
     vector<double> stats;
     char derAllele, otherAllele;
@@ -291,12 +388,10 @@ public:
 
 void scoreBedLine(BedLine *line, vector<string> &statname, vector<double> times,
                   double allele_age=-1, int infsites=-1) {
-    Tree * tree = (line->trees->pruned_tree != NULL ?
-                   line->trees->pruned_tree :
-                   line->trees->orig_tree);
     double bl=-1.0;
     int node_dist_idx=0;
     if (line->stats.size() == statname.size()) return;
+    TreeStats *tree = line->trees->get_stats(times);
     line->stats.resize(statname.size());
     for (unsigned int i=0; i < statname.size(); i++) {
         if (statname[i] == "tmrca")
@@ -324,12 +419,13 @@ void scoreBedLine(BedLine *line, vector<string> &statname, vector<double> times,
             line->stats[i] = tree->num_zero_branches();
         }
         else if (statname[i]=="tree") {
-            if (line->trees->pruned_tree != NULL) {
-                string tmp =
-                    line->trees->pruned_tree->format_newick(false, true, 1,
-                                                     &line->trees->pruned_spr);
-                //pruned tree will be fewer characters than whole tree
-                sprintf(line->newick, "%s", tmp.c_str());
+            // format the tree unless it was read as text and not pruned
+            if (line->trees->pruned_tree != NULL || line->newick == NULL) {
+                string tmp = line->trees->format_newick(false, true, 1);
+                if (line->newick != NULL)
+                    free(line->newick);
+                line->newick = (char*)malloc((tmp.size()+1)*sizeof(char));
+                strcpy(line->newick, tmp.c_str());
             }
         }
         else if (statname[i]=="allele_age")
@@ -343,7 +439,7 @@ void scoreBedLine(BedLine *line, vector<string> &statname, vector<double> times,
             node_dist_idx++;
         }
         else if (statname[i].substr(0, 10)=="coalcount.") {
-            vector<double>coal_counts = tree->coalCounts(times);
+            const vector<double> &coal_counts = tree->coalCounts();
             for (unsigned int j=0; j < coal_counts.size(); j++) {
                 assert(i+j < statname.size() &&
                        statname[i+j].substr(0,10)=="coalcount.");
@@ -381,8 +477,8 @@ struct CompareBedLineEnd
     }
 };
 
-void processNextBedLine(BedLine *line,
-                        IntervalIterator<vector<double> > *results,
+template <class resultsT>
+void processNextBedLine(BedLine *line, resultsT *results,
                         vector<string> &statname,
                         char *region_chrom, int region_start, int region_end,
                         vector<double> times) {
@@ -443,7 +539,10 @@ void processNextBedLine(BedLine *line,
 
 class SnpStream {
 public:
-    SnpStream(TabixStream *snp_in) : snp_in(snp_in) {
+    // 'ind_index' maps the individuals of the SNP file to their columns.
+    // It is kept by the caller so that it is shared across regions.
+    SnpStream(TabixStream *snp_in, map<string,int> *ind_index) :
+        snp_in(snp_in), ind_index(ind_index) {
         char tmp[1000], c;
         string str;
         assert(1==fscanf(snp_in->stream, "%s", tmp));
@@ -456,6 +555,18 @@ public:
             inds.push_back(str);
         }
         if (c==EOF) done=1;
+
+        bool same = (ind_index->size() == inds.size());
+        for (unsigned int i=0; same && i < inds.size(); i++) {
+            map<string,int>::iterator it = ind_index->find(inds[i]);
+            same = (it != ind_index->end() && it->second == (int) i);
+        }
+        if (!same) {
+            ind_index->clear();
+            for (unsigned int i=0; i < inds.size(); i++)
+                (*ind_index)[inds[i]] = i;
+        }
+        ind_allele.resize(inds.size());
     }
 
     int readNext() {
@@ -469,10 +580,10 @@ public:
         assert(tmpStart==coord-1);
         assert('\t' == fgetc(snp_in->stream));
         allele1=allele2='N';
-        allele1_inds.clear();
-        allele2_inds.clear();
+        int count1=0, count2=0;
         for (unsigned int i=0; i < inds.size(); i++) {
             a=fgetc(snp_in->stream);
+            ind_allele[i] = 0;
             if (a=='N') continue;
             a = toupper(a);
             assert(a=='A' || a=='C' || a=='G' || a=='T');
@@ -480,22 +591,23 @@ public:
                 allele1=a;
             }
             if (a==allele1) {
-                allele1_inds.insert(inds[i]);
+                ind_allele[i] = 1;
+                count1++;
             } else {
                 if (allele2=='N')
                     allele2=a;
                 else assert(a==allele2);
-                allele2_inds.insert(inds[i]);
+                ind_allele[i] = 2;
+                count2++;
             }
         }
         //make sure that allele1 is always minor allele
-        if (allele1_inds.size() > allele2_inds.size()) {
-            set<string> tmp;
-            char tmpch;
-            tmp = allele1_inds;
-            allele1_inds = allele2_inds;
-            allele2_inds = tmp;
-            tmpch=allele1;
+        if (count1 > count2) {
+            for (unsigned int i=0; i < inds.size(); i++) {
+                if (ind_allele[i] != 0)
+                    ind_allele[i] = 3 - ind_allele[i];
+            }
+            char tmpch=allele1;
             allele1=allele2;
             allele2=tmpch;
         }
@@ -503,8 +615,8 @@ public:
     }
 
 
-    void scoreAlleleAge(BedLine *l, vector<string> statname,
-                        vector<double> times) {
+    void scoreAlleleAge(BedLine *l, vector<string> &statname,
+                        vector<double> &times) {
         int num_derived, total;
         assert(l->start < coord);
         assert(l->end >= coord);
@@ -512,66 +624,85 @@ public:
         if (l->trees->pruned_tree != NULL)
             t = l->trees->pruned_tree;
         else t = l->trees->orig_tree;
-
-        set<string> prune;
-        set<string> derived_in_tree;
-        for (map<string,int>::iterator it=t->nodename_map.begin();
-             it != t->nodename_map.end(); ++it) {
-            if (t->nodes[it->second]->nchildren != 0) continue;
-            if (allele1_inds.find(it->first) != allele1_inds.end())
-                derived_in_tree.insert(it->first);
-            else if (allele2_inds.find(it->first) == allele2_inds.end())
-                prune.insert(it->first);
-        }
-        set<Node*> derived;
-        for (set<string>::iterator it=derived_in_tree.begin();
-             it != derived_in_tree.end(); ++it) {
-            map<string,int>::iterator it2 = t->nodename_map.find(*it);
-            assert(it2 != t->nodename_map.end());
-            derived.insert(t->nodes[it2->second]);
+        SnpTreeIndex *index = l->get_snp_index(t, *ind_index);
+
+        // the leaves with the minor allele
+        const LeafSets &leafsets = index->leafsets;
+        derived.assign(leafsets.nwords, 0);
+        num_derived = 0;
+        for (int i=0; i < t->nnodes; i++) {
+            const int ind = index->leaf_ind[i];
+            if (ind >= 0 && ind_allele[ind] == 1) {
+                leafsets.add_leaf(t->nodes[i], &derived[0]);
+                num_derived++;
+            }
         }
-        num_derived = (int)derived.size();
         total = (t->nnodes+1)/2;
 
-        set<Node*>lca = t->lca(derived);
-        set<Node*>lca2;
-        int major_is_derived=0;
-        if (lca.size() > 1) {
-            set<Node*> derived2;
-            for (map<string,int>::iterator it=t->nodename_map.begin();
-                 it != t->nodename_map.end(); ++it) {
-                if (t->nodes[it->second]->nchildren != 0) continue;
-                if (derived.find(t->nodes[it->second]) == derived.end()) {
-                    derived2.insert(t->nodes[it->second]);
+        // The lca of a set of leaves is the set of maximal subtrees whose
+        // leaves are all in the set.  Find it for both the minor allele
+        // and the major allele (all other leaves), with the age of the
+        // oldest subtree (midpoint of its branch).  Only the subtrees with
+        // both alleles are descended into.
+        int nlca=0, nlca2=0;
+        double age=0.0, age2=0.0;
+        if (leafsets.subset(t->root, &derived[0])) {
+            // only when the tree has a single allele
+            nlca++;
+        } else if (leafsets.disjoint(t->root, &derived[0])) {
+            nlca2++;
+        } else {
+            mixed.assign(1, t->root);
+            while (!mixed.empty()) {
+                Node *n = mixed.back();
+                mixed.pop_back();
+                for (int j=0; j < n->nchildren; j++) {
+                    Node *c = n->children[j];
+                    const double tempage = c->age + (n->age - c->age)/2;
+                    if (leafsets.subset(c, &derived[0])) {
+                        nlca++;
+                        if (tempage > age) age = tempage;
+                    } else if (leafsets.disjoint(c, &derived[0])) {
+                        nlca2++;
+                        if (tempage > age2) age2 = tempage;
+                    } else {
+                        mixed.push_back(c);
+                    }
                 }
             }
-            set <Node*>lca2 = t->lca(derived2);
-            if (lca2.size() < lca.size()) {
-                major_is_derived=1;
-                lca = lca2;
-            }
         }
-        double age=0.0;
-        for (set<Node*>::iterator it4=lca.begin(); it4 != lca.end(); ++it4) {
-            Node *n = *it4;
-            assert(n != t->root);
-            double tempage = n->age + (n->parent->age - n->age)/2;  //midpoint
-            if (tempage > age) age = tempage;
+        int major_is_derived=0;
+        if (nlca > 1 && nlca2 < nlca) {
+            major_is_derived=1;
+            nlca = nlca2;
+            age = age2;
         }
         if (num_derived == 0 || total-num_derived == 0) age = -1;
-        scoreBedLine(l, statname, times, age, lca.size()==1);
+
+        // statistics of the tree are kept across the SNPs within it
+        if (l->stats.size() == statname.size()) {
+            for (unsigned int i=0; i < statname.size(); i++) {
+                if (statname[i] == "allele_age")
+                    l->stats[i] = age;
+                else if (statname[i] == "inf_sites")
+                    l->stats[i] = (double) (nlca == 1);
+            }
+        } else {
+            scoreBedLine(l, statname, times, age, nlca==1);
+        }
         l->derAllele = (major_is_derived ? allele2 : allele1);
         l->otherAllele = (major_is_derived ? allele1 : allele2);
         l->derFreq = (major_is_derived ? total-num_derived : num_derived);
         l->otherFreq = (major_is_derived ? num_derived : total - num_derived);
-        l->infSites = (lca.size() == 1);
-
+        l->infSites = (nlca == 1);
     }
 
     TabixStream *snp_in;
+    map<string,int> *ind_index;
     vector<string> inds;
-    set<string> allele1_inds;
-    set<string> allele2_inds;
+    vector<char> ind_allele;  // 1: minor allele, 2: major allele, 0: N
+    vector<LeafSets::Word> derived;  // leaves with the minor allele
+    vector<Node*> mixed;      // subtrees with both alleles left to descend
     char allele1, allele2;  //minor allele, major allele
     char chr[100];
     int coord;  //1-based
@@ -612,33 +743,299 @@ void print_summaries(vector<double> &stat) {
 }
 
 
+//=============================================================================
+// input of local trees
+
+
+// A stream of local trees from all MCMC samples, sorted by start
+// coordinate.  A stream may be restricted to one of 'nparts' partitions
+// of the samples, so that several streams over the same input cover each
+// sample exactly once.
+class TreeStream {
+public:
+    TreeStream(int part=0, int nparts=1) : part(part), nparts(nparts) {}
+    virtual ~TreeStream() {}
+
+    // Moves to the next tree.  Returns false at the end of the stream.
+    virtual bool next(char *chrom, int &start, int &end, int &sample) = 0;
+
+    // Returns the order of the current tree among the trees with the same
+    // start coordinate in the unpartitioned stream
+    virtual long get_rank() = 0;
+
+    // Returns the newick string of the current tree, or NULL if trees are
+    // not read as text.  The string belongs to the stream.
+    virtual char *get_newick() { return NULL; }
+
+    // Updates the trees of the sample of the current tree, which must
+    // hold the previous tree of the sample.  If trees is NULL, new trees
+    // are returned.
+    virtual SprPruned *update_trees(SprPruned *trees,
+                                    const set<string> &inds,
+                                    const vector<double> &times) = 0;
+
+    int part;
+    int nparts;
+};
+
+
+// Local trees from a bed file written by smc2bed.  Samples are assigned
+// to partitions in the order they first appear.
+class BedTreeStream : public TreeStream {
+public:
+    BedTreeStream(Config *config, const char *region, int part=0,
+                  int nparts=1) :
+        TreeStream(part, nparts), newick(NULL), nlines(0) {
+        infile = new TabixStream(config->argfile, region, config->tabix_dir);
+        if (infile->stream == NULL) return;
+
+        // skip header lines
+        char c;
+        while (EOF != (c=fgetc(infile->stream))) {
+            ungetc(c, infile->stream);
+            if (c!='#') break;
+            while ('\n' != (c=fgetc(infile->stream))) {
+                if (c==EOF) break;
+            }
+        }
+    }
+    ~BedTreeStream() {
+        if (newick != NULL) delete [] newick;
+        infile->close();
+        delete infile;
+    }
+
+    bool next(char *chrom, int &start, int &end, int &sample) {
+        if (newick != NULL) {
+            delete [] newick;
+            newick = NULL;
+        }
+        while (true) {
+            if (infile->stream == NULL ||
+                4 != fscanf(infile->stream, "%s %i %i %i",
+                            chrom, &start, &end, &sample))
+                return false;
+            nlines++;
+            int c = fgetc(infile->stream);
+            assert(c == '\t');
+            if (get_part(sample) == part)
+                break;
+
+            // skip trees of other partitions without parsing them
+            while (c != '\n' && c != EOF)
+                c = fgetc(infile->stream);
+        }
+        newick = fgetline(infile->stream);
+        chomp(newick);
+        return true;
+    }
+
+    // lines are sorted by start, so the line number is a rank
+    long get_rank() { return nlines; }
+
+    char *get_newick() { return newick; }
+
+    SprPruned *update_trees(SprPruned *trees, const set<string> &inds,
+                            const vector<double> &times) {
+        if (trees == NULL)
+            return new SprPruned(newick, inds, times);
+        trees->update(newick, inds, times);
+        return trees;
+    }
+
+    TabixStream *infile;
+    char *newick;
+
+protected:
+    int get_part(int sample) {
+        if (nparts == 1)
+            return 0;
+        map<int,int>::iterator it = parts.find(sample);
+        if (it != parts.end())
+            return it->second;
+        int p = parts.size() % nparts;
+        parts[sample] = p;
+        return p;
+    }
+
+    long nlines;
+    map<int,int> parts;
+};
+
+
+// Local trees from an ARG archive.  Each sample is walked with a cursor
+// over the memory-mapped archive and the cursors are merged by start
+// coordinate.  Trees are updated by applying the stored SPRs directly.
+// Sample i belongs to partition i % nparts.
+class ArchiveTreeStream : public TreeStream {
+public:
+    ArchiveTreeStream(Config *config, const char *region, int part=0,
+                      int nparts=1) :
+        TreeStream(part, nparts), ok(false), current(NULL) {
+        if (!archive.open(config->argfile.c_str()))
+            return;
+        region_start = archive.start_coord;
+        region_end = archive.end_coord;
+        if (region != NULL) {
+            vector<string> token;
+            split(region, "[:-]", token);
+            if (token.size() != 3 || token[0] != archive.chrom) {
+                ok = true;
+                return;
+            }
+            token[1].erase(std::remove(token[1].begin(), token[1].end(),
+                                       ','), token[1].end());
+            token[2].erase(std::remove(token[2].begin(), token[2].end(),
+                                       ','), token[2].end());
+            region_start = max(region_start, atoi(token[1].c_str())-1);
+            region_end = min(region_end, atoi(token[2].c_str()));
+        }
+        for (unsigned int i=0; i<archive.seqnames.size(); i++)
+            names.push_back(archive.seqnames[i].c_str());
+        ptree.resize(archive.nnodes);
+        ages.resize(archive.nnodes);
+
+        if (region_start < region_end) {
+            cursors.resize(archive.get_num_samples(), NULL);
+            for (unsigned int i=part; i<cursors.size(); i+=nparts) {
+                cursors[i] = new ArgArchiveCursor(&archive, i, region_start);
+                if (!advance(cursors[i], i))
+                    return;
+            }
+        }
+        ok = true;
+    }
+    ~ArchiveTreeStream() {
+        for (unsigned int i=0; i<cursors.size(); i++)
+            delete cursors[i];
+    }
+
+    bool next(char *chrom, int &start, int &end, int &sample) {
+        // the last tree has been used; move its cursor on
+        if (current != NULL) {
+            int i = current_sample;
+            current = NULL;
+            if (!advance(cursors[i], i)) {
+                ok = false;
+                return false;
+            }
+        }
+        if (queue.empty())
+            return false;
+        current_sample = -queue.top().second;
+        current = cursors[current_sample];
+        queue.pop();
+
+        strcpy(chrom, archive.chrom.c_str());
+        start = current->start;
+        end = current->end;
+        sample = archive.get_sample_iter(current_sample);
+        return true;
+    }
+
+    // trees with the same start are ordered by sample
+    long get_rank() { return current_sample; }
+
+    SprPruned *update_trees(SprPruned *trees, const set<string> &inds,
+                            const vector<double> &times) {
+        const Spr &spr = current->spr;
+        if (trees != NULL && trees->orig_spr.recomb_node != NULL) {
+            trees->update(get_node_spr(trees->orig_tree, spr));
+            return trees;
+        }
+
+        // build trees from the current tree
+        const LocalTree *tree = current->tree;
+        const double *file_times = &archive.file_times[0];
+        for (int i=0; i<tree->nnodes; i++) {
+            ptree[i] = tree->nodes[i].parent;
+            ages[i] = file_times[tree->nodes[i].age];
+        }
+        Tree *tree2 = makeTree(tree->nnodes, &ptree[0], &ages[0], &names[0]);
+        NodeSpr spr2 = get_node_spr(tree2, spr);
+        if (trees == NULL)
+            return new SprPruned(tree2, spr2, inds);
+        trees->set_tree(tree2, spr2, inds);
+        return trees;
+    }
+
+    bool ok;
+
+protected:
+    // Moves a cursor to its next tree within the region and queues it
+    bool advance(ArgArchiveCursor *cursor, int sample) {
+        do {
+            if (!cursor->next())
+                return !cursor->error;
+        } while (cursor->end <= region_start);
+        if (cursor->start < region_end)
+            queue.push(make_pair(-cursor->start, -sample));
+        return true;
+    }
+
+    NodeSpr get_node_spr(Tree *tree, const Spr &spr) {
+        if (spr.is_null())
+            return NodeSpr();
+        const double *file_times = &archive.file_times[0];
+        return NodeSpr(tree, spr.recomb_node, file_times[spr.recomb_time],
+                       spr.coal_node, file_times[spr.coal_time]);
+    }
+
+    ArgArchiveReader archive;
+    vector<const char*> names;
+    int region_start;
+    int region_end;
+    vector<ArgArchiveCursor*> cursors;
+    ArgArchiveCursor *current;
+    int current_sample;
+    priority_queue<pair<int,int> > queue;
+    vector<int> ptree;
+    vector<double> ages;
+};
+
+
+TreeStream *open_tree_stream(Config *config, const char *region,
+                             int part=0, int nparts=1) {
+    if (is_arg_archive(config->argfile.c_str())) {
+        ArchiveTreeStream *stream = new ArchiveTreeStream(config, region,
+                                                          part, nparts);
+        if (!stream->ok) {
+            delete stream;
+            return NULL;
+        }
+        return stream;
+    }
+
+    BedTreeStream *stream = new BedTreeStream(config, region, part, nparts);
+    if (stream->infile->stream == NULL) {
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
+
+
 int summarizeRegionBySnp(Config *config, const char *region,
                          set<string> inds, vector<string> statname,
                          vector<double> times) {
     TabixStream snp_infile(config->snpfile, region, config->tabix_dir);
-    TabixStream infile(config->argfile, region, config->tabix_dir);
     vector<string> token;
     map<int,BedLine*> last_entry;
     map<int,BedLine*>::iterator it;
-    char chrom[1000], c;
+    char chrom[1000];
     int start, end, sample;
     BedLine *l=NULL;
 
     if (snp_infile.stream == NULL) return 1;
-    if (infile.stream == NULL) return 1;
-    while (EOF != (c=fgetc(infile.stream))) {
-        ungetc(c, infile.stream);
-        if (c != '#') break;
-        while ('\n' != (c=fgetc(infile.stream))) {
-            if (c==EOF) return 0;
-        }
+    TreeStream *infile = open_tree_stream(config, region);
+    if (infile == NULL) return 1;
+    // individuals of the SNP file, shared across regions
+    static map<string,int> ind_index;
+    SnpStream snpStream = SnpStream(&snp_infile, &ind_index);
+    if (!infile->next(chrom, start, end, sample)) {
+        delete infile;
+        return 0;
     }
-    SnpStream snpStream = SnpStream(&snp_infile);
-    if (EOF==fscanf(infile.stream, "%s %i %i %i",
-                    chrom, &start, &end, &sample)) return 0;
-    assert('\t' == fgetc(infile.stream));
-    char *newick = fgetline(infile.stream);
-    chomp(newick);
 
     while (1) {
         list<BedLine*> bedlist;
@@ -664,15 +1061,23 @@ int summarizeRegionBySnp(Config *config, const char *region,
                     delete l->trees;
                     delete &*l;
                 }
-                trees = new SprPruned(newick, inds, times);
-                l = new BedLine(chrom, start, end, sample, newick, trees);
+                trees = infile->update_trees(NULL, inds, times);
+                l = new BedLine(chrom, start, end, sample,
+                                infile->get_newick(), trees);
                 last_entry[sample] = l;
             } else {
                 l = it->second;
-                l->trees->update(newick, inds, times);
-                free(l->newick);
-                l->newick = (char*)malloc((strlen(newick)+1)*sizeof(char));
-                strcpy(l->newick, newick);
+                infile->update_trees(l->trees, inds, times);
+                l->tree_changed();
+                if (l->newick != NULL)
+                    free(l->newick);
+                l->newick = NULL;
+                char *newick = infile->get_newick();
+                if (newick != NULL) {
+                    l->newick =
+                        (char*)malloc((strlen(newick)+1)*sizeof(char));
+                    strcpy(l->newick, newick);
+                }
                 l->start = start;
                 l->end = end;
             }
@@ -680,15 +1085,8 @@ int summarizeRegionBySnp(Config *config, const char *region,
                 snpStream.scoreAlleleAge(l, statname, times);
                 bedlist.push_back(l);
             }
-            if (4 != fscanf(infile.stream, "%s %i %i %i",
-                            chrom, &start, &end, &sample))
+            if (!infile->next(chrom, start, end, sample))
                 start = -1;
-            else {
-                assert('\t' == fgetc(infile.stream));
-                delete [] newick;
-                newick = fgetline(infile.stream);
-                chomp(newick);
-            }
         }
         if (bedlist.size() > 0) {
             if (summarize == 0) {
@@ -710,7 +1108,6 @@ int summarizeRegionBySnp(Config *config, const char *region,
                         }
                     }
                     printf("\n");
-                    l->stats.clear();
                 }
             } else {
                 //now output three versions- one for all samples,
@@ -760,7 +1157,6 @@ int summarizeRegionBySnp(Config *config, const char *region,
                             BedLine *l = *it;
                             if (l->infSites)
                                 stat.push_back(l->stats[i]);
-                            l->stats.clear();
                         }
                         print_summaries(stat);
                     }
@@ -769,7 +1165,7 @@ int summarizeRegionBySnp(Config *config, const char *region,
             }
         }
     }
-    delete [] newick;
+    delete infile;
 
     for (map<int,BedLine*>::iterator it=last_entry.begin();
          it != last_entry.end(); ++it) {
@@ -781,16 +1177,25 @@ int summarizeRegionBySnp(Config *config, const char *region,
 }
 
 
-int summarizeRegionNoSnp(Config *config, const char *region,
-                         set<string> inds, vector<string>statname,
-                         vector<double> times) {
-    TabixStream *infile;
-    char c;
-    char *region_chrom = NULL;
+//=============================================================================
+// scoring of local trees
+
+
+// Receives scored lines in the order of a tree stream
+class LineSink {
+public:
+    virtual ~LineSink() {}
+    virtual void put(BedLine *line) = 0;
+};
+
+
+// Reads all trees of a stream, scores them, and passes each line to
+// 'sink' once it is complete
+void scoreTreeStream(TreeStream *infile, const set<string> &inds,
+                     vector<string> &statname, const vector<double> &times,
+                     LineSink *sink) {
     char chrom[1000];
-    vector<string> token;
-    int region_start=-1, region_end=-1, start, end, sample;
-    IntervalIterator<vector<double> > results;
+    int start, end, sample;
     queue<BedLine*> bedlineQueue;
     map<int,BedLine*> bedlineMap;
     map<int,SprPruned*> trees;
@@ -840,64 +1245,18 @@ int summarizeRegionNoSnp(Config *config, const char *region,
 
     */
 
-
-    infile = new TabixStream(config->argfile, region, config->tabix_dir);
-    if (infile->stream == NULL) return 1;
-
-    //parse region to get region_chrom, region_start, region_end.
-    // these are only needed to truncate results which fall outside
-    // of the boundaries (tabix returns anything that overlaps)
-    if (region != NULL) {
-        split(region, "[:-]", token);
-        if (token.size() != 3) {
-            fprintf(stderr,
-                    "Error: bad region format (%s); should be chr:start-end\n",
-                    region);
-            return 1;
-        }
-        region_chrom = new char[token[0].size()+1];
-        //remove commas from integer coordinates in case they are
-        // copied from browser
-        token[1].erase(std::remove(token[1].begin(), token[1].end(), ','),
-                       token[1].end());
-        token[2].erase(std::remove(token[2].begin(), token[2].end(), ','),
-                       token[2].end());
-        strcpy(region_chrom, token[0].c_str());
-        region_start = atoi(token[1].c_str())-1;
-        region_end = atoi(token[2].c_str());
-    }
-    while (EOF != (c=fgetc(infile->stream))) {
-        ungetc(c, infile->stream);
-        if (c!='#') break;
-        while ('\n' != (c=fgetc(infile->stream))) {
-            if (c==EOF) return 0;
-        }
-    }
-    int parse_tree = (inds.size() > 0);
-    if (!parse_tree) {
-        for (unsigned int i=0; i < statname.size(); i++) {
-            if (statname[i]!="tree") {
-                parse_tree=1;
-                break;
-            }
-        }
-    }
-
-    while (EOF != fscanf(infile->stream, "%s %i %i %i",
-                         chrom, &start, &end, &sample)) {
-        assert('\t'==fgetc(infile->stream));
-        char* newick = fgetline(infile->stream);
-        chomp(newick);
+    while (infile->next(chrom, start, end, sample)) {
         it = trees.find(sample);
         if (it == trees.end())   //first tree from this sample
-            trees[sample] = new SprPruned(newick, inds, times);
-        else trees[sample]->update(newick, inds, times);
+            trees[sample] = infile->update_trees(NULL, inds, times);
+        else infile->update_trees(trees[sample], inds, times);
 
         map<int,BedLine*>::iterator it3 = bedlineMap.find(sample);
         BedLine *currline;
         if (it3 == bedlineMap.end()) {
-            currline = new BedLine(chrom, start, end, sample, newick,
-                                   trees[sample]);
+            currline = new BedLine(chrom, start, end, sample,
+                                   infile->get_newick(), trees[sample]);
+            currline->rank = infile->get_rank();
             bedlineMap[sample] = currline;
             bedlineQueue.push(currline);
         } else {
@@ -920,25 +1279,244 @@ int summarizeRegionNoSnp(Config *config, const char *region,
         while (bedlineQueue.size() > 0) {
             BedLine *firstline = bedlineQueue.front();
             if (firstline->stats.size() == statname.size()) {
-                processNextBedLine(firstline, &results, statname,
-                                   region_chrom, region_start, region_end,
-                                   times);
+                sink->put(firstline);
                 bedlineQueue.pop();
             } else break;
         }
-        delete [] newick;
     }
-    infile->close();
-    delete infile;
 
     while (bedlineQueue.size() > 0) {
         BedLine *firstline = bedlineQueue.front();
-        processNextBedLine(firstline, &results, statname,
-                           region_chrom, region_start, region_end, times);
-        //        delete firstline;
+        scoreBedLine(firstline, statname, times);
+        sink->put(firstline);
         bedlineQueue.pop();
     }
 
+    it = trees.begin();
+    while (it != trees.end()) {
+        delete it->second;
+        advance(it, 1);
+    }
+}
+
+
+// Passes lines on to the output
+template <class resultsT>
+class OutputLineSink : public LineSink {
+public:
+    OutputLineSink(resultsT *results,
+                   vector<string> &statname, char *region_chrom,
+                   int region_start, int region_end,
+                   const vector<double> &times) :
+        results(results), statname(statname), region_chrom(region_chrom),
+        region_start(region_start), region_end(region_end), times(times) {}
+
+    void put(BedLine *line) {
+        processNextBedLine(line, results, statname, region_chrom,
+                           region_start, region_end, times);
+    }
+
+    resultsT *results;
+    vector<string> &statname;
+    char *region_chrom;
+    int region_start;
+    int region_end;
+    const vector<double> &times;
+};
+
+
+// A bounded queue of lines passed from a worker thread to the output
+class LineQueue : public LineSink {
+public:
+    LineQueue(unsigned int capacity=1000) :
+        capacity(capacity), closed(false) {
+        pthread_mutex_init(&lock, NULL);
+        pthread_cond_init(&not_empty, NULL);
+        pthread_cond_init(&not_full, NULL);
+    }
+    ~LineQueue() {
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&not_empty);
+        pthread_cond_destroy(&not_full);
+    }
+
+    void put(BedLine *line) {
+        pthread_mutex_lock(&lock);
+        while (lines.size() >= capacity)
+            pthread_cond_wait(&not_full, &lock);
+        lines.push(line);
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Marks the end of the lines
+    void close() {
+        pthread_mutex_lock(&lock);
+        closed = true;
+        pthread_cond_signal(&not_empty);
+        pthread_mutex_unlock(&lock);
+    }
+
+    // Returns the next line, or NULL after the last one
+    BedLine *get() {
+        pthread_mutex_lock(&lock);
+        while (lines.empty() && !closed)
+            pthread_cond_wait(&not_empty, &lock);
+        BedLine *line = NULL;
+        if (!lines.empty()) {
+            line = lines.front();
+            lines.pop();
+            pthread_cond_signal(&not_full);
+        }
+        pthread_mutex_unlock(&lock);
+        return line;
+    }
+
+protected:
+    unsigned int capacity;
+    bool closed;
+    queue<BedLine*> lines;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+
+// Scores the trees of one partition of the samples
+struct ScoreWorker {
+    TreeStream *infile;
+    const set<string> *inds;
+    vector<string> *statname;
+    const vector<double> *times;
+    LineQueue lines;
+    pthread_t thread;
+};
+
+
+void *scoreWorkerMain(void *arg) {
+    ScoreWorker *worker = (ScoreWorker*) arg;
+    scoreTreeStream(worker->infile, *worker->inds, *worker->statname,
+                    *worker->times, &worker->lines);
+    worker->lines.close();
+    return NULL;
+}
+
+
+// Scores the partitions of the samples in parallel and merges their lines
+// back into the order of the unpartitioned stream
+int scoreTreeStreamsParallel(Config *config, const char *region,
+                             const set<string> &inds,
+                             vector<string> &statname,
+                             const vector<double> &times, LineSink *sink) {
+    const int nparts = config->nthreads;
+    vector<ScoreWorker*> workers(nparts);
+    for (int i=0; i<nparts; i++) {
+        workers[i] = new ScoreWorker();
+        workers[i]->infile = open_tree_stream(config, region, i, nparts);
+        workers[i]->inds = &inds;
+        workers[i]->statname = &statname;
+        workers[i]->times = &times;
+    }
+    for (int i=0; i<nparts; i++) {
+        if (workers[i]->infile == NULL) {
+            for (int j=0; j<nparts; j++) {
+                delete workers[j]->infile;
+                delete workers[j];
+            }
+            return 1;
+        }
+    }
+
+    for (int i=0; i<nparts; i++) {
+        if (pthread_create(&workers[i]->thread, NULL, scoreWorkerMain,
+                           workers[i]) != 0) {
+            fprintf(stderr, "Error: could not start thread\n");
+            exit(1);
+        }
+    }
+
+    // merge lines by start coordinate and rank
+    vector<BedLine*> heads(nparts);
+    for (int i=0; i<nparts; i++)
+        heads[i] = workers[i]->lines.get();
+    while (true) {
+        int best = -1;
+        for (int i=0; i<nparts; i++) {
+            if (heads[i] == NULL)
+                continue;
+            if (best == -1 || heads[i]->start < heads[best]->start ||
+                (heads[i]->start == heads[best]->start &&
+                 heads[i]->rank < heads[best]->rank))
+                best = i;
+        }
+        if (best == -1)
+            break;
+        sink->put(heads[best]);
+        heads[best] = workers[best]->lines.get();
+    }
+
+    for (int i=0; i<nparts; i++) {
+        pthread_join(workers[i]->thread, NULL);
+        delete workers[i]->infile;
+        delete workers[i];
+    }
+    return 0;
+}
+
+
+// Summaries are collected in summaryT, and output segments are copies of
+// 'empty'
+template <class summaryT>
+int summarizeRegionNoSnp(Config *config, const char *region,
+                         set<string> inds, vector<string>statname,
+                         vector<double> times, const summaryT &empty) {
+    typedef IntervalIterator<vector<double>, summaryT> resultsT;
+    char *region_chrom = NULL;
+    vector<string> token;
+    int region_start=-1, region_end=-1;
+    resultsT results(empty);
+
+    //parse region to get region_chrom, region_start, region_end.
+    // these are only needed to truncate results which fall outside
+    // of the boundaries (tabix returns anything that overlaps)
+    if (region != NULL) {
+        split(region, "[:-]", token);
+        if (token.size() != 3) {
+            fprintf(stderr,
+                    "Error: bad region format (%s); should be chr:start-end\n",
+                    region);
+            return 1;
+        }
+        region_chrom = new char[token[0].size()+1];
+        //remove commas from integer coordinates in case they are
+        // copied from browser
+        token[1].erase(std::remove(token[1].begin(), token[1].end(), ','),
+                       token[1].end());
+        token[2].erase(std::remove(token[2].begin(), token[2].end(), ','),
+                       token[2].end());
+        strcpy(region_chrom, token[0].c_str());
+        region_start = atoi(token[1].c_str())-1;
+        region_end = atoi(token[2].c_str());
+    }
+
+    OutputLineSink<resultsT> output(&results, statname, region_chrom,
+                                    region_start, region_end, times);
+    if (config->nthreads > 1) {
+        if (scoreTreeStreamsParallel(config, region, inds, statname, times,
+                                     &output)) {
+            if (region_chrom != NULL) delete[] region_chrom;
+            return 1;
+        }
+    } else {
+        TreeStream *infile = open_tree_stream(config, region);
+        if (infile == NULL) {
+            if (region_chrom != NULL) delete[] region_chrom;
+            return 1;
+        }
+        scoreTreeStream(infile, inds, statname, times, &output);
+        delete infile;
+    }
+
     if (summarize) {
         results.finish();
         checkResults(&results);
@@ -947,11 +1525,6 @@ int summarizeRegionNoSnp(Config *config, const char *region,
                            region_start, region_end, times);
     }
 
-    it = trees.begin();
-    while (it != trees.end()) {
-        delete it->second;
-        advance(it, 1);
-    }
     if (region_chrom != NULL) delete[] region_chrom;
     return 0;
 }
@@ -959,9 +1532,14 @@ int summarizeRegionNoSnp(Config *config, const char *region,
 int summarizeRegion(Config *config, const char *region,
                     set<string> inds, vector<string>statname,
                     vector<double> times) {
-    if (config->snpfile.empty())
-        return summarizeRegionNoSnp(config, region, inds, statname, times);
-    else
+    if (config->snpfile.empty()) {
+        if (summarize && config->streaming)
+            return summarizeRegionNoSnp(
+                config, region, inds, statname, times,
+                IntervalSummary("", -1, -1, getQuantiles > 0));
+        return summarizeRegionNoSnp(config, region, inds, statname, times,
+                                    Interval<vector<double> >("", -1, -1));
+    } else
         return summarizeRegionBySnp(config, region,
                                     inds, statname, times);
 }
@@ -1068,6 +1646,10 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Error: need to specify a tree statistic\n");
         return 1;
     }
+    if (c.nthreads < 1) {
+        fprintf(stderr, "Error: --threads must be at least 1\n");
+        return 1;
+    }
 
     if (summarize && statname.size()==0) {
         fprintf(stderr,
@@ -0,0 +1,115 @@
+#include "getopt.h"
+
+// argweaver includes
+#include "argweaver/arg_archive.h"
+#include "argweaver/compress.h"
+#include "argweaver/local_tree.h"
+#include "argweaver/logging.h"
+
+
+using namespace argweaver;
+
+void print_usage() {
+    printf("argb2smc: This program converts an indexed binary ARG file\n"
+           "  (*.argb) or one sample of an ARG archive (*.arga) into the\n"
+           "  smc format.\n\n");
+    printf("Usage: ./argb2smc [OPTIONS] <argb-file> <smc-file>\n"
+           "  smc-file is gzipped if it ends in .gz\n"
+           " OPTIONS:\n"
+           " --region START-END\n"
+           "   Convert only these coordinates (1-based)\n"
+           " --iter <iteration>\n"
+           "   Sample of an ARG archive to convert (default: last)\n");
+}
+
+
+int main(int argc, char *argv[]) {
+    char c;
+    int opt_idx;
+    int region[2] = {-1, -1};
+    int iter = -1;
+    struct option long_opts[] = {
+        {"region", 1, 0, 'r'},
+        {"iter", 1, 0, 'i'},
+        {"help", 0, 0, 'h'},
+        {0,0,0,0}};
+    while ((c = (char)getopt_long(argc, argv, "r:i:h", long_opts, &opt_idx))
+           != -1) {
+        switch (c) {
+        case 'r':
+            if (2 != (sscanf(optarg, "%d-%d", &region[0], &region[1]))) {
+                fprintf(stderr, "error parsing region %s\n", optarg);
+                return 1;
+            }
+            region[0]--;  //convert to 0-based
+            break;
+        case 'i':
+            iter = atoi(optarg);
+            break;
+        case 'h':
+            print_usage();
+            return 0;
+        case '?':
+            fprintf(stderr, "unknown option. Try --help\n");
+            return 1;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "Bad arguments. Try --help\n");
+        return 1;
+    }
+    const char *argb_file = argv[optind];
+    const char *smc_file = argv[optind + 1];
+
+    // read binary ARG
+    LocalTrees trees;
+    vector<string> seqnames;
+    vector<double> times;
+    if (is_arg_archive(argb_file)) {
+        ArgArchiveReader reader;
+        if (!reader.open(argb_file))
+            return 1;
+        int sample = (iter == -1 ? reader.get_num_samples() - 1 :
+                      reader.find_sample(iter));
+        if (sample < 0) {
+            fprintf(stderr, "error: sample not found in '%s'\n", argb_file);
+            return 1;
+        }
+        if (!reader.read_sample(sample, &trees, region[0], region[1]))
+            return 1;
+        seqnames = reader.seqnames;
+        times = reader.file_times;
+    } else {
+        FILE *infile = fopen(argb_file, "rb");
+        if (!infile) {
+            fprintf(stderr, "error: could not open '%s'\n", argb_file);
+            return 1;
+        }
+        bool result;
+        if (region[0] >= 0)
+            result = read_local_trees_binary_region(
+                infile, NULL, 0, region[0], region[1], &trees, seqnames,
+                &times);
+        else
+            result = read_local_trees_binary(infile, NULL, 0, &trees,
+                                             seqnames, &times);
+        fclose(infile);
+        if (!result) {
+            fprintf(stderr, "error: could not read '%s'\n", argb_file);
+            return 1;
+        }
+    }
+
+    // write smc
+    vector<const char*> names;
+    for (unsigned int i=0; i<seqnames.size(); i++)
+        names.push_back(seqnames[i].c_str());
+    CompressStream outstream(smc_file, "w");
+    if (!outstream.stream) {
+        fprintf(stderr, "error: could not write '%s'\n", smc_file);
+        return 1;
+    }
+    write_local_trees(outstream.stream, &trees, &names[0], &times[0]);
+
+    return 0;
+}
@@ -2,14 +2,15 @@
 #define ARGWEAVER_INTERVALS_H
 
 #include "logging.h"
+#include "summary_stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
-#include <list>
+#include <algorithm>
+#include <deque>
+#include <functional>
 #include <vector>
-#include <set>
-#include <iterator>
 #include <assert.h>
 
 namespace argweaver {
@@ -78,29 +79,89 @@ protected:
 };
 
 
+/* Summary of the scores of an interval in constant memory, for scores
+   that are vectors of statistics.  Each statistic is summarized by its
+   running moments and, if 'keep_quantiles' is true, a quantile sketch.
+ */
+class IntervalSummary {
+public:
+    IntervalSummary(string chrom, int start, int end,
+                    bool keep_quantiles=true):
+        chrom(chrom), start(start), end(end), nscores(0),
+        keep_quantiles(keep_quantiles)
+    {}
+    void add_score(const vector<double> &score) {
+        if (nscores == 0) {
+            moments.resize(score.size());
+            if (keep_quantiles)
+                sketches.resize(score.size());
+        }
+        for (unsigned int i=0; i < score.size(); i++) {
+            moments[i].add(score[i]);
+            if (keep_quantiles)
+                sketches[i].add(score[i]);
+        }
+        nscores++;
+    }
+    int num_score() {
+        return nscores;
+    }
+    int num_stats() {
+        return moments.size();
+    }
+    double mean(int i) {
+        return moments[i].mean();
+    }
+    double stdev(int i) {
+        return moments[i].stdev();
+    }
+    vector<double> quantiles(int i, const vector<double> &q) {
+        assert(keep_quantiles);
+        return sketches[i].quantiles(q);
+    }
+
+    string chrom;
+    int start;
+    int end;
+
+protected:
+    int nscores;
+    bool keep_quantiles;
+    vector<RunningMoments> moments;
+    vector<QuantileSketch> sketches;
+};
+
+
 /* Process a set of overlapping segments, each associated with a score, into
    a set of non-overlapping segments, each associated with a list of scores.
    The segments should be input using the append() function in sorted bed
    order. The finish() function should be used at end to signal that there
    are no more incoming segments.
+   The scores of each output segment are collected in a summaryT, which by
+   default keeps all of them (Interval).  Output segments are copies of
+   'empty', which allows configuring the summary.
+
+   The segments are merged by a sweep line.  Segments that have not been
+   reached yet wait in a queue in input order.  Segments covering the sweep
+   line are kept in input order in a flat array, with a min-heap of their
+   ends giving the next boundary.  Scores are kept in a pool of reused
+   slots.
  */
-template <class scoreT>
+template <class scoreT, class summaryT=Interval<scoreT> >
 class IntervalIterator
 {
 public:
-    IntervalIterator()
-    {
-        intervals.clear();
-        combined.clear();
-        bounds.clear();
-        chrom = "";
-    }
+    IntervalIterator(const summaryT &empty=summaryT("", -1, -1)) :
+        empty(empty),
+        chrom(""),
+        pos(-1)
+    {}
     ~IntervalIterator()
     {
     }
 
-    Interval<scoreT> next() {
-        Interval<scoreT> rv("", -1, -1);
+    summaryT next() {
+        summaryT rv("", -1, -1);
         if (combined.size() > 0) {
             rv = combined.front();
             combined.pop_front();
@@ -112,88 +173,135 @@ public:
        (though end coord doesn't matter)
      */
     void append(string chr, int start, int end, scoreT score) {
-        Interval<scoreT> newint(chr, start, end, score);
-        std::set<int>::iterator it, prev_it;
-        int startCoord, endCoord;
-
-        if (intervals.size() > 0 && chrom != chr) {
+        if (pos != -1 && chrom != chr) {
             this->finish();
         }
         chrom = chr;
 
-        it = bounds.begin();
-        if (it != bounds.end()) {
-            startCoord = *it;
-            if (startCoord > start) {
-                printError("IntervalIterator.append() received segments "
-                           "out of order");
-                abort();
-            }
+        int first = pos;
+        if (first == -1 && waiting.size() > 0)
+            first = waiting.front().start;
+        if (first != -1 && first > start) {
+            printError("IntervalIterator.append() received segments "
+                       "out of order");
+            abort();
         }
 
-        bounds.insert(start);
-        bounds.insert(end);
-        intervals.push_back(newint);
-
-        it = prev_it = bounds.begin();
-        startCoord = *it;
-        for (++it; it != bounds.end(); it++) {
-            endCoord = *it;
-            if (endCoord >= start) break;
-            pushNext(chrom, startCoord, endCoord);
-            bounds.erase(prev_it);
-            prev_it = it;
-            startCoord = endCoord;
+        // store score
+        int slot;
+        if (free_slots.size() > 0) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+            scores[slot] = score;
+        } else {
+            slot = scores.size();
+            scores.push_back(score);
         }
+        waiting.push_back(Segment(start, end, slot));
+
+        // output the segments that end before this one starts
+        sweep(start, false);
     }
 
     // call this when there are no more remaining segments at end of chromosome.
     // It is called internally when switching chromosomes, and must be called
     // by the user at the end of the final chromosome
     void finish() {
-        std::set<int>::iterator it=bounds.begin();
-        int startCoord, endCoord;
-
-        if (bounds.size() == 0) return;
-        startCoord = *it;
-        for (++it; it != bounds.end(); it++) {
-            endCoord = *it;
-            pushNext(chrom, startCoord, endCoord);
-            startCoord = endCoord;
-        }
-        bounds.clear();
+        sweep(0, true);
+        pos = -1;
     }
 
 protected:
-    void pushNext(string chr, int start, int end) {
-        Interval<scoreT> newCombined(chr, start, end);
-        typename std::list<Interval<scoreT> >::iterator curr_it, next_it;
-        curr_it = intervals.begin();
-        next_it = intervals.begin();
-        next_it++;
-        while (curr_it != intervals.end()  &&
-               curr_it->chrom == chr && curr_it->start == start) {
-            newCombined.add_score(curr_it->get_score(0));
-            if (curr_it->end < end) {
-                fprintf(stderr, "Error\n");
+    struct Segment
+    {
+        Segment(int start, int end, int slot) :
+            start(start), end(end), slot(slot) {}
+        int start;
+        int end;
+        int slot;
+    };
+
+    // Moves the sweep line, outputting segments that end before 'limit'
+    // (or all segments if 'all' is true)
+    void sweep(int limit, bool all) {
+        while (true) {
+            if (ends.size() == 0) {
+                if (waiting.size() == 0)
+                    return;
+                // no segment covers the sweep line; output the gap until
+                // the next segment
+                const int next_start = waiting.front().start;
+                if (pos != -1 && pos < next_start) {
+                    if (!all && next_start >= limit)
+                        return;
+                    pushNext(pos, next_start);
+                }
+                pos = next_start;
+                activate();
             }
-            assert(curr_it->end >= end);
-            if (curr_it->end == end) {
-                intervals.erase(curr_it);
+
+            // next boundary
+            int boundary = ends.front();
+            if (waiting.size() > 0 && waiting.front().start < boundary)
+                boundary = waiting.front().start;
+            if (!all && boundary >= limit)
+                return;
+
+            pushNext(pos, boundary);
+            pos = boundary;
+            while (ends.size() > 0 && ends.front() == boundary) {
+                pop_heap(ends.begin(), ends.end(), greater<int>());
+                ends.pop_back();
+            }
+            activate();
+        }
+    }
+
+    // Moves the waiting segments that start at the sweep line to the
+    // active ones
+    void activate() {
+        while (waiting.size() > 0 && waiting.front().start == pos) {
+            const Segment &seg = waiting.front();
+            active.push_back(seg);
+            ends.push_back(seg.end);
+            push_heap(ends.begin(), ends.end(), greater<int>());
+            waiting.pop_front();
+        }
+    }
+
+    // Outputs [start, end) with the scores of the active segments, and
+    // drops those that end there
+    void pushNext(int start, int end) {
+        summaryT newCombined(empty);
+        newCombined.chrom = chrom;
+        newCombined.start = start;
+        newCombined.end = end;
+        unsigned int j = 0;
+        for (unsigned int i=0; i < active.size(); i++) {
+            const Segment &seg = active[i];
+            newCombined.add_score(scores[seg.slot]);
+            assert(seg.end >= end);
+            if (seg.end == end) {
+                free_slots.push_back(seg.slot);
             } else {
-                curr_it->start = end;
+                if (i != j)
+                    active[j] = seg;
+                j++;
             }
-            if (next_it == intervals.end()) break;
-            curr_it = next_it;
-            next_it++;
         }
+        active.resize(j, Segment(0, 0, 0));
         combined.push_back(newCombined);
     }
 
-    list<Interval<scoreT> > intervals;
-    list<Interval<scoreT> > combined;
-    set<int> bounds;
+    summaryT empty;
     string chrom;
+    int pos;                  // sweep line, or -1 before the first segment
+    deque<Segment> waiting;   // segments starting after the sweep line
+    vector<Segment> active;   // segments covering the sweep line
+    vector<int> ends;         // min-heap of the ends of active segments
+    vector<scoreT> scores;    // scores of waiting and active segments
+    vector<int> free_slots;
+    deque<summaryT> combined;
 };
 
 } // namespace argweaver
@@ -618,6 +618,20 @@ void SprPruned::update_spr_pruned() {
     if (pruned_spr.recomb_node != NULL) assert(pruned_spr.coal_node != NULL);
 }
 
+void SprPruned::apply_spr() {
+    NodeMap *map = (pruned_tree != NULL ? &node_map : NULL);
+    if (stats != NULL && pruned_tree == NULL)
+        stats->apply_spr(&orig_spr, map);
+    else
+        orig_tree->apply_spr(&orig_spr, map);
+    if (pruned_tree != NULL && pruned_spr.recomb_node != NULL) {
+        if (stats != NULL)
+            stats->apply_spr(&pruned_spr, NULL);
+        else
+            pruned_tree->apply_spr(&pruned_spr, NULL);
+    }
+}
+
 void SprPruned::update(char *newick, const set<string> inds,
                        const vector<double> &times) {
     //in this first case need to parse newick tree again
@@ -629,16 +643,21 @@ void SprPruned::update(char *newick, const set<string> inds,
         update_slow(newick, inds, times);
     } else {
         //otherwise, apply the SPR and node map, and get next SPR
-        orig_tree->apply_spr(&orig_spr, inds.size() > 0 ? &node_map : NULL);
+        apply_spr();
         orig_spr.update_spr_from_newick(orig_tree, newick, times);
-        if (pruned_tree != NULL) {
-            if (pruned_spr.recomb_node != NULL)
-                pruned_tree->apply_spr(&pruned_spr, NULL);
+        if (pruned_tree != NULL)
             update_spr_pruned();
-        }
     }
 }
 
+void SprPruned::update(const NodeSpr &next_spr) {
+    assert(orig_spr.recomb_node != NULL);
+    apply_spr();
+    orig_spr = next_spr;
+    if (pruned_tree != NULL)
+        update_spr_pruned();
+}
+
 
 NodeMap Tree::prune(set<string> leafs, bool allBut) {
     ExtendArray<Node*> newnodes = ExtendArray<Node*>(0);
@@ -738,10 +757,20 @@ NodeMap Tree::prune(set<string> leafs, bool allBut) {
 
 void SprPruned::update_slow(char *newick, const set<string> inds,
                             const vector<double> &times) {
+    Tree *tree = new Tree(newick, times);
+    set_tree(tree, NodeSpr(tree, newick, times), inds);
+}
+
+void SprPruned::set_tree(Tree *tree, const NodeSpr &spr,
+                         const set<string> inds) {
     if (orig_tree  != NULL) delete(orig_tree);
     if (pruned_tree != NULL) delete(pruned_tree);
-    orig_tree = new Tree(newick, times);
-    orig_spr = NodeSpr(orig_tree, newick, times);
+    if (stats != NULL) {
+        delete stats;
+        stats = NULL;
+    }
+    orig_tree = tree;
+    orig_spr = spr;
     if (inds.size() > 0) {
         pruned_tree = orig_tree->copy();
         pruned_spr = orig_spr;
@@ -750,6 +779,232 @@ void SprPruned::update_slow(char *newick, const set<string> inds,
     } else pruned_tree = NULL;
 }
 
+//=============================================================================
+// incremental tree statistics
+
+
+TreeStats::TreeStats(Tree *tree, const vector<double> &times) :
+    tree(tree),
+    nsubtree(tree->nnodes),
+    branchlen(0.0),
+    nzero(0),
+    times(times),
+    coal_counts(times.size(), 0.0),
+    mark(tree->nnodes, 0),
+    mark_id(0),
+    nqueries(0),
+    indexed(false)
+{
+    ExtendArray<Node*> postnodes;
+    getTreePostOrder(tree, &postnodes);
+    for (int i=0; i < postnodes.size(); i++) {
+        Node *node = postnodes[i];
+        nsubtree[node->name] = 1;
+        for (int j=0; j < node->nchildren; j++)
+            nsubtree[node->name] += nsubtree[node->children[j]->name];
+        add_branch(node, 1);
+        if (node->nchildren > 0)
+            add_age(node->age, 1);
+    }
+}
+
+
+// Adds (sign=1) or removes (sign=-1) the branch above node
+void TreeStats::add_branch(Node *node, int sign) {
+    if (node == tree->root)
+        return;
+    branchlen += sign * node->dist;
+    if (fabs(node->dist) < 0.0001)
+        nzero += sign;
+}
+
+
+// Adds (sign=1) or removes (sign=-1) an internal node age
+void TreeStats::add_age(double age, int sign) {
+    map<double,int>::iterator it = ages.insert(make_pair(age, 0)).first;
+    it->second += sign;
+    if (it->second == 0)
+        ages.erase(it);
+
+    if (times.size() > 0) {
+        unsigned int idx = lower_bound(times.begin(), times.end(),
+                                       age - 0.00001) - times.begin();
+        assert(idx < times.size() && fabs(times[idx] - age) < 0.00001);
+        coal_counts[idx] += sign;
+    }
+}
+
+
+void TreeStats::apply_spr(NodeSpr *spr, NodeMap *node_map) {
+    nqueries = 0;
+    indexed = false;
+
+    Node *recomb_node = spr->recomb_node;
+    Node *coal_node = spr->coal_node;
+    if (recomb_node == NULL || recomb_node == tree->root ||
+        recomb_node == coal_node) {
+        tree->apply_spr(spr, node_map);
+        return;
+    }
+
+    // only the branches above these nodes change
+    Node *recomb_parent = recomb_node->parent;
+    Node *recomb_sibling = recomb_parent->children[
+        recomb_parent->children[0] == recomb_node ? 1 : 0];
+    Node *changed[4] = {recomb_node, recomb_sibling, recomb_parent,
+                        coal_node};
+    int nchanged = 3;
+    if (coal_node != recomb_sibling && coal_node != recomb_parent)
+        nchanged = 4;
+
+    // remove the recombining subtree and broken node from its ancestors
+    const int size = nsubtree[recomb_node->name] + 1;
+    for (Node *node = recomb_parent->parent; node; node = node->parent)
+        nsubtree[node->name] -= size;
+    for (int i=0; i<nchanged; i++)
+        add_branch(changed[i], -1);
+    add_age(recomb_parent->age, -1);
+
+    tree->apply_spr(spr, node_map);
+
+    // add them back at the recoalescence
+    add_age(recomb_parent->age, 1);
+    for (int i=0; i<nchanged; i++)
+        add_branch(changed[i], 1);
+    nsubtree[recomb_parent->name] = 1;
+    for (int j=0; j < recomb_parent->nchildren; j++)
+        nsubtree[recomb_parent->name] +=
+            nsubtree[recomb_parent->children[j]->name];
+    for (Node *node = recomb_parent->parent; node; node = node->parent)
+        nsubtree[node->name] += size;
+}
+
+
+// Same as Tree::tmrca_half using the subtree sizes
+double TreeStats::tmrca_half() const {
+    const int numnode = (tree->nnodes-1)/2;
+    Node *node = tree->root;
+    while (true) {
+        if (nsubtree[node->name] == numnode)
+            return node->age;
+        Node *c0 = node->children[0], *c1 = node->children[1];
+        if (nsubtree[c0->name] == numnode && nsubtree[c1->name] == numnode)
+            return min(c0->age, c1->age);
+        if (nsubtree[c0->name] >= numnode)
+            node = c0;
+        else if (nsubtree[c1->name] >= numnode)
+            node = c1;
+        else
+            return node->age;
+    }
+}
+
+
+// Same as Tree::popsize using the sorted internal node ages
+double TreeStats::popsize() const {
+    int numleaf = (tree->nnodes+1)/2;
+    double lasttime=0, popsize=0;
+    int k=numleaf;
+    for (map<double,int>::const_iterator it=ages.begin(); it != ages.end();
+         ++it) {
+        for (int i=0; i < it->second; i++) {
+            popsize += (double)k*(k-1)*(it->first-lasttime);
+            lasttime = it->first;
+            k--;
+        }
+    }
+    return popsize/(4.0*numleaf-4);
+}
+
+
+// Marks the ancestors of n1, then walks up from n2 to the first marked one
+Node *TreeStats::lca_walk(Node *n1, Node *n2) {
+    mark_id++;
+    for (Node *node = n1; node; node = node->parent)
+        mark[node->name] = mark_id;
+    Node *node = n2;
+    while (mark[node->name] != mark_id)
+        node = node->parent;
+    return node;
+}
+
+
+void TreeStats::euler_tour(Node *node, int depth, double dist) {
+    first[node->name] = tour.size();
+    root_dist[node->name] = dist;
+    tour.push_back(node);
+    tour_depth.push_back(depth);
+    for (int i=0; i < node->nchildren; i++) {
+        Node *child = node->children[i];
+        euler_tour(child, depth + 1, dist + child->dist);
+        tour.push_back(node);
+        tour_depth.push_back(depth);
+    }
+}
+
+
+void TreeStats::build_lca_index() {
+    first.resize(tree->nnodes);
+    root_dist.resize(tree->nnodes);
+    tour.clear();
+    tour_depth.clear();
+    euler_tour(tree->root, 0, 0.0);
+
+    const int n = tour.size();
+    int nlevels = 1;
+    while ((1 << nlevels) <= n)
+        nlevels++;
+    sparse.resize(nlevels);
+    sparse[0].resize(n);
+    for (int i=0; i < n; i++)
+        sparse[0][i] = i;
+    for (int k=1; k < nlevels; k++) {
+        const int half = 1 << (k-1);
+        sparse[k].resize(n - (1 << k) + 1);
+        for (unsigned int i=0; i < sparse[k].size(); i++) {
+            const int a = sparse[k-1][i], b = sparse[k-1][i + half];
+            sparse[k][i] = (tour_depth[a] <= tour_depth[b] ? a : b);
+        }
+    }
+    indexed = true;
+}
+
+
+Node *TreeStats::lca(Node *n1, Node *n2) {
+    if (!indexed) {
+        if (++nqueries < (tree->nnodes+1)/2)
+            return lca_walk(n1, n2);
+        build_lca_index();
+    }
+
+    int i = first[n1->name], j = first[n2->name];
+    if (i > j)
+        swap(i, j);
+    int k = 0;
+    while ((2 << k) <= j - i + 1)
+        k++;
+    const int a = sparse[k][i], b = sparse[k][j - (1 << k) + 1];
+    return tour[tour_depth[a] <= tour_depth[b] ? a : b];
+}
+
+
+// Sums the branches from both leaves up to their common ancestor
+double TreeStats::distBetweenLeaves(Node *n1, Node *n2) {
+    if (n1 == n2) return 0.0;
+    Node *ancestor = lca(n1, n2);
+    if (indexed)
+        return root_dist[n1->name] + root_dist[n2->name] -
+            2.0 * root_dist[ancestor->name];
+
+    double rv = 0.0;
+    for (Node *node = n2; node != ancestor; node = node->parent)
+        rv += node->dist;
+    for (Node *node = n1; node != ancestor; node = node->parent)
+        rv += node->dist;
+    return rv;
+}
+
+
 // assumes both trees have same number of nodes
 // and have same leaves
 void Tree::setTopology(Tree *other)
@@ -1327,48 +1582,108 @@ double Tree::distBetweenLeaves(Node *n1, Node *n2) {
 // want to return set of nodes above which mutations happened under infinite
 // sites to cause site pattern.
 // assumes tree has been pruned to remove non-informative leafs
-// this is not particularly efficient! may want to think of something faster.
+// Descends from the root through the subtrees that have both derived and
+// ancestral leaves; the fully derived subtrees met on the way are the lca.
 set<Node*> Tree::lca(set<Node*> derived) {
-    set<Node*>::iterator it;
     set<Node*> rv;
 
     if (derived.size() == 1) return derived;
-    ExtendArray<Node*> postnodes;
-    getTreePostOrder(this, &postnodes);
-    for (int i=0; i < postnodes.size(); i++) {
-        if (postnodes[i]->nchildren == 0) continue;
-        if (postnodes[i] == root) {
-            assert(derived.size() == 1);
-            rv.insert(*(derived.begin()));
-            return rv;
-        }
-        int count=0;
-        for (int j=0; j < postnodes[i]->nchildren; j++) {
-            if (derived.find(postnodes[i]->children[j]) != derived.end())
-                count++;
-        }
-        if (count == postnodes[i]->nchildren) { // all children are derived
-            for (int j=0; j < postnodes[i]->nchildren; j++)
-                derived.erase(postnodes[i]->children[j]);
-            derived.insert(postnodes[i]);
-        }  else if (count != 0) {
-            for (int j=0; j < postnodes[i]->nchildren; j++) {
-                if (derived.find(postnodes[i]->children[j]) != derived.end()) {
-                    rv.insert(postnodes[i]->children[j]);
-                    derived.erase(postnodes[i]->children[j]);
-                }
-            }
+
+    LeafSets leafsets(this);
+    vector<LeafSets::Word> derived_set(leafsets.nwords, 0);
+    for (set<Node*>::iterator it=derived.begin(); it != derived.end(); ++it)
+        leafsets.add(*it, &derived_set[0]);
+
+    vector<Node*> stack(1, root);
+    while (!stack.empty()) {
+        Node *node = stack.back();
+        stack.pop_back();
+        for (int j=0; j < node->nchildren; j++) {
+            Node *child = node->children[j];
+            if (leafsets.subset(child, &derived_set[0]))
+                rv.insert(child);
+            else if (!leafsets.disjoint(child, &derived_set[0]))
+                stack.push_back(child);
         }
-        if (derived.size() == 0) return rv;
     }
-    fprintf(stderr, "got to end of LCA\n"); fflush(stderr);
     return rv;
 }
 
 
+//=============================================================================
+// leaf bitsets
+
+LeafSets::LeafSets(Tree *tree) :
+    bit(tree->nnodes, -1)
+{
+    ExtendArray<Node*> postorder;
+    getTreePostOrder(tree, &postorder);
+    int nleaves = 0;
+    for (int i=0; i < postorder.size(); i++)
+        if (postorder[i]->isLeaf())
+            bit[postorder[i]->name] = nleaves++;
+    nwords = max(1, (nleaves + WORD_BITS - 1) / WORD_BITS);
+
+    below.assign(tree->nnodes * nwords, 0);
+    for (int i=0; i < postorder.size(); i++) {
+        Node *node = postorder[i];
+        Word *leaves = &below[node->name * nwords];
+        if (node->isLeaf())
+            add_leaf(node, leaves);
+        for (int j=0; j < node->nchildren; j++) {
+            const Word *child = &below[node->children[j]->name * nwords];
+            for (int k=0; k < nwords; k++)
+                leaves[k] |= child[k];
+        }
+    }
+}
+
+
+void LeafSets::add(const Node *node, Word *set) const {
+    const Word *leaves = &below[node->name * nwords];
+    for (int i=0; i < nwords; i++)
+        set[i] |= leaves[i];
+}
+
+
 //=============================================================================
 // primitive tree format conversion functions
 
+Tree *makeTree(int nnodes, const int *ptree, const double *ages,
+               const char *const *leaf_names)
+{
+    Tree *tree = new Tree(nnodes);
+    Node **nodes = tree->nodes;
+
+    for (int i=0; i<nnodes; i++) {
+        nodes[i]->allocChildren(2);
+        nodes[i]->name = i;
+        nodes[i]->nchildren = 0;
+        nodes[i]->age = ages[i];
+    }
+    for (int i=0; i<nnodes; i++) {
+        const int parent = ptree[i];
+        if (parent != -1) {
+            Node *parentnode = nodes[parent];
+            parentnode->children[parentnode->nchildren++] = nodes[i];
+            nodes[i]->parent = parentnode;
+            nodes[i]->dist = ages[parent] - ages[i];
+        } else {
+            nodes[i]->parent = NULL;
+            tree->root = nodes[i];
+        }
+    }
+    for (int i=0; i<nnodes; i++) {
+        if (nodes[i]->nchildren == 0) {
+            nodes[i]->longname = leaf_names[i];
+            tree->nodename_map[nodes[i]->longname] = i;
+        }
+    }
+
+    return tree;
+}
+
+
 extern "C" {
 
 /*
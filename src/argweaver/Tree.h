@@ -335,6 +335,12 @@ public:
             const vector<double> &times=vector<double>()) {
         update_spr_from_newick(tree, newick, times);
     }
+    // SPR given by node names of tree (recomb_node=-1 for no SPR)
+    NodeSpr(Tree *tree, int recomb_node, double recomb_time,
+            int coal_node, double coal_time) :
+        recomb_node(recomb_node == -1 ? NULL : tree->nodes[recomb_node]),
+        coal_node(recomb_node == -1 ? NULL : tree->nodes[coal_node]),
+        recomb_time(recomb_time), coal_time(coal_time) {}
     void correct_recomb_times(const vector<double> &times);
     void update_spr_from_newick(Tree *tree, char *newick_str,
                                 const vector<double> &times=vector<double>());
@@ -345,12 +351,131 @@ public:
 };
 
 
+// The leaves below each node of a tree as bitsets, so that a set of
+// leaves can be compared with a subtree a word at a time.  Leaves get
+// bits in postorder, and sets are arrays of nwords words.
+class LeafSets {
+public:
+    typedef unsigned long Word;
+    static const int WORD_BITS = 8 * sizeof(Word);
+
+    LeafSets(Tree *tree);
+
+    // Adds the leaves below node to set
+    void add(const Node *node, Word *set) const;
+    // Adds a single leaf to set
+    void add_leaf(const Node *leaf, Word *set) const {
+        const int b = bit[leaf->name];
+        set[b / WORD_BITS] |= Word(1) << (b % WORD_BITS);
+    }
+
+    // Returns true if all the leaves below node are in set
+    bool subset(const Node *node, const Word *set) const {
+        const Word *leaves = &below[node->name * nwords];
+        for (int i=0; i < nwords; i++)
+            if (leaves[i] & ~set[i])
+                return false;
+        return true;
+    }
+
+    // Returns true if none of the leaves below node are in set
+    bool disjoint(const Node *node, const Word *set) const {
+        const Word *leaves = &below[node->name * nwords];
+        for (int i=0; i < nwords; i++)
+            if (leaves[i] & set[i])
+                return false;
+        return true;
+    }
+
+    int nwords;
+    vector<int> bit;        // bit of each leaf (-1 for internal nodes)
+
+protected:
+    vector<Word> below;     // nwords words per node, indexed by name
+};
+
+
+// Statistics of a tree that are kept up to date across SPR operations.
+// Subtree sizes, internal node ages and the total branch length are
+// updated along the paths affected by each SPR, so that the statistics
+// below cost O(depth) or less instead of a traversal of the tree.
+class TreeStats {
+public:
+    // Computes the statistics of tree.  Coalescence counts are only kept
+    // if times are given.
+    TreeStats(Tree *tree, const vector<double> &times = vector<double>());
+
+    // Applies an SPR to the tree (see Tree::apply_spr) and updates the
+    // statistics
+    void apply_spr(NodeSpr *spr, NodeMap *node_map=NULL);
+
+    double total_branchlength() const { return branchlen; }
+    double tmrca() const { return tree->root->age; }
+    double tmrca_half() const;
+    double rth() const { return tmrca_half() / tmrca(); }
+    double popsize() const;
+    const vector<double> &coalCounts() const { return coal_counts; }
+    double num_zero_branches() const { return nzero; }
+
+    // Returns the last common ancestor of two nodes
+    Node *lca(Node *n1, Node *n2);
+
+    double distBetweenLeaves(Node *n1, Node *n2);
+    double distBetweenLeaves(string n1, string n2) {
+        return distBetweenLeaves(
+            tree->nodes[tree->nodename_map.find(n1)->second],
+            tree->nodes[tree->nodename_map.find(n2)->second]);
+    }
+
+    Tree *tree;
+
+protected:
+    void add_branch(Node *node, int sign);
+    void add_age(double age, int sign);
+    Node *lca_walk(Node *n1, Node *n2);
+    void build_lca_index();
+    void euler_tour(Node *node, int depth, double dist);
+
+    vector<int> nsubtree;   // number of nodes in subtree of each node
+    double branchlen;
+    int nzero;
+    map<double,int> ages;   // number of internal nodes of each age
+    vector<double> times;
+    vector<double> coal_counts;
+    vector<int> mark;       // scratch space for lca_walk
+    int mark_id;
+
+    // Euler tour of the tree with a sparse table for range minimum
+    // queries, giving the lca of two nodes in O(1).  An SPR moves a
+    // subtree within the tour and changes the depths of up to three
+    // subtrees, so updating the tour in place would still shift most of
+    // it and redo the O(n log n) sparse table.  The index is dropped by
+    // apply_spr instead, and is only rebuilt once a tree gets as many lca
+    // queries as it has leaves; fewer queries walk up from both nodes.
+    // On coalescent trees a rebuild costs about as much as 1.3-1.6 walks
+    // per leaf (1.2us for 20 leaves, 53us for 500, 300us for 2000, against
+    // 0.04-0.1us per walk), so this never costs more than twice the
+    // better of always walking and always indexing.
+    int nqueries;               // lca queries since the tree last changed
+    bool indexed;
+    vector<int> first;          // first position of each node in the tour
+    vector<double> root_dist;   // distance from the root of each node
+    vector<Node*> tour;
+    vector<int> tour_depth;
+    vector<vector<int> > sparse; // sparse[k][i]: position of the lowest
+                                 // depth in tour[i, i+2^k)
+};
+
+
 // Efficient SPR operation on a tree and its pruned version
 class SprPruned {
 private:
     //update spr operation on pruned tree
     void update_spr_pruned();
 
+    //apply current SPR on both trees
+    void apply_spr();
+
     //update object by parsing newick string
     void update_slow(char *newick, const set<string> inds,
                      const vector<double> &times = vector<double>());
@@ -359,12 +484,36 @@ public:
               const vector<double> &times = vector<double>())
         {
             orig_tree = pruned_tree = NULL;
+            stats = NULL;
             update_slow(newick, inds, times);
         }
 
+    //create from a tree and its next SPR; takes ownership of tree
+    SprPruned(Tree *tree, const NodeSpr &spr, const set<string> inds)
+        {
+            orig_tree = pruned_tree = NULL;
+            stats = NULL;
+            set_tree(tree, spr, inds);
+        }
+
     ~SprPruned() {
         delete orig_tree;
         if (pruned_tree != NULL) delete pruned_tree;
+        if (stats != NULL) delete stats;
+    }
+
+    //returns the tree to be scored: the pruned tree if set, otherwise
+    //the full tree
+    Tree *get_tree() {
+        return pruned_tree != NULL ? pruned_tree : orig_tree;
+    }
+
+    //returns statistics of get_tree(), which are kept up to date by
+    //later updates
+    TreeStats *get_stats(const vector<double> &times = vector<double>()) {
+        if (stats == NULL)
+            stats = new TreeStats(get_tree(), times);
+        return stats;
     }
 
     //print pruned tree if set, otherwise full tree, with NHX string giving
@@ -387,11 +536,19 @@ public:
     void update(char *newick, const set<string> inds,
                 const vector<double> &times = vector<double>());
 
+    //apply spr on both trees and set the next SPR, given by nodes of
+    //orig_tree
+    void update(const NodeSpr &next_spr);
+
+    //replace trees by a new tree and its next SPR; takes ownership of tree
+    void set_tree(Tree *tree, const NodeSpr &spr, const set<string> inds);
+
     Tree *orig_tree;
     Tree *pruned_tree;
     NodeSpr orig_spr;
     NodeSpr pruned_spr;
     NodeMap node_map;
+    TreeStats *stats;
 };
 
 
@@ -429,6 +586,10 @@ void getTreePreOrder(Tree *tree, ExtendArray<Node*> *nodes, Node *node=NULL);
 void printFtree(int nnodes, int **ftree);
 void printTree(Tree *tree, Node *node=NULL, int depth=0);
 
+// Creates a tree from a parent array, node ages and names of the leaves
+Tree *makeTree(int nnodes, const int *ptree, const double *ages,
+               const char *const *leaf_names);
+
 
 // C exports
 extern "C" {
@@ -0,0 +1,847 @@
+//=============================================================================
+// multi-sample ARG archive
+
+// c/c++ includes
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// arghmm includes
+#include "arg_archive.h"
+#include "logging.h"
+
+
+namespace argweaver {
+
+
+static const char *ARCHIVE_MAGIC = "ARGA";
+static const int ARCHIVE_VERSION = 1;
+
+// entry types
+enum {
+    ARCHIVE_CHUNK = 1,
+    ARCHIVE_SAMPLE = 2
+};
+
+
+//=============================================================================
+// writing archives
+
+
+ArgArchiveWriter::ArgArchiveWriter(int chunk_size) :
+    nsamples(0),
+    nchunks_written(0),
+    out(NULL),
+    offset(0),
+    chunk_size(chunk_size),
+    nnodes(0),
+    start_coord(0),
+    end_coord(0),
+    encoder(NULL)
+{}
+
+
+ArgArchiveWriter::~ArgArchiveWriter()
+{
+    close();
+}
+
+
+bool ArgArchiveWriter::open(const char *filename, const LocalTrees *trees,
+                            const char *const *names,
+                            const double *times, int ntimes, bool append)
+{
+    close();
+
+    nnodes = trees->nnodes;
+    start_coord = trees->start_coord;
+    end_coord = trees->end_coord;
+
+    struct stat st;
+    if (append && stat(filename, &st) == 0 && st.st_size > 0) {
+        // continue an existing archive of the same region and time points
+        ArgArchiveReader reader;
+        if (!reader.open(filename))
+            return false;
+        if (reader.nnodes != nnodes || reader.start_coord != start_coord ||
+            reader.end_coord != end_coord) {
+            printError("ARG archive '%s' is for a different region",
+                       filename);
+            return false;
+        }
+        if (reader.file_times.size() != (unsigned int) ntimes ||
+            !equal(reader.file_times.begin(), reader.file_times.end(),
+                   times)) {
+            printError("ARG archive '%s' has different time points",
+                       filename);
+            return false;
+        }
+        chunk_size = reader.get_chunk_size();
+
+        // drop any incomplete entry at the end of the archive
+        offset = reader.get_valid_size();
+        reader.close();
+        if (offset < st.st_size && truncate(filename, offset) != 0) {
+            printError("cannot truncate ARG archive '%s'", filename);
+            return false;
+        }
+        if ((out = fopen(filename, "ab")) == NULL) {
+            printError("cannot write file '%s'", filename);
+            return false;
+        }
+    } else {
+        if ((out = fopen(filename, "wb")) == NULL) {
+            printError("cannot write file '%s'", filename);
+            return false;
+        }
+
+        // write header
+        const int nleaves = trees->get_num_leaves();
+        BinaryWriter writer(out);
+        writer.write(ARCHIVE_MAGIC, 4);
+        writer.write_int(ARCHIVE_VERSION);
+        writer.write_int(chunk_size);
+        writer.write_int(nnodes);
+        writer.write_int(nleaves);
+        writer.write_int(start_coord);
+        writer.write_int(end_coord);
+        writer.write_int(ntimes);
+        writer.write(times, sizeof(double) * ntimes);
+        writer.write_string(trees->chrom);
+        for (int i=0; i<nleaves; i++) {
+            if (names)
+                writer.write_string(names[trees->seqids[i]]);
+            else
+                writer.write_string("");
+        }
+        offset = writer.offset;
+        if (!writer.ok) {
+            printError("error writing ARG archive '%s'", filename);
+            close();
+            return false;
+        }
+    }
+
+    encoder = new BinaryTreeEncoder(nnodes);
+    return true;
+}
+
+
+bool ArgArchiveWriter::open(const char *filename, const LocalTrees *trees,
+                            const Sequences &seqs,
+                            const double *times, int ntimes, bool append)
+{
+    // setup names
+    const unsigned int nleaves = trees->get_num_leaves();
+    vector<string> names2(nleaves);
+    const char **names = new const char* [nleaves];
+    for (unsigned int i=0; i<nleaves; i++) {
+        if (i < seqs.names.size()) {
+            names2[i] = seqs.names[i];
+        } else {
+            // use ids
+            char id[11];
+            snprintf(id, 10, "%d", i);
+            names2[i] = id;
+        }
+        names[i] = names2[i].c_str();
+    }
+
+    bool result = open(filename, trees, names, times, ntimes, append);
+    delete [] names;
+    return result;
+}
+
+
+void ArgArchiveWriter::close()
+{
+    if (out) {
+        fclose(out);
+        out = NULL;
+    }
+    delete encoder;
+    encoder = NULL;
+}
+
+
+// Encodes the chunk [chunk_start, chunk_end).  'it' is the tree
+// overlapping chunk_start and 'start' is its start coordinate.  On return
+// they refer to the tree overlapping chunk_end.
+void ArgArchiveWriter::encode_chunk(LocalTrees::const_iterator &it,
+                                    int &start, const LocalTrees *trees,
+                                    int chunk_start, int chunk_end,
+                                    vector<char> &data)
+{
+    BinaryWriter writer(&data);
+
+    int end = start + it->blocklen;
+    encoder->write_first(writer, it->tree, min(end, chunk_end) - chunk_start,
+                         true);
+    while (end < chunk_end) {
+        LocalTrees::const_iterator next = it;
+        ++next;
+        start = end;
+        end += next->blocklen;
+        encoder->write_next(writer, it->tree, *next,
+                            min(end, chunk_end) - start);
+        it = next;
+    }
+    writer.write_int(BINARY_END);
+
+    // link to the next chunk
+    BinarySpr link;
+    link.set_null();
+    if (end == chunk_end) {
+        LocalTrees::const_iterator next = it;
+        ++next;
+        if (next != trees->end()) {
+            encoder->get_spr(*next, &link);
+            start = end;
+            it = next;
+        }
+    }
+    link.blocklen = 0;
+    writer.write(&link, sizeof(link));
+}
+
+
+bool ArgArchiveWriter::write_sample(const LocalTrees *trees, int iter)
+{
+    if (!out)
+        return false;
+    if (trees->nnodes != nnodes || trees->start_coord != start_coord ||
+        trees->end_coord != end_coord) {
+        printError("ARG does not match the region of the archive");
+        return false;
+    }
+
+    const int nchunks = (end_coord - start_coord + chunk_size - 1) /
+        chunk_size;
+    vector<int64_t> offsets(nchunks);
+    BinaryWriter writer(out);
+    writer.offset = offset;
+
+    LocalTrees::const_iterator it = trees->begin();
+    int start = start_coord;
+    vector<char> data;
+    for (int i=0; i<nchunks; i++) {
+        const int chunk_start = start_coord + i * chunk_size;
+        const int chunk_end = min(chunk_start + chunk_size, end_coord);
+        data.clear();
+        encode_chunk(it, start, trees, chunk_start, chunk_end, data);
+
+        writer.write_int(ARCHIVE_CHUNK);
+        writer.write_int(data.size());
+        offsets[i] = writer.offset;
+        writer.write(&data[0], data.size());
+        nchunks_written++;
+    }
+
+    // write sample index
+    writer.write_int(ARCHIVE_SAMPLE);
+    writer.write_int(iter);
+    writer.write_int(nchunks);
+    writer.write(&offsets[0], sizeof(int64_t) * nchunks);
+    fflush(out);
+    offset = writer.offset;
+    nsamples++;
+
+    if (!writer.ok) {
+        printError("error writing ARG archive");
+        return false;
+    }
+    return true;
+}
+
+
+//=============================================================================
+// reading archives
+
+
+ArgArchiveReader::ArgArchiveReader() :
+    start_coord(0),
+    end_coord(0),
+    nnodes(0),
+    infile(NULL),
+    mapped(NULL),
+    mapped_size(0),
+    chunk_size(0),
+    nchunks(0),
+    valid_size(0)
+{}
+
+
+ArgArchiveReader::~ArgArchiveReader()
+{
+    close();
+}
+
+
+bool ArgArchiveReader::open(const char *filename, const double *times,
+                            int ntimes)
+{
+    close();
+    samples.clear();
+
+    if ((infile = fopen(filename, "rb")) == NULL) {
+        printError("cannot read file '%s'", filename);
+        return false;
+    }
+
+    // read header
+    BinaryReader reader(infile);
+    char magic[4];
+    int32_t version, nleaves, ntimes2;
+    if (!reader.read(magic, 4) || strncmp(magic, ARCHIVE_MAGIC, 4) != 0) {
+        printError("'%s' is not an ARG archive", filename);
+        close();
+        return false;
+    }
+    if (!reader.read_int(&version) || version != ARCHIVE_VERSION) {
+        printError("unsupported ARG archive version");
+        close();
+        return false;
+    }
+    if (!reader.read_int(&chunk_size) || chunk_size <= 0 ||
+        !reader.read_int(&nnodes) ||
+        !reader.read_int(&nleaves) ||
+        !reader.read_int(&start_coord) ||
+        !reader.read_int(&end_coord) ||
+        !reader.read_int(&ntimes2) ||
+        !check_binary_header(nnodes, nleaves, ntimes2)) {
+        printError("bad ARG archive header");
+        close();
+        return false;
+    }
+    file_times.resize(ntimes2);
+    if ((ntimes2 > 0 &&
+         !reader.read(&file_times[0], sizeof(double) * ntimes2)) ||
+        !reader.read_string(chrom)) {
+        printError("bad ARG archive header");
+        close();
+        return false;
+    }
+    seqnames.resize(nleaves);
+    for (int i=0; i<nleaves; i++) {
+        if (!reader.read_string(seqnames[i])) {
+            printError("bad ARG archive header");
+            close();
+            return false;
+        }
+    }
+    nchunks = (end_coord - start_coord + chunk_size - 1) / chunk_size;
+    get_binary_time_mapping(file_times, times, ntimes, time_mapping);
+
+    // scan entries for the sample index.  An incomplete entry at the end
+    // of the archive is ignored.
+    struct stat st;
+    if (fstat(fileno(infile), &st) != 0) {
+        printError("cannot read file '%s'", filename);
+        close();
+        return false;
+    }
+    valid_size = ftello(infile);
+    while (true) {
+        int32_t type, value;
+        if (!reader.read_int(&type) || !reader.read_int(&value))
+            break;
+        if (type == ARCHIVE_CHUNK) {
+            const int64_t end = ftello(infile) + value;
+            if (value < 0 || end > st.st_size ||
+                fseeko(infile, end, SEEK_SET) != 0)
+                break;
+        } else if (type == ARCHIVE_SAMPLE) {
+            int32_t n;
+            SampleIndex index;
+            index.iter = value;
+            index.offsets.resize(nchunks);
+            if (!reader.read_int(&n))
+                break;
+            if (n != nchunks) {
+                printError("bad sample index in ARG archive");
+                close();
+                return false;
+            }
+            if (!reader.read(&index.offsets[0], sizeof(int64_t) * nchunks))
+                break;
+            samples.push_back(index);
+        } else {
+            printError("bad entry in ARG archive");
+            close();
+            return false;
+        }
+        valid_size = ftello(infile);
+    }
+
+    // map the archive into memory if possible.  Otherwise chunks are read
+    // with stdio.
+    if (valid_size > 0) {
+        void *ptr = mmap(NULL, valid_size, PROT_READ, MAP_PRIVATE,
+                         fileno(infile), 0);
+        if (ptr != MAP_FAILED) {
+            mapped = (const char*) ptr;
+            mapped_size = valid_size;
+        }
+    }
+
+    return true;
+}
+
+
+void ArgArchiveReader::close()
+{
+    if (mapped) {
+        munmap((void*) mapped, mapped_size);
+        mapped = NULL;
+        mapped_size = 0;
+    }
+    if (infile) {
+        fclose(infile);
+        infile = NULL;
+    }
+}
+
+
+int ArgArchiveReader::find_sample(int iter) const
+{
+    for (int i=samples.size() - 1; i>=0; i--)
+        if (samples[i].iter == iter)
+            return i;
+    return -1;
+}
+
+
+bool ArgArchiveReader::get_chunk_view(int sample, int chunk,
+                                      const char **data, int *size) const
+{
+    if (!mapped)
+        return false;
+    const int64_t offset = samples[sample].offsets[chunk];
+    int32_t size2;
+    if (offset < (int64_t) sizeof(size2) || offset > mapped_size)
+        return false;
+    memcpy(&size2, mapped + offset - sizeof(size2), sizeof(size2));
+    if (size2 < 0 || offset + size2 > mapped_size)
+        return false;
+    *data = mapped + offset;
+    *size = size2;
+    return true;
+}
+
+
+bool ArgArchiveReader::read_chunk_data(int sample, int chunk,
+                                       vector<char> &data)
+{
+    const char *view;
+    int size2;
+    if (get_chunk_view(sample, chunk, &view, &size2)) {
+        data.assign(view, view + size2);
+        return true;
+    }
+
+    const int64_t offset = samples[sample].offsets[chunk];
+    BinaryReader reader(infile);
+    int32_t size;
+    if (fseeko(infile, offset - sizeof(size), SEEK_SET) != 0 ||
+        !reader.read_int(&size) || size < 0) {
+        printError("cannot read chunk of ARG archive");
+        return false;
+    }
+    data.resize(size);
+    if (size > 0 && !reader.read(&data[0], size)) {
+        printError("cannot read chunk of ARG archive");
+        return false;
+    }
+    return true;
+}
+
+
+bool ArgArchiveReader::read_chunk(int sample, int chunk, LocalTrees *trees,
+                                  Spr *link)
+{
+    trees->clear();
+    trees->chrom = chrom;
+    trees->nnodes = nnodes;
+    trees->start_coord = get_chunk_start(chunk);
+    trees->end_coord = get_chunk_end(chunk);
+
+    // decode from the mapped archive if possible
+    vector<char> data;
+    const char *view;
+    int size;
+    if (!get_chunk_view(sample, chunk, &view, &size)) {
+        if (!read_chunk_data(sample, chunk, data))
+            return false;
+        view = &data[0];
+        size = data.size();
+    }
+
+    BinaryReader reader(view, size);
+    BinarySpr record;
+    if (!read_binary_tree_records(reader, nnodes, time_mapping,
+                                  trees->start_coord, -1, trees) ||
+        !reader.read(&record, sizeof(record)) ||
+        !check_binary_spr(record, nnodes, time_mapping.size())) {
+        printError("bad chunk in ARG archive");
+        return false;
+    }
+
+    link->set_null();
+    if (!record.is_null()) {
+        link->recomb_node = record.recomb_node;
+        link->recomb_time = time_mapping[record.recomb_time];
+        link->coal_node = record.coal_node;
+        link->coal_time = time_mapping[record.coal_time];
+    }
+    trees->set_default_seqids();
+
+    return true;
+}
+
+
+// Appends the trees of the next chunk to 'trees'.  'link' is the SPR
+// between the last tree of 'trees' and the first tree of the chunk.
+static void join_chunk(LocalTrees *trees, LocalTrees *chunk,
+                       const Spr &link)
+{
+    const int nnodes = trees->nnodes;
+    LocalTreeSpr &last = trees->back();
+    LocalTreeSpr &first = chunk->front();
+
+    if (link.is_null()) {
+        // the last tree continues into the chunk.  Keep the tree of the
+        // chunk, whose labels are used by the following SPRs.
+        vector<int> labels(nnodes);
+        vector<int> seqids(nnodes);
+        for (int i=0; i<nnodes; i++)
+            seqids[i] = i;
+        map_congruent_trees(last.tree, &seqids[0], first.tree, &seqids[0],
+                            &labels[0]);
+        if (last.mapping) {
+            for (int i=0; i<nnodes; i++)
+                if (last.mapping[i] != -1)
+                    last.mapping[i] = labels[last.mapping[i]];
+        }
+        delete last.tree;
+        last.tree = first.tree;
+        last.blocklen += first.blocklen;
+        first.tree = NULL;
+        first.clear();
+        chunk->trees.pop_front();
+    } else {
+        first.spr = link;
+        first.mapping = new int [nnodes];
+        infer_mapping(last.tree, first.tree, link.recomb_node,
+                      first.mapping);
+    }
+
+    trees->trees.splice(trees->trees.end(), chunk->trees);
+}
+
+
+bool ArgArchiveReader::read_sample(int sample, LocalTrees *trees,
+                                   int start, int end)
+{
+    if (start < 0)
+        start = start_coord;
+    if (end < 0)
+        end = end_coord;
+    start = max(start, start_coord);
+    end = min(end, end_coord);
+    if (start >= end) {
+        printError("region is outside of ARG archive");
+        return false;
+    }
+
+    trees->clear();
+    trees->chrom = chrom;
+    trees->nnodes = nnodes;
+
+    const int first_chunk = (start - start_coord) / chunk_size;
+    const int last_chunk = (end - 1 - start_coord) / chunk_size;
+    LocalTrees chunk;
+    Spr link, next_link;
+    for (int i=first_chunk; i<=last_chunk; i++) {
+        if (!read_chunk(sample, i, &chunk, &next_link))
+            return false;
+        if (i == first_chunk) {
+            trees->trees.splice(trees->trees.end(), chunk.trees);
+        } else {
+            if (!link.is_null() &&
+                !check_spr_on_tree(trees->back().tree, link)) {
+                printError("bad chunk in ARG archive");
+                return false;
+            }
+            join_chunk(trees, &chunk, link);
+        }
+        link = next_link;
+    }
+
+    crop_binary_trees(trees, get_chunk_start(first_chunk), start, end);
+    trees->set_default_seqids();
+    assert_trees(trees);
+
+    return true;
+}
+
+
+//=============================================================================
+// walking the trees of a sample
+
+
+ArgArchiveCursor::ArgArchiveCursor(ArgArchiveReader *archive, int sample,
+                                   int start) :
+    start(0),
+    end(0),
+    error(false),
+    archive(archive),
+    time_mapping(archive->get_time_mapping()),
+    sample(sample),
+    nnodes(archive->nnodes),
+    chunk(0),
+    started(false),
+    reader(NULL, 0),
+    next_blocklen(0),
+    has_next(false)
+{
+    if (start > archive->start_coord)
+        chunk = min((start - archive->start_coord) /
+                    archive->get_chunk_size(),
+                    archive->get_num_chunks() - 1);
+    spr.set_null();
+
+    ids = new int [nnodes];
+    labels = new int [nnodes];
+    ptree = new int [nnodes];
+    ages = new int [nnodes];
+    ptree2 = new int [nnodes];
+    ages2 = new int [nnodes];
+    tree = new LocalTree(nnodes);
+    next_tree = new LocalTree(nnodes);
+}
+
+
+ArgArchiveCursor::~ArgArchiveCursor()
+{
+    delete [] ids;
+    delete [] labels;
+    delete [] ptree;
+    delete [] ages;
+    delete [] ptree2;
+    delete [] ages2;
+    delete tree;
+    delete next_tree;
+}
+
+
+bool ArgArchiveCursor::load_chunk(int chunk2)
+{
+    const char *view;
+    int size;
+    chunk = chunk2;
+    if (!archive->get_chunk_view(sample, chunk, &view, &size)) {
+        if (!archive->read_chunk_data(sample, chunk, buffer))
+            return false;
+        view = &buffer[0];
+        size = buffer.size();
+    }
+    reader = BinaryReader(view, size);
+    return true;
+}
+
+
+// Reads the type and SPR of a record.  The END record is followed by the
+// link into the next chunk, which is read as its SPR.
+bool ArgArchiveCursor::read_record(int32_t *type, BinarySpr *record)
+{
+    return reader.read_int(type) && reader.read(record, sizeof(*record)) &&
+        check_binary_spr(*record, nnodes, time_mapping.size());
+}
+
+
+// Reads the nodes of a TREE record
+bool ArgArchiveCursor::read_nodes()
+{
+    vector<BinaryNode> nodes(nnodes);
+    if (!reader.read(&nodes[0], sizeof(BinaryNode) * nnodes) ||
+        !check_binary_nodes(&nodes[0], nnodes, time_mapping.size()))
+        return false;
+    for (int i=0; i<nnodes; i++) {
+        ptree[i] = nodes[i].parent;
+        ages[i] = time_mapping[nodes[i].age];
+    }
+    return true;
+}
+
+
+// Returns the SPR of a record in node ids
+Spr ArgArchiveCursor::get_spr(const BinarySpr &record) const
+{
+    if (record.is_null())
+        return Spr(-1, -1, -1, -1);
+    return Spr(ids[record.recomb_node], time_mapping[record.recomb_time],
+               ids[record.coal_node], time_mapping[record.coal_time]);
+}
+
+
+// Returns true if the last tree record equals 'expected' when node id i
+// is given label labels[i]
+bool ArgArchiveCursor::match_tree(const LocalTree *expected,
+                                  const int *labels) const
+{
+    for (int i=0; i<nnodes; i++) {
+        const int label = labels[i];
+        const int parent = expected->nodes[i].parent;
+        if (ptree[label] != (parent == -1 ? -1 : labels[parent]) ||
+            ages[label] != expected->nodes[i].age)
+            return false;
+    }
+    return true;
+}
+
+
+// Sets the next tree from the last tree record
+void ArgArchiveCursor::set_next_tree()
+{
+    for (int i=0; i<nnodes; i++) {
+        ptree2[ids[i]] = (ptree[i] == -1 ? -1 : ids[ptree[i]]);
+        ages2[ids[i]] = ages[i];
+    }
+    next_tree->set_ptree(ptree2, nnodes, ages2);
+}
+
+
+// Reads the tree following the current tree into next_tree and sets spr.
+// Sets 'cont' if the current tree continues into the next chunk instead
+// and 'done' at the end of the sample.
+bool ArgArchiveCursor::read_step(int *blocklen, bool *cont, bool *done)
+{
+    *cont = *done = false;
+
+    int32_t type;
+    BinarySpr record;
+    if (!read_record(&type, &record))
+        return false;
+
+    Spr link;
+    bool chunk_start = false;
+    if (type == BINARY_END) {
+        if (chunk + 1 >= archive->get_num_chunks()) {
+            *done = true;
+            return true;
+        }
+        link = get_spr(record);
+        if (!load_chunk(chunk + 1) || !read_record(&type, &record) ||
+            type != BINARY_TREE)
+            return false;
+        chunk_start = true;
+    }
+    *blocklen = record.blocklen;
+
+    // SPR records always reproduce the next tree
+    if (type == BINARY_SPR && !chunk_start) {
+        spr = get_spr(record);
+        if (spr.is_null() || !check_spr_on_tree(tree, spr))
+            return false;
+        next_tree->copy(*tree);
+        apply_spr(next_tree, spr);
+        return true;
+    }
+    if (type != BINARY_TREE || !read_nodes())
+        return false;
+
+    if (chunk_start) {
+        // the first tree of a chunk has canonical labels.  Find the
+        // labels of the tree expected from the link.
+        next_tree->copy(*tree);
+        if (!link.is_null()) {
+            if (!check_spr_on_tree(tree, link))
+                return false;
+            apply_spr(next_tree, link);
+        }
+        get_canonical_labels(next_tree, labels);
+        if (match_tree(next_tree, labels)) {
+            for (int i=0; i<nnodes; i++)
+                ids[labels[i]] = i;
+            if (link.is_null())
+                *cont = true;
+            else
+                spr = link;
+            return true;
+        }
+
+        // start over with the ids of the chunk
+        for (int i=0; i<nnodes; i++)
+            ids[i] = i;
+    }
+
+    // a TREE record within a chunk is only written if its SPR does not
+    // reproduce it
+    spr.set_null();
+    set_next_tree();
+    return true;
+}
+
+
+bool ArgArchiveCursor::next()
+{
+    if (error)
+        return false;
+
+    if (!started) {
+        started = true;
+        int32_t type;
+        BinarySpr record;
+        if (!load_chunk(chunk) || !read_record(&type, &record) ||
+            type != BINARY_TREE || !read_nodes()) {
+            printError("bad chunk in ARG archive");
+            error = true;
+            return false;
+        }
+        for (int i=0; i<nnodes; i++)
+            ids[i] = i;
+        set_next_tree();
+        start = archive->get_chunk_start(chunk);
+        next_blocklen = record.blocklen;
+    } else {
+        if (!has_next)
+            return false;
+        start = end;
+    }
+    swap(tree, next_tree);
+    end = start + next_blocklen;
+
+    // find the end of the tree and the SPR into the next tree
+    while (true) {
+        int blocklen;
+        bool cont, done;
+        if (!read_step(&blocklen, &cont, &done)) {
+            printError("bad chunk in ARG archive");
+            error = true;
+            return false;
+        }
+        if (done) {
+            spr.set_null();
+            has_next = false;
+            return true;
+        }
+        if (!cont) {
+            next_blocklen = blocklen;
+            has_next = true;
+            return true;
+        }
+        end += blocklen;
+    }
+}
+
+
+bool is_arg_archive(const char *filename)
+{
+    const char *suffix = ".arga";
+    const int len = strlen(filename);
+    const int slen = strlen(suffix);
+    return len > slen && strcmp(&filename[len - slen], suffix) == 0;
+}
+
+
+} // namespace argweaver
@@ -0,0 +1,246 @@
+//=============================================================================
+// multi-sample ARG archive
+//
+// An ARG archive (*.arga) stores a series of ARGs sampled for the same
+// region, such as the thinned output of an MCMC run, in a single
+// append-only file, with an index for reading any part of any sample.
+//
+// Layout of an archive (host byte order):
+//
+//   header:  "ARGA", version, chunk_size, nnodes, nleaves, start_coord,
+//            end_coord, ntimes, times[ntimes], chrom, names[nleaves]
+//   entries: each entry is one of
+//     CHUNK:  type, size, then 'size' bytes of chunk data
+//     SAMPLE: type, iteration, nchunks, then the file offset of the data
+//             of each chunk of the sample
+//
+// The region is split into chunks of chunk_size bases.  The data of a
+// chunk are the local trees overlapping it, clipped to the chunk and
+// written as tree records (see binary_trees.h) whose labels start from the
+// canonical labels of the first tree, so that equal chunks have equal
+// data.  After the END record follows a link: the SPR from the last tree
+// into the first tree of the next chunk, or a null SPR if the last tree
+// continues into the next chunk.
+//
+// ArgArchiveWriter writes all chunks of each sample.  Samples of a thinned
+// MCMC run share no chunks, since every thread is resampled between them.
+// The index of a sample may still refer to chunk data written for an
+// earlier sample, and readers support this.
+
+#ifndef ARGWEAVER_ARG_ARCHIVE_H
+#define ARGWEAVER_ARG_ARCHIVE_H
+
+// c/c++ includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// arghmm includes
+#include "binary_trees.h"
+#include "local_tree.h"
+#include "sequences.h"
+
+
+namespace argweaver {
+
+using namespace std;
+
+
+// default number of bases in a chunk
+const int DEFAULT_ARCHIVE_CHUNK_SIZE = 10000;
+
+
+// Appends ARG samples to an archive
+class ArgArchiveWriter
+{
+public:
+    ArgArchiveWriter(int chunk_size=DEFAULT_ARCHIVE_CHUNK_SIZE);
+    ~ArgArchiveWriter();
+
+    // Opens an archive for the region of 'trees'.  If 'append' is true
+    // and the archive exists, new samples are appended to it.  Appending
+    // fails unless the archive has the same region and time points.
+    bool open(const char *filename, const LocalTrees *trees,
+              const char *const *names, const double *times, int ntimes,
+              bool append=false);
+    bool open(const char *filename, const LocalTrees *trees,
+              const Sequences &seqs, const double *times, int ntimes,
+              bool append=false);
+
+    // Appends a sample with the given iteration number
+    bool write_sample(const LocalTrees *trees, int iter);
+
+    void close();
+
+    bool is_open() const { return out != NULL; }
+
+    // statistics
+    int nsamples;
+    long nchunks_written;
+
+protected:
+    void encode_chunk(LocalTrees::const_iterator &it, int &start,
+                      const LocalTrees *trees, int chunk_start,
+                      int chunk_end, vector<char> &data);
+
+    FILE *out;
+    int64_t offset;
+    int chunk_size;
+    int nnodes;
+    int start_coord;
+    int end_coord;
+    BinaryTreeEncoder *encoder;
+};
+
+
+// Reads ARG samples from an archive
+class ArgArchiveReader
+{
+public:
+    ArgArchiveReader();
+    ~ArgArchiveReader();
+
+    // Opens an archive and scans its sample index.  If times is NULL,
+    // time indices of the archive are used unchanged.  Otherwise they are
+    // mapped to the closest of the given time points.
+    bool open(const char *filename, const double *times=NULL,
+              int ntimes=0);
+    void close();
+
+    int get_num_samples() const { return samples.size(); }
+    int get_sample_iter(int sample) const { return samples[sample].iter; }
+    int get_num_chunks() const { return nchunks; }
+    int get_chunk_size() const { return chunk_size; }
+
+    // Returns the index of the last sample with iteration 'iter' or -1
+    int find_sample(int iter) const;
+
+    // Returns the coordinates of a chunk
+    int get_chunk_start(int chunk) const
+    {
+        return start_coord + chunk * chunk_size;
+    }
+    int get_chunk_end(int chunk) const
+    {
+        return min(start_coord + (chunk + 1) * chunk_size, end_coord);
+    }
+
+    // Returns the file offset of the data of a chunk of a sample
+    int64_t get_chunk_offset(int sample, int chunk) const
+    {
+        return samples[sample].offsets[chunk];
+    }
+
+    // Returns the size of the archive up to the last complete entry
+    int64_t get_valid_size() const { return valid_size; }
+
+    // Returns the time index mapping of the archive, one entry per time
+    // point of the file
+    const vector<int> &get_time_mapping() const { return time_mapping; }
+
+    // Sets 'data' to the raw data of a chunk of a sample within the
+    // memory-mapped archive.  Returns false if the archive is not mapped.
+    bool get_chunk_view(int sample, int chunk, const char **data,
+                        int *size) const;
+
+    // Reads the raw data of a chunk of a sample
+    bool read_chunk_data(int sample, int chunk, vector<char> &data);
+
+    // Reads the local trees of one chunk of a sample.  The first tree has
+    // a null SPR.  'link' is set to the SPR from the last tree into the
+    // next chunk, which is null if the last tree continues.
+    bool read_chunk(int sample, int chunk, LocalTrees *trees, Spr *link);
+
+    // Reads the local trees of a sample overlapping [start, end).  By
+    // default the whole region is read.
+    bool read_sample(int sample, LocalTrees *trees,
+                     int start=-1, int end=-1);
+
+    // archive info
+    string chrom;
+    int start_coord;
+    int end_coord;
+    int nnodes;
+    vector<string> seqnames;
+    vector<double> file_times;
+
+protected:
+    struct SampleIndex
+    {
+        int iter;
+        vector<int64_t> offsets;
+    };
+
+    FILE *infile;
+    const char *mapped;
+    int64_t mapped_size;
+    int chunk_size;
+    int nchunks;
+    int64_t valid_size;
+    vector<int> time_mapping;
+    vector<SampleIndex> samples;
+};
+
+
+// Walks the local trees of one sample of an archive, decoding the tree
+// records directly from the memory-mapped archive.  Node ids are kept
+// along the walk: unless 'spr' is null, applying 'spr' to 'tree' (see
+// apply_spr) gives the next tree with its node ids.  A null 'spr' means
+// that the next tree is given afresh (or that there is none).
+class ArgArchiveCursor
+{
+public:
+    // Starts at the chunk containing 'start' (by default the first one)
+    ArgArchiveCursor(ArgArchiveReader *archive, int sample, int start=-1);
+    ~ArgArchiveCursor();
+
+    // Moves to the next tree.  Returns false at the end of the sample or
+    // if the archive is corrupt, in which case 'error' is set.
+    bool next();
+
+    LocalTree *tree;  // current tree
+    int start;        // coordinates of the current tree
+    int end;
+    Spr spr;          // SPR from the current tree into the next one
+    bool error;
+
+protected:
+    bool load_chunk(int chunk);
+    bool read_record(int32_t *type, BinarySpr *record);
+    bool read_nodes();
+    bool read_step(int *blocklen, bool *cont, bool *done);
+    Spr get_spr(const BinarySpr &record) const;
+    bool match_tree(const LocalTree *expected, const int *labels) const;
+    void set_next_tree();
+
+    ArgArchiveReader *archive;
+    const vector<int> &time_mapping;
+    int sample;
+    int nnodes;
+    int chunk;
+    bool started;
+
+    BinaryReader reader; // unread part of the current chunk
+    vector<char> buffer; // chunk data if the archive is not mapped
+
+    int *ids;      // node id of each label of the current chunk
+    int *labels;   // label of each node id
+    int *ptree;    // last tree record, in labels
+    int *ages;
+    int *ptree2;   // last tree record, in node ids
+    int *ages2;
+
+    LocalTree *next_tree;
+    int next_blocklen;
+    bool has_next;
+};
+
+
+// Returns true if filename has the ARG archive suffix (*.arga)
+bool is_arg_archive(const char *filename);
+
+
+} // namespace argweaver
+
+#endif // ARGWEAVER_ARG_ARCHIVE_H
@@ -0,0 +1,281 @@
+//=============================================================================
+// BGZF output and tabix indexes
+
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+
+#include "bgzf.h"
+#include "binary_trees.h"
+#include "logging.h"
+
+
+namespace argweaver {
+
+
+// size of the gzip header and footer of a BGZF block
+const int BGZF_HEADER_SIZE = 18;
+const int BGZF_FOOTER_SIZE = 8;
+
+// empty block marking the end of a BGZF file
+const char BGZF_EOF[] =
+    "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+const int BGZF_EOF_SIZE = 28;
+
+// unset entry of a linear index
+const uint64_t TABIX_UNSET = (uint64_t) -1;
+
+
+static void put_uint16(char *dest, unsigned int value)
+{
+    dest[0] = value & 0xff;
+    dest[1] = (value >> 8) & 0xff;
+}
+
+
+static void put_uint32(char *dest, uint32_t value)
+{
+    put_uint16(dest, value & 0xffff);
+    put_uint16(dest + 2, value >> 16);
+}
+
+
+// Compresses 'size' bytes into a BGZF block.  Returns the size of the
+// block, or -1 if it does not fit.
+static int bgzf_compress_block(char *dest, const char *data, int size,
+                               int level)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    zs.next_in = (Bytef*) data;
+    zs.avail_in = size;
+    zs.next_out = (Bytef*) dest + BGZF_HEADER_SIZE;
+    zs.avail_out = BGZF_MAX_BLOCK_SIZE - BGZF_HEADER_SIZE - BGZF_FOOTER_SIZE;
+    int ret = deflate(&zs, Z_FINISH);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END)
+        return -1;
+
+    const int block_size = BGZF_HEADER_SIZE + zs.total_out + BGZF_FOOTER_SIZE;
+    memcpy(dest, BGZF_EOF, 16);
+    put_uint16(dest + 16, block_size - 1);
+    uLong crc = crc32(crc32(0L, NULL, 0), (const Bytef*) data, size);
+    put_uint32(dest + block_size - 8, crc);
+    put_uint32(dest + block_size - 4, size);
+    return block_size;
+}
+
+
+BgzfWriter::BgzfWriter(int level) :
+    out(NULL),
+    level(level),
+    ok(true),
+    block_address(0),
+    block_used(0)
+{
+    block = new char [BGZF_BLOCK_SIZE];
+    compressed = new char [BGZF_MAX_BLOCK_SIZE];
+}
+
+
+BgzfWriter::~BgzfWriter()
+{
+    close();
+    delete [] block;
+    delete [] compressed;
+}
+
+
+bool BgzfWriter::open(const char *filename)
+{
+    close();
+    out = fopen(filename, "w");
+    if (!out) {
+        printError("cannot open '%s' for writing", filename);
+        return false;
+    }
+    ok = true;
+    block_address = 0;
+    block_used = 0;
+    return true;
+}
+
+
+bool BgzfWriter::close()
+{
+    if (!out)
+        return ok;
+    flush_block();
+    if (fwrite(BGZF_EOF, 1, BGZF_EOF_SIZE, out) != (size_t) BGZF_EOF_SIZE)
+        ok = false;
+    if (fclose(out) != 0)
+        ok = false;
+    out = NULL;
+    return ok;
+}
+
+
+bool BgzfWriter::write(const void *data, size_t size)
+{
+    const char *ptr = (const char*) data;
+    while (size > 0) {
+        int n = min((size_t) (BGZF_BLOCK_SIZE - block_used), size);
+        memcpy(block + block_used, ptr, n);
+        block_used += n;
+        ptr += n;
+        size -= n;
+        if (block_used == BGZF_BLOCK_SIZE)
+            flush_block();
+    }
+    return ok;
+}
+
+
+bool BgzfWriter::flush_block()
+{
+    if (block_used == 0)
+        return ok;
+
+    // fall back to storing data that does not compress into a block
+    int size = bgzf_compress_block(compressed, block, block_used, level);
+    if (size < 0)
+        size = bgzf_compress_block(compressed, block, block_used, 0);
+    if (size < 0 || fwrite(compressed, 1, size, out) != (size_t) size)
+        ok = false;
+    block_address += size;
+    block_used = 0;
+    return ok;
+}
+
+
+//=============================================================================
+// tabix index
+
+unsigned int tabix_reg2bin(int start, int end)
+{
+    end--;
+    if (start >> 14 == end >> 14)
+        return ((1 << 15) - 1) / 7 + (start >> 14);
+    if (start >> 17 == end >> 17)
+        return ((1 << 12) - 1) / 7 + (start >> 17);
+    if (start >> 20 == end >> 20)
+        return ((1 << 9) - 1) / 7 + (start >> 20);
+    if (start >> 23 == end >> 23)
+        return ((1 << 6) - 1) / 7 + (start >> 23);
+    if (start >> 26 == end >> 26)
+        return ((1 << 3) - 1) / 7 + (start >> 26);
+    return 0;
+}
+
+
+bool TabixIndexer::add(const char *chrom, int start, int end,
+                       uint64_t vstart, uint64_t vend)
+{
+    if (refs.size() == 0 || refs.back().name != chrom) {
+        for (unsigned int i=0; i<refs.size(); i++) {
+            if (refs[i].name == chrom) {
+                printError("records are not sorted by chromosome (%s)",
+                           chrom);
+                return false;
+            }
+        }
+        refs.push_back(RefIndex());
+        refs.back().name = chrom;
+        refs.back().last_start = 0;
+    }
+
+    RefIndex &ref = refs.back();
+    if (start < ref.last_start) {
+        printError("records are not sorted by start (%s:%d)", chrom, start);
+        return false;
+    }
+    ref.last_start = start;
+    if (end <= start)
+        end = start + 1;
+
+    // add offsets to the chunks of the bin, merging adjacent ones
+    vector<Chunk> &chunks = ref.bins[tabix_reg2bin(start, end)];
+    if (chunks.size() > 0 && chunks.back().end == vstart) {
+        chunks.back().end = vend;
+    } else {
+        Chunk chunk;
+        chunk.start = vstart;
+        chunk.end = vend;
+        chunks.push_back(chunk);
+    }
+
+    // record first offset of each window
+    const unsigned int first = start >> 14;
+    const unsigned int last = (end - 1) >> 14;
+    if (ref.linear.size() <= last)
+        ref.linear.resize(last + 1, TABIX_UNSET);
+    for (unsigned int i=first; i<=last; i++) {
+        if (ref.linear[i] == TABIX_UNSET)
+            ref.linear[i] = vstart;
+    }
+    return true;
+}
+
+
+// Writes the index in the tabix format (little-endian hosts), with the
+// preset for BED files
+bool TabixIndexer::write(const char *filename)
+{
+    vector<char> data;
+    BinaryWriter writer(&data);
+    writer.write("TBI\1", 4);
+    writer.write_int(refs.size());
+    writer.write_int(0x10000);  // generic format, 0-based coordinates
+    writer.write_int(1);        // columns of chrom, start, end
+    writer.write_int(2);
+    writer.write_int(3);
+    writer.write_int('#');      // comment lines
+    writer.write_int(0);        // lines to skip
+
+    int names_size = 0;
+    for (unsigned int i=0; i<refs.size(); i++)
+        names_size += refs[i].name.size() + 1;
+    writer.write_int(names_size);
+    for (unsigned int i=0; i<refs.size(); i++)
+        writer.write(refs[i].name.c_str(), refs[i].name.size() + 1);
+
+    for (unsigned int i=0; i<refs.size(); i++) {
+        RefIndex &ref = refs[i];
+        writer.write_int(ref.bins.size());
+        for (map<unsigned int, vector<Chunk> >::iterator it=ref.bins.begin();
+             it != ref.bins.end(); ++it) {
+            uint32_t bin = it->first;
+            writer.write(&bin, sizeof(bin));
+            writer.write_int(it->second.size());
+            for (unsigned int j=0; j<it->second.size(); j++) {
+                writer.write(&it->second[j].start, sizeof(uint64_t));
+                writer.write(&it->second[j].end, sizeof(uint64_t));
+            }
+        }
+
+        // windows without records start at the previous offset
+        uint64_t offset = 0;
+        writer.write_int(ref.linear.size());
+        for (unsigned int j=0; j<ref.linear.size(); j++) {
+            if (ref.linear[j] != TABIX_UNSET)
+                offset = ref.linear[j];
+            writer.write(&offset, sizeof(offset));
+        }
+    }
+
+    BgzfWriter out;
+    if (!out.open(filename))
+        return false;
+    out.write(&data[0], data.size());
+    if (!out.close()) {
+        printError("error writing '%s'", filename);
+        return false;
+    }
+    return true;
+}
+
+
+} // namespace argweaver
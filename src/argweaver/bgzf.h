@@ -0,0 +1,116 @@
+//=============================================================================
+// BGZF output and tabix indexes
+//
+// BGZF is the blocked gzip format written by bgzip: a series of gzip
+// members, each holding at most 64KB of data, followed by an empty EOF
+// member.  The file is still valid gzip, but can also be read starting from
+// any block.  Positions within a BGZF file are virtual offsets: the file
+// offset of a block shifted left by 16 bits, plus the offset within the
+// uncompressed data of the block.
+//
+// A tabix index (*.tbi) maps genomic intervals to the virtual offsets of
+// the records overlapping them, using the UCSC binning scheme and a linear
+// index of 16kb windows.
+
+#ifndef ARGWEAVER_BGZF_H
+#define ARGWEAVER_BGZF_H
+
+// c/c++ includes
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace argweaver {
+
+using namespace std;
+
+
+// maximum uncompressed size of a BGZF block
+const int BGZF_BLOCK_SIZE = 0xff00;
+
+// maximum compressed size of a BGZF block
+const int BGZF_MAX_BLOCK_SIZE = 0x10000;
+
+
+// Writes a BGZF file
+class BgzfWriter
+{
+public:
+    BgzfWriter(int level=-1);
+    ~BgzfWriter();
+
+    bool open(const char *filename);
+
+    // Writes the EOF block and closes the file.  Returns false if any
+    // write failed.
+    bool close();
+
+    bool write(const void *data, size_t size);
+    bool write(const string &str) { return write(str.c_str(), str.size()); }
+
+    // Returns the virtual offset of the next byte written
+    uint64_t tell() const
+    {
+        return ((uint64_t) block_address << 16) | block_used;
+    }
+
+    bool is_open() const { return out != NULL; }
+
+protected:
+    bool flush_block();
+
+    FILE *out;
+    int level;
+    bool ok;
+    int64_t block_address;  // file offset of the current block
+    int block_used;         // bytes of data in the current block
+    char *block;            // uncompressed data of the current block
+    char *compressed;
+};
+
+
+// Builds a tabix index for a BGZF file of BED records sorted by chromosome
+// and start coordinate
+class TabixIndexer
+{
+public:
+    TabixIndexer() {}
+
+    // Adds a record for [start, end) on 'chrom' that occupies the virtual
+    // offsets [vstart, vend) in the BGZF file.  Returns false if records
+    // are not sorted.
+    bool add(const char *chrom, int start, int end,
+             uint64_t vstart, uint64_t vend);
+
+    // Writes the index (BGZF-compressed)
+    bool write(const char *filename);
+
+protected:
+    struct Chunk
+    {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    struct RefIndex
+    {
+        string name;
+        int last_start;
+        map<unsigned int, vector<Chunk> > bins;
+        vector<uint64_t> linear;  // first offset of each window
+    };
+
+    vector<RefIndex> refs;
+};
+
+
+// Returns the UCSC bin of the interval [start, end)
+unsigned int tabix_reg2bin(int start, int end);
+
+
+} // namespace argweaver
+
+#endif // ARGWEAVER_BGZF_H
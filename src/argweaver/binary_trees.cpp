@@ -0,0 +1,391 @@
+//=============================================================================
+// binary records of local trees
+
+#include "binary_trees.h"
+#include "logging.h"
+
+
+namespace argweaver {
+
+
+BinaryTreeEncoder::BinaryTreeEncoder(int nnodes) :
+    nnodes(nnodes)
+{
+    labels = new int [nnodes];
+    tmp_labels = new int [nnodes];
+    ptree = new int [nnodes];
+    ages = new int [nnodes];
+    nodes = new BinaryNode [nnodes];
+    for (int i=0; i<nnodes; i++)
+        labels[i] = i;
+}
+
+
+BinaryTreeEncoder::~BinaryTreeEncoder()
+{
+    delete [] labels;
+    delete [] tmp_labels;
+    delete [] ptree;
+    delete [] ages;
+    delete [] nodes;
+}
+
+
+void BinaryTreeEncoder::write_first(BinaryWriter &writer,
+                                    const LocalTree *tree, int blocklen,
+                                    bool canonical)
+{
+    if (canonical) {
+        get_canonical_labels(tree, labels);
+    } else {
+        for (int i=0; i<nnodes; i++)
+            labels[i] = i;
+    }
+
+    BinarySpr spr;
+    spr.blocklen = blocklen;
+    spr.set_null();
+    write_tree(writer, tree, spr, false);
+}
+
+
+void BinaryTreeEncoder::get_spr(const LocalTreeSpr &next,
+                                BinarySpr *spr) const
+{
+    spr->blocklen = next.blocklen;
+    if (next.spr.is_null()) {
+        spr->set_null();
+    } else {
+        spr->recomb_node = labels[next.spr.recomb_node];
+        spr->recomb_time = next.spr.recomb_time;
+        spr->coal_node = labels[next.spr.coal_node];
+        spr->coal_time = next.spr.coal_time;
+    }
+}
+
+
+bool BinaryTreeEncoder::write_next(BinaryWriter &writer,
+                                   const LocalTree *prev_tree,
+                                   const LocalTreeSpr &next, int blocklen,
+                                   bool force_tree)
+{
+    // SPR in relabeled ids of the previous tree
+    BinarySpr spr;
+    get_spr(next, &spr);
+    spr.blocklen = blocklen;
+
+    // update labels
+    if (!spr.is_null()) {
+        const int *mapping = next.mapping;
+        for (int i=0; i<nnodes; i++)
+            tmp_labels[i] = labels[i];
+        for (int i=0; i<nnodes; i++) {
+            if (mapping[i] != -1) {
+                labels[mapping[i]] = tmp_labels[i];
+            } else {
+                int recoal = get_recoal_node(prev_tree, next.spr, mapping);
+                labels[recoal] = tmp_labels[i];
+            }
+        }
+    }
+
+    const bool use_spr = !spr.is_null() && !force_tree;
+    return write_tree(writer, next.tree, spr, use_spr);
+}
+
+
+// Writes a tree as an SPR record if 'use_spr' is true and the SPR
+// reproduces the tree, otherwise as a TREE record.  Returns true if a TREE
+// record was written.
+bool BinaryTreeEncoder::write_tree(BinaryWriter &writer,
+                                   const LocalTree *tree,
+                                   const BinarySpr &spr, bool use_spr)
+{
+    // relabel tree
+    for (int i=0; i<nnodes; i++) {
+        const int parent = tree->nodes[i].parent;
+        const int j = labels[i];
+        ptree[j] = (parent == -1 ? -1 : labels[parent]);
+        ages[j] = tree->nodes[i].age;
+    }
+
+    // use an SPR record only if it reproduces the tree
+    if (use_spr) {
+        Spr spr2(spr.recomb_node, spr.recomb_time,
+                 spr.coal_node, spr.coal_time);
+        apply_spr(&last_tree, spr2);
+        for (int i=0; i<nnodes; i++) {
+            if (last_tree.nodes[i].parent != ptree[i] ||
+                last_tree.nodes[i].age != ages[i]) {
+                use_spr = false;
+                break;
+            }
+        }
+    }
+
+    if (use_spr) {
+        writer.write_int(BINARY_SPR);
+        writer.write(&spr, sizeof(spr));
+    } else {
+        for (int i=0; i<nnodes; i++) {
+            nodes[i].parent = ptree[i];
+            nodes[i].age = ages[i];
+        }
+        writer.write_int(BINARY_TREE);
+        writer.write(&spr, sizeof(spr));
+        writer.write(nodes, sizeof(BinaryNode) * nnodes);
+        last_tree.set_ptree(ptree, nnodes, ages);
+    }
+    return !use_spr;
+}
+
+
+void get_canonical_labels(const LocalTree *tree, int *labels)
+{
+    int order[tree->nnodes];
+    tree->get_postorder(order);
+    for (int i=0; i<tree->nnodes; i++)
+        labels[order[i]] = i;
+}
+
+
+bool check_binary_header(int nnodes, int nleaves, int ntimes)
+{
+    return nleaves > 0 && nleaves <= BINARY_MAX_LEAVES &&
+        nnodes == 2 * nleaves - 1 &&
+        ntimes >= 0 && ntimes <= BINARY_MAX_TIMES;
+}
+
+
+bool check_binary_nodes(const BinaryNode *nodes, int nnodes, int ntimes)
+{
+    const int nleaves = (nnodes + 1) / 2;
+    vector<int> children(2 * nnodes, -1);
+    int root = -1;
+
+    for (int i=0; i<nnodes; i++) {
+        const int parent = nodes[i].parent;
+        if (nodes[i].age < 0 || nodes[i].age >= ntimes)
+            return false;
+        if (parent == -1) {
+            if (root != -1)
+                return false;
+            root = i;
+        } else {
+            if (parent < nleaves || parent >= nnodes ||
+                nodes[parent].age < nodes[i].age)
+                return false;
+            int *c = &children[2 * parent];
+            if (c[0] == -1)
+                c[0] = i;
+            else if (c[1] == -1)
+                c[1] = i;
+            else
+                return false;
+        }
+    }
+    if (root == -1)
+        return false;
+
+    // every internal node has two children and is reachable from the root,
+    // so that there are no cycles
+    for (int i=nleaves; i<nnodes; i++)
+        if (children[2 * i + 1] == -1)
+            return false;
+    vector<int> stack(1, root);
+    int nvisited = 0;
+    while (!stack.empty()) {
+        const int node = stack.back();
+        stack.pop_back();
+        nvisited++;
+        if (node >= nleaves) {
+            stack.push_back(children[2 * node]);
+            stack.push_back(children[2 * node + 1]);
+        }
+    }
+    return nvisited == nnodes;
+}
+
+
+bool check_binary_spr(const BinarySpr &record, int nnodes, int ntimes)
+{
+    if (record.is_null())
+        return true;
+    return record.recomb_node >= 0 && record.recomb_node < nnodes &&
+        record.coal_node >= 0 && record.coal_node < nnodes &&
+        record.recomb_time >= 0 && record.recomb_time < ntimes &&
+        record.coal_time >= 0 && record.coal_time < ntimes;
+}
+
+
+bool check_spr_on_tree(const LocalTree *tree, const Spr &spr)
+{
+    const LocalNode *nodes = tree->nodes;
+    const int broken = nodes[spr.recomb_node].parent;
+    const int coal_parent = nodes[spr.coal_node].parent;
+
+    // recombination on a branch below the root
+    if (broken == -1 ||
+        spr.recomb_time < nodes[spr.recomb_node].age ||
+        spr.recomb_time > nodes[broken].age)
+        return false;
+
+    // coalescence on its branch and not before the recombination
+    if (spr.coal_time < spr.recomb_time ||
+        spr.coal_time < nodes[spr.coal_node].age ||
+        (coal_parent != -1 && spr.coal_time > nodes[coal_parent].age))
+        return false;
+
+    // coalescence outside of the pruned subtree
+    for (int i=spr.coal_node; i != -1; i=nodes[i].parent)
+        if (i == spr.recomb_node)
+            return false;
+    return true;
+}
+
+
+bool read_binary_tree_records(BinaryReader &reader, int nnodes,
+                              const vector<int> &time_mapping, int start,
+                              int region_end, LocalTrees *trees)
+{
+    const int ntimes = time_mapping.size();
+    BinaryNode *nodes = new BinaryNode [nnodes];
+    int *ptree = new int [nnodes];
+    int *ages = new int [nnodes];
+    LocalTree *last_tree = NULL;
+    bool result = true;
+
+    while (true) {
+        int32_t type;
+        BinarySpr record;
+        if (!reader.read_int(&type) ||
+            (type != BINARY_END && !reader.read(&record, sizeof(record)))) {
+            printError("unexpected end of binary ARG");
+            result = false;
+            break;
+        }
+        if (type == BINARY_END || (region_end >= 0 && start >= region_end))
+            break;
+        if (!check_binary_spr(record, nnodes, ntimes)) {
+            printError("bad record in binary ARG");
+            result = false;
+            break;
+        }
+
+        Spr spr(record.recomb_node, record.recomb_time,
+                record.coal_node, record.coal_time);
+        if (!spr.is_null()) {
+            spr.recomb_time = time_mapping[spr.recomb_time];
+            spr.coal_time = time_mapping[spr.coal_time];
+        }
+
+        LocalTree *tree;
+        if (type == BINARY_TREE) {
+            if (!reader.read(nodes, sizeof(BinaryNode) * nnodes)) {
+                printError("unexpected end of binary ARG");
+                result = false;
+                break;
+            }
+            if (!check_binary_nodes(nodes, nnodes, ntimes)) {
+                printError("bad record in binary ARG");
+                result = false;
+                break;
+            }
+            for (int i=0; i<nnodes; i++) {
+                ptree[i] = nodes[i].parent;
+                ages[i] = time_mapping[nodes[i].age];
+            }
+            tree = new LocalTree(ptree, nnodes, ages);
+        } else if (type == BINARY_SPR && last_tree && !spr.is_null()) {
+            tree = new LocalTree(*last_tree);
+        } else {
+            printError("bad record in binary ARG");
+            result = false;
+            break;
+        }
+
+        if (last_tree && !spr.is_null() && !check_spr_on_tree(last_tree, spr)) {
+            printError("bad record in binary ARG");
+            delete tree;
+            result = false;
+            break;
+        }
+        if (type == BINARY_SPR)
+            apply_spr(tree, spr);
+
+        // first tree has no SPR to its left
+        if (!last_tree)
+            spr.set_null();
+
+        // setup mapping
+        int *mapping = NULL;
+        if (!spr.is_null()) {
+            mapping = new int [nnodes];
+            for (int i=0; i<nnodes; i++)
+                mapping[i] = i;
+            mapping[last_tree->nodes[spr.recomb_node].parent] = -1;
+        }
+
+        trees->trees.push_back(
+            LocalTreeSpr(tree, spr, record.blocklen, mapping));
+        last_tree = tree;
+        start += record.blocklen;
+    }
+
+    delete [] nodes;
+    delete [] ptree;
+    delete [] ages;
+    return result;
+}
+
+
+void crop_binary_trees(LocalTrees *trees, int start, int region_start,
+                       int region_end)
+{
+    // drop trees before the region
+    while (trees->get_num_trees() > 1 &&
+           start + trees->front().blocklen <= region_start) {
+        start += trees->front().blocklen;
+        trees->front().clear();
+        trees->trees.pop_front();
+    }
+    if (trees->get_num_trees() > 0) {
+        LocalTreeSpr &first = trees->front();
+        first.spr.set_null();
+        if (first.mapping) {
+            delete [] first.mapping;
+            first.mapping = NULL;
+        }
+    }
+
+    // trim blocks to region
+    trees->start_coord = region_start;
+    trees->front().blocklen -= region_start - start;
+    int end = region_start;
+    for (LocalTrees::iterator it=trees->begin(); it != trees->end(); ++it)
+        end += it->blocklen;
+
+    // drop trees after the region
+    while (trees->get_num_trees() > 1 &&
+           end - trees->back().blocklen >= region_end) {
+        end -= trees->back().blocklen;
+        trees->back().clear();
+        trees->trees.pop_back();
+    }
+    trees->back().blocklen -= end - region_end;
+    trees->end_coord = region_end;
+}
+
+
+void get_binary_time_mapping(const vector<double> &file_times,
+                             const double *times, int ntimes,
+                             vector<int> &time_mapping)
+{
+    time_mapping.resize(max(file_times.size(), (size_t) 1));
+    for (unsigned int i=0; i<file_times.size(); i++)
+        time_mapping[i] = (times ? find_time(file_times[i], times, ntimes) :
+                           i);
+}
+
+
+} // namespace argweaver
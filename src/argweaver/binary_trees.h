@@ -0,0 +1,242 @@
+//=============================================================================
+// binary records of local trees
+//
+// The binary ARG file (*.argb) and the ARG archive (*.arga) store local
+// trees as a sequence of fixed-width records (host byte order):
+//
+//   TREE record: type, SPR, then a (parent, age) node record for every node
+//   SPR record:  type, SPR
+//   END record:  type
+//
+// The SPR of a record transforms the previous tree into the next one and
+// also gives the length of the block.  An SPR record is only used when
+// applying its SPR reproduces the next tree exactly.  As in the text
+// format, node ids are relabeled so that the broken node of each SPR is
+// reused as the recoalescing node.
+
+#ifndef ARGWEAVER_BINARY_TREES_H
+#define ARGWEAVER_BINARY_TREES_H
+
+// c/c++ includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// arghmm includes
+#include "local_tree.h"
+
+
+namespace argweaver {
+
+using namespace std;
+
+
+// limits on the header of a binary file, so that corrupt files cannot
+// request unbounded allocations
+const int BINARY_MAX_LEAVES = 1 << 20;
+const int BINARY_MAX_TIMES = 1 << 16;
+const int BINARY_MAX_STRING = 1 << 20;
+
+
+// record types
+enum {
+    BINARY_END = 0,
+    BINARY_TREE = 1,
+    BINARY_SPR = 2
+};
+
+
+// fixed-width node record
+struct BinaryNode
+{
+    int32_t parent;
+    int32_t age;
+};
+
+
+// fixed-width SPR record
+struct BinarySpr
+{
+    int32_t blocklen;
+    int32_t recomb_node;
+    int32_t recomb_time;
+    int32_t coal_node;
+    int32_t coal_time;
+
+    void set_null()
+    {
+        recomb_node = recomb_time = -1;
+        coal_node = coal_time = -1;
+    }
+
+    bool is_null() const
+    {
+        return recomb_node == -1;
+    }
+};
+
+
+// Writes binary data to a file or memory buffer while keeping track of
+// the offset, so that indexes can also be built for unseekable streams
+class BinaryWriter
+{
+public:
+    BinaryWriter(FILE *out) :
+        out(out), buffer(NULL), offset(0), ok(true) {}
+    BinaryWriter(vector<char> *buffer) :
+        out(NULL), buffer(buffer), offset(0), ok(true) {}
+
+    void write(const void *data, size_t size)
+    {
+        if (out) {
+            if (fwrite(data, 1, size, out) != size)
+                ok = false;
+        } else {
+            const char *ptr = (const char*) data;
+            buffer->insert(buffer->end(), ptr, ptr + size);
+        }
+        offset += size;
+    }
+
+    void write_int(int32_t value) { write(&value, sizeof(value)); }
+
+    void write_string(const string &str)
+    {
+        write_int(str.size());
+        write(str.c_str(), str.size());
+    }
+
+    FILE *out;
+    vector<char> *buffer;
+    int64_t offset;
+    bool ok;
+};
+
+
+// Reads binary data from a file or memory buffer
+class BinaryReader
+{
+public:
+    BinaryReader(FILE *in) :
+        in(in), data(NULL), end(NULL) {}
+    BinaryReader(const char *data, size_t size) :
+        in(NULL), data(data), end(data + size) {}
+
+    bool read(void *dest, size_t size)
+    {
+        if (in)
+            return fread(dest, 1, size, in) == size;
+        if (size_t(end - data) < size)
+            return false;
+        memcpy(dest, data, size);
+        data += size;
+        return true;
+    }
+
+    bool read_int(int32_t *value) { return read(value, sizeof(*value)); }
+
+    bool read_string(string &str)
+    {
+        int32_t len;
+        if (!read_int(&len) || len < 0 || len > BINARY_MAX_STRING)
+            return false;
+        str.resize(len);
+        return len == 0 || read(&str[0], len);
+    }
+
+    FILE *in;
+    const char *data;
+    const char *end;
+};
+
+
+// Writes a sequence of local trees as binary records, keeping track of
+// the relabeling of nodes
+class BinaryTreeEncoder
+{
+public:
+    BinaryTreeEncoder(int nnodes);
+    ~BinaryTreeEncoder();
+
+    // Writes a TREE record that starts a new sequence of records.  If
+    // 'canonical' is true, nodes are labeled by their postorder rank (see
+    // get_canonical_labels), so that equal trees are written identically.
+    // Otherwise the node ids of 'tree' are kept.
+    void write_first(BinaryWriter &writer, const LocalTree *tree,
+                     int blocklen, bool canonical);
+
+    // Writes a record for the tree of 'next' that follows 'prev_tree'.
+    // A TREE record is written if 'force_tree' is true or if the SPR does
+    // not reproduce the tree.  Returns true if a TREE record was written.
+    bool write_next(BinaryWriter &writer, const LocalTree *prev_tree,
+                    const LocalTreeSpr &next, int blocklen,
+                    bool force_tree=false);
+
+    // Returns the SPR of 'next' in the labels of the last written tree
+    void get_spr(const LocalTreeSpr &next, BinarySpr *spr) const;
+
+protected:
+    bool write_tree(BinaryWriter &writer, const LocalTree *tree,
+                    const BinarySpr &spr, bool use_spr);
+
+    int nnodes;
+    int *labels;       // label of each node of the current tree
+    int *tmp_labels;
+    int *ptree;
+    int *ages;
+    BinaryNode *nodes;
+    LocalTree last_tree; // last written tree in relabeled ids
+};
+
+
+// Labels the nodes of a tree by their postorder rank.  Leaves keep their
+// ids and the labels depend only on the topology, so equal trees get
+// equal labels.
+void get_canonical_labels(const LocalTree *tree, int *labels);
+
+// Returns true if the node, leaf, and time point counts of a header
+// describe binary trees within the limits above
+bool check_binary_header(int nnodes, int nleaves, int ntimes);
+
+// Returns true if the nodes of a TREE record form a binary tree: one root
+// from which every node is reachable, leaves 0..nleaves-1 without
+// children, internal nodes with two children, parents no younger than
+// their children, and ages within the 'ntimes' time points of the file
+bool check_binary_nodes(const BinaryNode *nodes, int nnodes, int ntimes);
+
+// Returns true if the SPR of a record is null or refers to valid nodes
+// and time points of the file
+bool check_binary_spr(const BinarySpr &record, int nnodes, int ntimes);
+
+// Returns true if a non-null SPR can be applied to 'tree': the
+// recombination and coalescence times lie on their branches, the
+// recombination is not on the root branch, and the coalescence is outside
+// of the subtree that is pruned
+bool check_spr_on_tree(const LocalTree *tree, const Spr &spr);
+
+// Reads binary tree records until the end record or until a tree
+// starting at or after 'region_end' is reached and appends them to
+// 'trees'.  'start' is the start coordinate of the first record.  The
+// first tree read has a null SPR.  Returns false on truncated or invalid
+// records.
+bool read_binary_tree_records(BinaryReader &reader, int nnodes,
+                              const vector<int> &time_mapping, int start,
+                              int region_end, LocalTrees *trees);
+
+// Crops trees read from binary records to [region_start, region_end).
+// 'start' is the start coordinate of the first tree.
+void crop_binary_trees(LocalTrees *trees, int start, int region_start,
+                       int region_end);
+
+// Maps the time points of a file onto the given time points.  If times
+// is NULL, the time indices of the file are used unchanged.
+void get_binary_time_mapping(const vector<double> &file_times,
+                             const double *times, int ntimes,
+                             vector<int> &time_mapping);
+
+
+} // namespace argweaver
+
+#endif // ARGWEAVER_BINARY_TREES_H
@@ -290,6 +290,37 @@ inline int sample(const double *weights, int nweights)
 }
 
 
+// Samples like sample() from the weights a[i] * b[i], without storing
+// the products.  The running sums are kept so that the chosen item is
+// found by binary search instead of a second linear scan; the result is
+// the same as sample() for the same random number.
+inline int sample_product(const double *a, const double *b, int n)
+{
+    double cumsum[n];
+    double total = 0.0;
+    for (int i=0; i<n; i++) {
+        total += a[i] * b[i];
+        cumsum[i] = total;
+    }
+
+    double pick = frand(total);
+
+    // find first item whose running sum reaches pick
+    int low = 0;
+    int high = n - 1;
+    while (low < high) {
+        const int mid = (low + high) / 2;
+        if (cumsum[mid] >= pick)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    if (cumsum[low] < pick)
+        return n - 1;
+    return low;
+}
+
+
 template <class T>
 inline T max_array(const T* lst, int size)
 {
@@ -1,6 +1,7 @@
 
 #include "common.h"
 #include "emit.h"
+#include "scratch.h"
 #include "seq.h"
 #include "thread.h"
 
@@ -58,6 +59,47 @@ void find_masked_sites(const char *const *seqs, int nseqs, int seqlen,
 }
 
 
+// Populates array 'pattern' with the first site whose alignment column is
+// identical to that of each variant site, so that such sites can share
+// their emissions.  Invariant sites map to themselves.
+static void find_site_patterns(const char *const *seqs, int nseqs,
+                               int seqlen, const bool *invariant,
+                               int *pattern, ScratchArena &arena)
+{
+    // open addressing hash table of first sites
+    int size = 1;
+    while (size < 2 * seqlen)
+        size *= 2;
+    int *table = arena.alloc<int>(size);
+    fill(table, table + size, -1);
+
+    for (int i=0; i<seqlen; i++) {
+        pattern[i] = i;
+        if (invariant[i])
+            continue;
+
+        unsigned int hash = 2166136261u;
+        for (int j=0; j<nseqs; j++)
+            hash = (hash ^ (unsigned char) seqs[j][i]) * 16777619u;
+
+        for (int k=hash & (size - 1); ; k=(k + 1) & (size - 1)) {
+            const int site = table[k];
+            if (site == -1) {
+                table[k] = i;
+                break;
+            }
+            int j = 0;
+            while (j < nseqs && seqs[j][site] == seqs[j][i])
+                j++;
+            if (j == nseqs) {
+                pattern[i] = site;
+                break;
+            }
+        }
+    }
+}
+
+
 int count_alleles(const char *const *seqs,
                   const int nseqs, const int pos)
 {
@@ -122,23 +164,16 @@ void prob_tree_mutation(const LocalTree *tree, const ArgModel *model,
 // table of partial likelihood values
 typedef double lk_row[4];
 
+// NOTE: table memory is drawn from a scratch arena and is released with
+// the enclosing ScratchFrame
 class LikelihoodTable
 {
 public:
-    LikelihoodTable(int seqlen, int nnodes) :
+    LikelihoodTable(int seqlen, int nnodes, ScratchArena &arena) :
         seqlen(seqlen),
         nnodes(nnodes)
     {
-        data = new lk_row* [seqlen];
-        for (int i=0; i<seqlen; i++)
-            data[i] = new double [nnodes][4];
-    }
-
-    ~LikelihoodTable()
-    {
-        for (int i=0; i<seqlen; i++)
-            delete [] data[i];
-        delete [] data;
+        data = arena.alloc_matrix<lk_row>(seqlen, nnodes);
     }
 
     int seqlen;
@@ -600,7 +635,9 @@ void get_infinite_sites_states(const States &states, const LocalTree *tree,
         phase_pr->treemap1 >= 0    && phase_pr->treemap2 >= 0 &&
         phase_pr->treemap1 < nseqs && phase_pr->treemap2 < nseqs) {
         int nstates = states.size();
-        bool **valid_states2 = new_matrix<bool>(seqlen, nstates);
+        ScratchArena &arena = get_scratch_arena();
+        ScratchFrame frame(arena);
+        bool **valid_states2 = arena.alloc_matrix<bool>(seqlen, nstates);
         const char *flipSeqs[nseqs];
         for (int i=0; i < nseqs; i++)
             flipSeqs[i] = seqs[i];
@@ -669,18 +706,41 @@ void calc_emissions(const States &states, const LocalTree *tree,
     }
 
 
+    // all temporaries for this block are drawn from the scratch arena
+    ScratchArena &arena = get_scratch_arena();
+    ScratchFrame frame(arena);
+
     // find invariant sites
-    bool *invariant = new bool [seqlen];
-    bool *masked = new bool [seqlen];
+    bool *invariant = arena.alloc<bool>(seqlen);
+    bool *masked = arena.alloc<bool>(seqlen);
     find_invariant_sites(seqs, nseqs, seqlen, invariant);
     find_masked_sites(seqs, nseqs, seqlen, masked, invariant);
 
+    // tables for the alternative phasing are only needed for unphased data
+    const bool use_phase = (
+        model->unphased && phase_pr != NULL &&
+        phase_pr->treemap1 >= 0 && phase_pr->treemap1 < nseqs &&
+        phase_pr->treemap2 >= 0 && phase_pr->treemap2 < nseqs);
+
+    // variant sites with the same column as an earlier site copy its
+    // emissions (phase probabilities are recorded per site)
+    int *pattern = arena.alloc<int>(seqlen);
+    bool *skip = arena.alloc<bool>(seqlen);
+    if (use_phase) {
+        for (int i=0; i<seqlen; i++)
+            pattern[i] = i;
+    } else {
+        find_site_patterns(seqs, nseqs, seqlen, invariant, pattern, arena);
+    }
+    for (int i=0; i<seqlen; i++)
+        skip[i] = invariant[i] || pattern[i] != i;
+
 
     // compute inner and outer likelihood tables
-    LikelihoodTable inner(seqlen, tree->nnodes);
-    LikelihoodTable inner_subtree(seqlen, 1);
-    LikelihoodTable outer(seqlen, tree->nnodes);
-    calc_inner_outer(tree, model, seqs, seqlen, invariant, internal,
+    LikelihoodTable inner(seqlen, tree->nnodes, arena);
+    LikelihoodTable inner_subtree(seqlen, 1, arena);
+    LikelihoodTable outer(seqlen, tree->nnodes, arena);
+    calc_inner_outer(tree, model, seqs, seqlen, skip, internal,
                      inner.data, outer.data);
 
     if (!internal) {
@@ -702,19 +762,18 @@ void calc_emissions(const States &states, const LocalTree *tree,
         }
     }
 
-    LikelihoodTable inner2(seqlen, tree->nnodes);
-    LikelihoodTable inner_subtree2(seqlen, 1);
-    LikelihoodTable outer2(seqlen, tree->nnodes);
+    const int seqlen2 = use_phase ? seqlen : 0;
+    LikelihoodTable inner2(seqlen2, tree->nnodes, arena);
+    LikelihoodTable inner_subtree2(seqlen2, 1, arena);
+    LikelihoodTable outer2(seqlen2, tree->nnodes, arena);
     bool *not_het = NULL;
-    if (model->unphased && phase_pr != NULL &&
-	phase_pr->treemap1 >= 0 && phase_pr->treemap1 < nseqs &&
-	phase_pr->treemap2 >= 0 && phase_pr->treemap2 < nseqs) {
+    if (use_phase) {
 	const char *subseqs[nseqs];
 	for (int i=0; i < nseqs; i++)
 	    subseqs[i] = seqs[i];
 	subseqs[phase_pr->treemap1] = seqs[phase_pr->treemap2];
 	subseqs[phase_pr->treemap2] = seqs[phase_pr->treemap1];
-	not_het = new bool[seqlen];
+	not_het = arena.alloc<bool>(seqlen);
 	for (int i=0; i < seqlen; i++)
 	    not_het[i] = (seqs[phase_pr->treemap1][i] == seqs[phase_pr->treemap2][i]);
 
@@ -774,14 +833,20 @@ void calc_emissions(const States &states, const LocalTree *tree,
     }
 
 
-    // populate emission table
+    // compute branch mutation probabilities and invariant site
+    // likelihoods of every state once for the block
+    int *node2s = arena.alloc<int>(nstates);
+    double *muts = arena.alloc<double>(3 * nstates);
+    double *nomuts = arena.alloc<double>(3 * nstates);
+    double *invariant_lks = arena.alloc<double>(nstates);
+    const int node1 = internal ? subtree_root : 0;
     for (int j=0; j<nstates; j++) {
         State state = states[j];
 
         // get nodes
-        int node1 = internal ? subtree_root : 0;
         int node2 = state.node;
         int parent = tree->nodes[node2].parent;
+        node2s[j] = node2;
 
         // get times
         double time1 = internal ? model->times[tree->nodes[node1].age] : 0.0;
@@ -791,18 +856,18 @@ void calc_emissions(const States &states, const LocalTree *tree,
         double coal_time = model->times[state.time];
 
         // get distances
-	double dist[3], mut[3], nomut[3];
+        double dist[3];
         dist[0] = max(coal_time - time1, mintime);
         dist[1] = max(coal_time - time2, mintime);
         dist[2] = max(parent_time - coal_time, mintime);
 
         // get mutation probabilities
-        mut[0] = prob_branch(dist[0], model->mu, true);
-        mut[1] = prob_branch(dist[1], model->mu, true);
-        mut[2] = prob_branch(dist[2], model->mu, true);
-        nomut[0] = prob_branch(dist[0], model->mu, false);
-        nomut[1] = prob_branch(dist[1], model->mu, false);
-        nomut[2] = prob_branch(dist[2], model->mu, false);
+        double *mut = &muts[3*j];
+        double *nomut = &nomuts[3*j];
+        for (int k=0; k<3; k++) {
+            mut[k] = prob_branch(dist[k], model->mu, true);
+            nomut[k] = prob_branch(dist[k], model->mu, false);
+        }
 
         // get tree length
         double treelen;
@@ -816,30 +881,42 @@ void calc_emissions(const States &states, const LocalTree *tree,
                 + max(coal_time - time1, mintime);
 
         // calculate invariant_lk
-        double invariant_lk = .25 * exp(- model->mu * max(treelen, mintime));
+        invariant_lks[j] = .25 * exp(- model->mu * max(treelen, mintime));
+    }
 
-        // fill in row of emission table
-        for (int i=0; i<seqlen; i++) {
-            if (masked[i]) {
-                // masked site
-                emit[i][j] = 1.0;
-            } else if (invariant[i]) {
-                // invariant site
-                emit[i][j] = invariant_lk;
-            } else {
-		emit[i][j] = calc_emit(inner.data[i], outer.data[i],
-				       internal ? inner.data[i] : inner_subtree.data[i],
-				       i, node1, node2, maintree_root,
-				       nomut, mut);
-		if (not_het != NULL && not_het[i]==0) {
-		    double emit2 = calc_emit(inner2.data[i], outer2.data[i],
-					    internal ? inner2.data[i] : inner_subtree2.data[i],
-					    i, node1, node2, maintree_root,
-					    nomut, mut);
-		    phase_pr->add(i, j, emit[i][j]/(emit[i][j] + emit2), nstates);
-		    emit[i][j] += emit2;
-		    emit[i][j] *= 0.5;
-		}
+
+    // populate emission table one site (row) at a time
+    for (int i=0; i<seqlen; i++) {
+        double *row = emit[i];
+        if (masked[i]) {
+            // masked site
+            fill(row, row + nstates, 1.0);
+        } else if (invariant[i]) {
+            // invariant site
+            copy(invariant_lks, invariant_lks + nstates, row);
+        } else if (pattern[i] != i) {
+            // same column as an earlier site
+            copy(emit[pattern[i]], emit[pattern[i]] + nstates, row);
+        } else {
+            lk_row *in2 = internal ? inner.data[i] : inner_subtree.data[i];
+            for (int j=0; j<nstates; j++) {
+                row[j] = calc_emit(inner.data[i], outer.data[i], in2,
+                                   i, node1, node2s[j], maintree_root,
+                                   &nomuts[3*j], &muts[3*j]);
+            }
+
+            if (not_het != NULL && not_het[i]==0) {
+                lk_row *in2b = internal ? inner2.data[i] :
+                    inner_subtree2.data[i];
+                for (int j=0; j<nstates; j++) {
+                    double emit2 = calc_emit(inner2.data[i], outer2.data[i],
+                                             in2b, i, node1, node2s[j],
+                                             maintree_root,
+                                             &nomuts[3*j], &muts[3*j]);
+                    phase_pr->add(i, j, row[j]/(row[j] + emit2), nstates);
+                    row[j] += emit2;
+                    row[j] *= 0.5;
+                }
             }
         }
     }
@@ -847,7 +924,7 @@ void calc_emissions(const States &states, const LocalTree *tree,
     // optionally enforce infinite sites model
     if (model->infsites_penalty < 1.0) {
 
-        bool **valid_states = new_matrix<bool>(seqlen, nstates);
+        bool **valid_states = arena.alloc_matrix<bool>(seqlen, nstates);
         get_infinite_sites_states(states, tree, seqs, nseqs, seqlen,
                                   invariant, internal, valid_states,
                                   model->unphased ? phase_pr : NULL);
@@ -858,14 +935,7 @@ void calc_emissions(const States &states, const LocalTree *tree,
                         emit[i][j] *= model->infsites_penalty;
             }
         }
-        delete_matrix<bool>(valid_states, seqlen);
     }
-
-
-    // clean up
-    delete [] invariant;
-    delete [] masked;
-    if (not_het != NULL) delete [] not_het;
 }
 
 // calculate emissions for external branch resampling
@@ -1144,8 +1214,10 @@ void calc_emissions_external_slow(
 {
     const int nstates = states.size();
     const int newleaf = tree->get_num_leaves();
-    bool *invariant = new bool [seqlen];
-    LikelihoodTable table(seqlen, tree->nnodes+2);
+    ScratchArena &arena = get_scratch_arena();
+    ScratchFrame frame(arena);
+    bool *invariant = arena.alloc<bool>(seqlen);
+    LikelihoodTable table(seqlen, tree->nnodes+2, arena);
 
     // create local tree we can edit
     LocalTree tree2(tree->nnodes, tree->nnodes + 2);
@@ -1163,8 +1235,6 @@ void calc_emissions_external_slow(
 
         remove_tree_branch(&tree2, newleaf, NULL);
     }
-
-    delete [] invariant;
 }
 
 
@@ -1185,8 +1255,10 @@ void calc_emissions_internal_slow(
         return;
     }
 
-    bool *invariant = new bool [seqlen];
-    LikelihoodTable table(seqlen, tree->nnodes+2);
+    ScratchArena &arena = get_scratch_arena();
+    ScratchFrame frame(arena);
+    bool *invariant = arena.alloc<bool>(seqlen);
+    LikelihoodTable table(seqlen, tree->nnodes+2, arena);
 
     // create local tree we can edit
     LocalTree tree2(tree->nnodes, tree->nnodes + 2);
@@ -1209,9 +1281,6 @@ void calc_emissions_internal_slow(
                        tree2.root, maxtime);
         apply_spr(&tree2, remove_spr);
     }
-
-    // clean up
-    delete [] invariant;
 }
 
 
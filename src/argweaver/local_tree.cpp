@@ -2,8 +2,10 @@
 // C/C++ includes
 #include "math.h"
 #include "stdio.h"
+#include <stdint.h>
 
 // argweaver includes
+#include "binary_trees.h"
 #include "compress.h"
 #include "common.h"
 #include "local_tree.h"
@@ -449,6 +451,7 @@ bool remove_null_spr(LocalTrees *trees, LocalTrees::iterator it)
 
     // delete this tree
     it2->blocklen += it->blocklen;
+    it2->invalidate_cache();
     it->clear();
     trees->trees.erase(it);
 
@@ -537,6 +540,7 @@ LocalTrees *partition_local_trees(LocalTrees *trees, int pos,
 
     trees->end_coord = pos;
     it2->blocklen -= pos - it_start;
+    it2->invalidate_cache();
     assert(it2->blocklen > 0);
 
     //assert_trees(trees);
@@ -760,6 +764,13 @@ void append_local_trees(LocalTrees *trees, LocalTrees *trees2, bool merge)
     trees->end_coord = trees2->end_coord;
     trees2->end_coord = trees2->start_coord;
 
+    // first tree of trees2 now has a previous tree
+    if (ntrees > 0 && ntrees2 > 0) {
+        LocalTrees::iterator it2 = it;
+        ++it2;
+        it2->invalidate_cache();
+    }
+
     // set the mapping the newly neighboring trees
     if (merge && ntrees > 0 && ntrees2 > 0) {
         LocalTrees::iterator it2 = it;
@@ -1563,6 +1574,338 @@ bool read_local_trees(const char *filename, const double *times,
 
 
 
+//=============================================================================
+// binary input and output of local trees
+//
+// Layout of a binary ARG file (host byte order):
+//
+//   header:  "ARGB", version, nnodes, nleaves, start_coord, end_coord,
+//            ntimes, times[ntimes], chrom, names[nleaves]
+//   records: tree records as described in binary_trees.h.  Every
+//            BINARY_TREE_INTERVAL trees a TREE record is written.
+//   index:   nkeys, then (start, tree index, file offset) for each TREE
+//            record
+//   footer:  offset of index, "ARGI"
+
+static const char *BINARY_MAGIC = "ARGB";
+static const char *BINARY_INDEX_MAGIC = "ARGI";
+static const int BINARY_VERSION = 1;
+static const int BINARY_TREE_INTERVAL = 64;
+
+
+// entry of the block index
+struct BinaryIndexEntry
+{
+    int32_t start;
+    int32_t tree;
+    int64_t offset;
+};
+
+
+void write_local_trees_binary(FILE *out, const LocalTrees *trees,
+                              const char *const *names,
+                              const double *times, int ntimes)
+{
+    const int nnodes = trees->nnodes;
+    const int nleaves = trees->get_num_leaves();
+    BinaryWriter writer(out);
+
+    // write header
+    writer.write(BINARY_MAGIC, 4);
+    writer.write_int(BINARY_VERSION);
+    writer.write_int(nnodes);
+    writer.write_int(nleaves);
+    writer.write_int(trees->start_coord);
+    writer.write_int(trees->end_coord);
+    writer.write_int(ntimes);
+    writer.write(times, sizeof(double) * ntimes);
+    writer.write_string(trees->chrom);
+    for (int i=0; i<nleaves; i++) {
+        if (names)
+            writer.write_string(names[trees->seqids[i]]);
+        else
+            writer.write_string("");
+    }
+
+    // write tree records
+    BinaryTreeEncoder encoder(nnodes);
+    vector<BinaryIndexEntry> index;
+    int end = trees->start_coord;
+    int itree = 0;
+    const LocalTree *prev_tree = NULL;
+    for (LocalTrees::const_iterator it=trees->begin();
+         it != trees->end(); ++it, itree++)
+    {
+        const int start = end;
+        end += it->blocklen;
+
+        BinaryIndexEntry entry;
+        entry.start = start;
+        entry.tree = itree;
+        entry.offset = writer.offset;
+
+        if (!prev_tree) {
+            encoder.write_first(writer, it->tree, it->blocklen, false);
+            index.push_back(entry);
+        } else if (encoder.write_next(writer, prev_tree, *it, it->blocklen,
+                                      itree % BINARY_TREE_INTERVAL == 0)) {
+            index.push_back(entry);
+        }
+
+        prev_tree = it->tree;
+    }
+    writer.write_int(BINARY_END);
+
+    // write index and footer
+    const int64_t index_offset = writer.offset;
+    writer.write_int(index.size());
+    if (index.size() > 0)
+        writer.write(&index[0], sizeof(BinaryIndexEntry) * index.size());
+    writer.write(&index_offset, sizeof(index_offset));
+    writer.write(BINARY_INDEX_MAGIC, 4);
+
+    if (!writer.ok)
+        printError("error writing binary local trees");
+}
+
+
+bool write_local_trees_binary(const char *filename, const LocalTrees *trees,
+                              const char *const *names,
+                              const double *times, int ntimes)
+{
+    FILE *out = NULL;
+
+    if ((out = fopen(filename, "wb")) == NULL) {
+        printError("cannot write file '%s'\n", filename);
+        return false;
+    }
+
+    write_local_trees_binary(out, trees, names, times, ntimes);
+    fclose(out);
+    return true;
+}
+
+
+void write_local_trees_binary(FILE *out, const LocalTrees *trees,
+                              const Sequences &seqs,
+                              const double *times, int ntimes)
+{
+    // setup names
+    const unsigned int nleaves = trees->get_num_leaves();
+    vector<string> names2(nleaves);
+    const char **names = new const char* [nleaves];
+    for (unsigned int i=0; i<nleaves; i++) {
+        if (i < seqs.names.size()) {
+            names2[i] = seqs.names[i];
+        } else {
+            // use ids
+            char id[11];
+            snprintf(id, 10, "%d", i);
+            names2[i] = id;
+        }
+        names[i] = names2[i].c_str();
+    }
+
+    write_local_trees_binary(out, trees, names, times, ntimes);
+    delete [] names;
+}
+
+
+bool write_local_trees_binary(const char *filename, const LocalTrees *trees,
+                              const Sequences &seqs,
+                              const double *times, int ntimes)
+{
+    FILE *out = NULL;
+
+    if ((out = fopen(filename, "wb")) == NULL) {
+        printError("cannot write file '%s'\n", filename);
+        return false;
+    }
+
+    write_local_trees_binary(out, trees, seqs, times, ntimes);
+    fclose(out);
+    return true;
+}
+
+
+// Reads the header of a binary ARG file.  Returns the number of nodes
+// or -1 on error.
+static int read_local_trees_binary_header(
+    BinaryReader &reader, LocalTrees *trees, vector<string> &seqnames,
+    vector<double> &file_times)
+{
+    char magic[4];
+    int32_t version, nnodes, nleaves, ntimes;
+    if (!reader.read(magic, 4) ||
+        strncmp(magic, BINARY_MAGIC, 4) != 0) {
+        printError("not a binary ARG file");
+        return -1;
+    }
+    if (!reader.read_int(&version) || version != BINARY_VERSION) {
+        printError("unsupported binary ARG version");
+        return -1;
+    }
+
+    if (!reader.read_int(&nnodes) ||
+        !reader.read_int(&nleaves) ||
+        !reader.read_int(&trees->start_coord) ||
+        !reader.read_int(&trees->end_coord) ||
+        !reader.read_int(&ntimes) ||
+        !check_binary_header(nnodes, nleaves, ntimes)) {
+        printError("bad binary ARG header");
+        return -1;
+    }
+
+    file_times.resize(ntimes);
+    if ((ntimes > 0 &&
+         !reader.read(&file_times[0], sizeof(double) * ntimes)) ||
+        !reader.read_string(trees->chrom)) {
+        printError("bad binary ARG header");
+        return -1;
+    }
+
+    seqnames.resize(nleaves);
+    for (int i=0; i<nleaves; i++) {
+        if (!reader.read_string(seqnames[i])) {
+            printError("bad binary ARG header");
+            return -1;
+        }
+    }
+
+    return nnodes;
+}
+
+
+bool read_local_trees_binary(FILE *infile, const double *times, int ntimes,
+                             LocalTrees *trees, vector<string> &seqnames,
+                             vector<double> *file_times)
+{
+    trees->clear();
+
+    BinaryReader reader(infile);
+    vector<double> file_times2;
+    int nnodes = read_local_trees_binary_header(
+        reader, trees, seqnames, file_times2);
+    if (nnodes < 0)
+        return false;
+    if (file_times)
+        *file_times = file_times2;
+
+    vector<int> time_mapping;
+    get_binary_time_mapping(file_times2, times, ntimes, time_mapping);
+
+    if (!read_binary_tree_records(reader, nnodes, time_mapping,
+                                  trees->start_coord, -1, trees))
+        return false;
+
+    // set trees info
+    trees->nnodes = nnodes;
+    trees->set_default_seqids();
+    assert_trees(trees);
+
+    return true;
+}
+
+
+bool read_local_trees_binary(const char *filename, const double *times,
+                             int ntimes, LocalTrees *trees,
+                             vector<string> &seqnames,
+                             vector<double> *file_times)
+{
+    FILE *infile = NULL;
+
+    if ((infile = fopen(filename, "rb")) == NULL) {
+        printError("cannot read file '%s'\n", filename);
+        return false;
+    }
+
+    bool result = read_local_trees_binary(infile, times, ntimes, trees,
+                                          seqnames, file_times);
+
+    fclose(infile);
+    return result;
+}
+
+
+bool read_local_trees_binary_region(
+    FILE *infile, const double *times, int ntimes,
+    int region_start, int region_end,
+    LocalTrees *trees, vector<string> &seqnames, vector<double> *file_times)
+{
+    trees->clear();
+
+    BinaryReader reader(infile);
+    vector<double> file_times2;
+    int nnodes = read_local_trees_binary_header(
+        reader, trees, seqnames, file_times2);
+    if (nnodes < 0)
+        return false;
+    if (file_times)
+        *file_times = file_times2;
+    vector<int> time_mapping;
+    get_binary_time_mapping(file_times2, times, ntimes, time_mapping);
+
+    // clamp region
+    region_start = max(region_start, trees->start_coord);
+    region_end = min(region_end, trees->end_coord);
+    if (region_start >= region_end) {
+        printError("region is outside of binary ARG");
+        return false;
+    }
+
+    // read index from footer
+    int64_t index_offset;
+    int32_t nkeys;
+    char magic[4];
+    const int footer_size = sizeof(index_offset) + 4;
+    if (fseeko(infile, -footer_size, SEEK_END) != 0 ||
+        !reader.read(&index_offset, sizeof(index_offset)) ||
+        !reader.read(magic, 4) ||
+        strncmp(magic, BINARY_INDEX_MAGIC, 4) != 0 ||
+        fseeko(infile, index_offset, SEEK_SET) != 0 ||
+        !reader.read_int(&nkeys) || nkeys <= 0) {
+        printError("cannot read index of binary ARG");
+        return false;
+    }
+    vector<BinaryIndexEntry> index(nkeys);
+    if (!reader.read(&index[0], sizeof(BinaryIndexEntry) * nkeys)) {
+        printError("cannot read index of binary ARG");
+        return false;
+    }
+
+    // find last whole tree starting at or before region start
+    int lo = 0, hi = nkeys;
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (index[mid].start <= region_start)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (fseeko(infile, index[lo].offset, SEEK_SET) != 0 ||
+        !read_binary_tree_records(reader, nnodes, time_mapping,
+                                  index[lo].start, region_end, trees))
+        return false;
+
+    trees->nnodes = nnodes;
+    crop_binary_trees(trees, index[lo].start, region_start, region_end);
+    trees->set_default_seqids();
+    assert_trees(trees);
+
+    return true;
+}
+
+
+bool is_local_trees_binary(const char *filename)
+{
+    const char *suffix = ".argb";
+    const int len = strlen(filename);
+    const int slen = strlen(suffix);
+    return len > slen && strcmp(&filename[len - slen], suffix) == 0;
+}
+
+
 //=============================================================================
 // debugging output
 
@@ -437,14 +437,28 @@ public:
         tree(tree),
         spr(ispr[0], ispr[1], ispr[2], ispr[3]),
         mapping(mapping),
-        blocklen(blocklen)
+        blocklen(blocklen),
+        prior_valid(false),
+        prior_treelen(0.0),
+        prior_spr_lnl(0.0),
+        likelihood_valid(false),
+        likelihood_start(0),
+        likelihood_end(0),
+        likelihood(0.0)
     {}
 
      LocalTreeSpr(LocalTree *tree, Spr spr, int blocklen, int *mapping=NULL) :
         tree(tree),
         spr(spr),
         mapping(mapping),
-        blocklen(blocklen)
+        blocklen(blocklen),
+        prior_valid(false),
+        prior_treelen(0.0),
+        prior_spr_lnl(0.0),
+        likelihood_valid(false),
+        likelihood_start(0),
+        likelihood_end(0),
+        likelihood(0.0)
     {}
 
     // deallocate associated data
@@ -487,11 +501,32 @@ public:
             set_capacity(_capacity);
     }
 
+    // mark the cached prior terms and likelihood of this block as out of
+    // date.  Must be called whenever the tree, the SPR, or the previous
+    // tree of this block changes.
+    void invalidate_cache()
+    {
+        prior_valid = false;
+        likelihood_valid = false;
+    }
+
 
     LocalTree *tree;  // local tree
     Spr spr;          // SPR operation to the left of local tree
     int *mapping;     // node mapping between previous tree and this tree
     int blocklen;     // length of sequence block
+
+    // terms of the ARG prior cached by calc_arg_prior_cached()
+    bool prior_valid;      // whether the cached terms are up to date
+    double prior_treelen;  // length of tree
+    double prior_spr_lnl;  // log probability of spr given the previous tree
+
+    // log likelihood of the block [likelihood_start, likelihood_end)
+    // cached by calc_arg_likelihood_cached()
+    bool likelihood_valid;
+    int likelihood_start;
+    int likelihood_end;
+    double likelihood;
 };
 
 
@@ -572,6 +607,13 @@ public:
         trees.clear();
     }
 
+    // mark the cached terms of all blocks as out of date
+    void invalidate_cache()
+    {
+        for (iterator it=begin(); it!=end(); it++)
+            it->invalidate_cache();
+    }
+
     // make trunk genealogy
     void make_trunk(int start, int end, int capacity=-1)
     {
@@ -688,16 +730,15 @@ public:
     LineageCounts(int ntimes) :
         ntimes(ntimes)
     {
-        nbranches = new int [ntimes];
-        nrecombs = new int [ntimes];
-        ncoals = new int [ntimes];
+        // all counts share one allocation
+        nbranches = new int [3 * ntimes];
+        nrecombs = &nbranches[ntimes];
+        ncoals = &nbranches[2 * ntimes];
     }
 
     ~LineageCounts()
     {
         delete [] nbranches;
-        delete [] nrecombs;
-        delete [] ncoals;
     }
 
     // Counts the number of lineages for a tree
@@ -798,6 +839,9 @@ void write_local_trees(FILE *out, const LocalTrees *trees,
 bool write_local_trees(const char *filename, const LocalTrees *trees,
                        const Sequences &seqs, const double *times);
 
+// find closest time in times array
+int find_time(double time, const double *times, int ntimes);
+
 bool parse_local_tree(const char* newick, LocalTree *tree,
                       const double *times, int ntimes);
 bool read_local_trees(FILE *infile, const double *times, int ntimes,
@@ -806,6 +850,44 @@ bool read_local_trees(const char *filename, const double *times, int ntimes,
                       LocalTrees *trees, vector<string> &seqnames);
 
 
+//=============================================================================
+// binary input and output
+
+void write_local_trees_binary(FILE *out, const LocalTrees *trees,
+                              const char *const *names,
+                              const double *times, int ntimes);
+bool write_local_trees_binary(const char *filename, const LocalTrees *trees,
+                              const char *const *names,
+                              const double *times, int ntimes);
+void write_local_trees_binary(FILE *out, const LocalTrees *trees,
+                              const Sequences &seqs,
+                              const double *times, int ntimes);
+bool write_local_trees_binary(const char *filename, const LocalTrees *trees,
+                              const Sequences &seqs,
+                              const double *times, int ntimes);
+
+// If times is NULL, time indices of the file are used unchanged.
+// Otherwise they are mapped to the closest of the given time points.
+// The time points of the file are returned in file_times if given.
+bool read_local_trees_binary(FILE *infile, const double *times, int ntimes,
+                             LocalTrees *trees, vector<string> &seqnames,
+                             vector<double> *file_times=NULL);
+bool read_local_trees_binary(const char *filename, const double *times,
+                             int ntimes, LocalTrees *trees,
+                             vector<string> &seqnames,
+                             vector<double> *file_times=NULL);
+
+// Reads only the local trees overlapping [start, end) using the block
+// index.  NOTE: infile must be seekable.
+bool read_local_trees_binary_region(
+    FILE *infile, const double *times, int ntimes, int start, int end,
+    LocalTrees *trees, vector<string> &seqnames,
+    vector<double> *file_times=NULL);
+
+// Returns true if filename has the binary ARG suffix (*.argb)
+bool is_local_trees_binary(const char *filename);
+
+
 //=============================================================================
 // assert functions
 
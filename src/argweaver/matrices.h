@@ -16,6 +16,7 @@
 #include "local_tree.h"
 #include "logging.h"
 #include "model.h"
+#include "scratch.h"
 #include "sequences.h"
 #include "states.h"
 #include "trans.h"
@@ -199,6 +200,14 @@ public:
         return blocks.size();
     }
 
+    // Returns the length of the longest block
+    int max_length() const {
+        int maxlen = 0;
+        for (unsigned int i=0; i<blocks.size(); i++)
+            maxlen = max(maxlen, blocks[i].length());
+        return maxlen;
+    }
+
 protected:
     const ArgModel *model;
     const LocalTrees *trees;
@@ -220,20 +229,46 @@ public:
         seqs(seqs),
         trees(trees),
         new_chrom(_new_chrom),
+        mut_cursor(model->mutmap),
+        recomb_cursor(model->recombmap),
         blocks(model, trees)
     {
         if (new_chrom == -1)
             new_chrom = trees->get_num_leaves();
     }
 
+    // Iterator over the same blocks with its own matrices and map
+    // cursors, so that it can be used by another thread
+    ArgHmmMatrixIter(const ArgHmmMatrixIter &other) :
+        states_model(other.states_model),
+        model(other.model),
+        seqs(other.seqs),
+        trees(other.trees),
+        new_chrom(other.new_chrom),
+        mut_cursor(other.model->mutmap),
+        recomb_cursor(other.model->recombmap),
+        blocks(other.blocks),
+        block_index(other.block_index)
+    {}
+
     virtual ~ArgHmmMatrixIter()
     {
         mat.clear();
     }
 
+    // Returns a new iterator of the same type over the same blocks
+    virtual ArgHmmMatrixIter *clone() const
+    {
+        return new ArgHmmMatrixIter(*this);
+    }
+
     virtual void setup() {
         // determine all blocks
         blocks.setup();
+
+        // size scratch space once for the largest block
+        get_scratch_arena().reserve(get_scratch_block_size(
+            trees->nnodes, model->ntimes, blocks.max_length()));
     }
 
     virtual void clear() {}
@@ -280,6 +315,18 @@ public:
         return block_index >= 0 && block_index < blocks.size();
     }
 
+    // moves iterator to block 'index'
+    virtual void seek(int index)
+    {
+        if (blocks.size() == 0)
+            setup();
+        block_index = index;
+    }
+
+    int num_blocks() const {
+        return blocks.size();
+    }
+
     //==================================================
     // accessors
 
@@ -324,7 +371,8 @@ public:
     }
 
     void get_local_model(ArgModel &local_model) {
-        model->get_local_model(blocks.at(block_index).start, local_model);
+        model->get_local_model(blocks.at(block_index).start, local_model,
+                               mut_cursor, recomb_cursor);
     }
 
     void get_coal_states(const LocalTree *tree, States &states) const {
@@ -363,6 +411,10 @@ protected:
 
     ArgHmmMatrices mat;
 
+    // cursors for looking up map values of successive blocks
+    TrackCursor<double> mut_cursor;
+    TrackCursor<double> recomb_cursor;
+
     // record of common blocks
     ArgModelBlocks blocks;
     int block_index;
@@ -378,13 +430,29 @@ public:
                      const LocalTrees *trees,
                      int new_chrom=-1) :
         ArgHmmMatrixIter(model, seqs, trees,
-                         new_chrom)
+                         new_chrom),
+        owner(true)
     {}
+
+    // List that shares the precomputed matrices of 'other' without
+    // owning them
+    ArgHmmMatrixList(const ArgHmmMatrixList &other) :
+        ArgHmmMatrixIter(other),
+        matrix_index(other.matrix_index),
+        matrices(other.matrices),
+        owner(false)
+    {}
+
     virtual ~ArgHmmMatrixList()
     {
         clear();
     }
 
+    virtual ArgHmmMatrixIter *clone() const
+    {
+        return new ArgHmmMatrixList(*this);
+    }
+
     // precompute all matrices
     virtual void setup(PhaseProbs *phase_pr=NULL)
     {
@@ -399,8 +467,9 @@ public:
     // free all computed matrices
     virtual void clear()
     {
-        for (unsigned int i=0; i<matrices.size(); i++)
-            matrices[i].clear();
+        if (owner)
+            for (unsigned int i=0; i<matrices.size(); i++)
+                matrices[i].clear();
         matrices.clear();
     }
 
@@ -433,6 +502,12 @@ public:
         return ArgHmmMatrixIter::prev();
     }
 
+    virtual void seek(int index)
+    {
+        ArgHmmMatrixIter::seek(index);
+        matrix_index = index;
+    }
+
     //==================================================
     // accessors
 
@@ -445,6 +520,7 @@ public:
 protected:
     int matrix_index;
     vector<ArgHmmMatrices> matrices;
+    bool owner;
 };
 
 
@@ -37,6 +37,9 @@ void get_coal_time_steps(const double *times, int ntimes,
 
 
 
+class ForwardPruning;
+
+
 // The model parameters and time discretization scheme
 class ArgModel
 {
@@ -53,7 +56,10 @@ public:
 	infsites_penalty(1.0),
         unphased(0),
         sample_phase(0),
-        unphased_file("")
+        unphased_file(""),
+        pruning(NULL),
+        forward_threads(1),
+        forward_tol(0.0)
     {}
 
     // Model with constant population sizes and log-spaced time points
@@ -69,7 +75,10 @@ public:
         mu(mu),
         infsites_penalty(1.0),
         unphased(0),
-        sample_phase(0)
+        sample_phase(0),
+        pruning(NULL),
+        forward_threads(1),
+        forward_tol(0.0)
     {
         set_log_times(maxtime, ntimes);
         set_popsizes(popsize, ntimes);
@@ -88,7 +97,10 @@ public:
         mu(mu),
         infsites_penalty(1.0),
 	unphased(0),
-	sample_phase(0)
+	sample_phase(0),
+        pruning(NULL),
+        forward_threads(1),
+        forward_tol(0.0)
     {
         set_log_times(maxtime, ntimes);
         if (_popsizes)
@@ -109,7 +121,10 @@ public:
         mu(mu),
         infsites_penalty(1.0),
         unphased(0),
-	sample_phase(0)
+	sample_phase(0),
+        pruning(NULL),
+        forward_threads(1),
+        forward_tol(0.0)
     {
         set_times(_times, ntimes);
         if (_popsizes)
@@ -130,7 +145,10 @@ public:
 	infsites_penalty(other.infsites_penalty),
         unphased(other.unphased),
 	sample_phase(other.sample_phase),
-        unphased_file(other.unphased_file)
+        unphased_file(other.unphased_file),
+        pruning(other.pruning),
+        forward_threads(other.forward_threads),
+        forward_tol(other.forward_tol)
     {}
 
 
@@ -146,7 +164,10 @@ public:
         infsites_penalty(other.infsites_penalty),
 	unphased(other.unphased),
         sample_phase(other.sample_phase),
-        unphased_file(other.unphased_file)
+        unphased_file(other.unphased_file),
+        pruning(other.pruning),
+        forward_threads(other.forward_threads),
+        forward_tol(other.forward_tol)
     {
         copy(other);
     }
@@ -188,6 +209,9 @@ public:
         unphased = other.unphased;
 	sample_phase = other.sample_phase;
 	unphased_file = other.unphased_file;
+        pruning = other.pruning;
+        forward_threads = other.forward_threads;
+        forward_tol = other.forward_tol;
 
         // copy popsizes and times
         set_times(other.times, ntimes);
@@ -285,14 +309,17 @@ public:
     void get_local_model(int pos, ArgModel &model) const {
         model.mu = mutmap.find(pos, mu);
         model.rho = recombmap.find(pos, rho);
-        model.infsites_penalty = infsites_penalty;
+        share_local_model(model);
+    }
 
-        model.owned = false;
-        model.times = times;
-        model.ntimes = ntimes;
-        model.time_steps = time_steps;
-        model.coal_time_steps = coal_time_steps;
-        model.popsizes = popsizes;
+    // Returns a model customized for the local position, using cursors
+    // into the mutation and recombination maps for successive positions
+    void get_local_model(int pos, ArgModel &model,
+                         TrackCursor<double> &mut_cursor,
+                         TrackCursor<double> &recomb_cursor) const {
+        model.mu = mut_cursor.find(pos, mu);
+        model.rho = recomb_cursor.find(pos, rho);
+        share_local_model(model);
     }
 
     void get_local_model_index(int index, ArgModel &model) const {
@@ -307,6 +334,9 @@ public:
         model.unphased = unphased;
 	model.sample_phase = sample_phase;
 	model.unphased_file = unphased_file;
+        model.pruning = pruning;
+        model.forward_threads = forward_threads;
+        model.forward_tol = forward_tol;
 
         model.owned = false;
         model.times = times;
@@ -318,6 +348,18 @@ public:
 
 protected:
 
+    // Shares time points and population sizes with a local model
+    void share_local_model(ArgModel &model) const {
+        model.infsites_penalty = infsites_penalty;
+
+        model.owned = false;
+        model.times = times;
+        model.ntimes = ntimes;
+        model.time_steps = time_steps;
+        model.coal_time_steps = coal_time_steps;
+        model.popsizes = popsizes;
+    }
+
     // Setup time steps between time points
     void setup_time_steps()
     {
@@ -349,6 +391,9 @@ public:
     bool unphased;
     int sample_phase;
     string unphased_file;
+    ForwardPruning *pruning; // approximate forward algorithm (optional)
+    int forward_threads;     // threads of the parallel forward algorithm
+    double forward_tol;      // relative tolerance of its corrections
     Track<double> mutmap;    // mutation map
     Track<double> recombmap; // recombination map
 };
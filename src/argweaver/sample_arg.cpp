@@ -455,6 +455,12 @@ double resample_arg_region(
         trees2->end_coord++;
     }
 
+    // Removal path counts of trees2 are kept across iterations: a rejected
+    // proposal restores the same ARG, and an accepted one leaves the
+    // counts of its reverse move.
+    RemovalPaths *removal_paths = new RemovalPaths(trees2);
+    count_arg_removal_paths(trees2, *removal_paths);
+
     // perform several iterations of resampling
     int accepts = 0;
     for (int i=0; i<niters; i++) {
@@ -471,7 +477,8 @@ double resample_arg_region(
 
         // remove internal branch from trees2
         int *removal_path = new int [trees2->get_num_trees()];
-        double npaths = sample_arg_removal_path_uniform(trees2, removal_path);
+        double npaths = sample_arg_removal_path_uniform(
+            trees2, *removal_paths, removal_path);
         remove_arg_thread_path(trees2, removal_path, maxtime);
         delete [] removal_path;
 
@@ -497,21 +504,29 @@ double resample_arg_region(
                                         start_state, end_state);
         incLogLevel();
         assert_trees(trees2);
-        double npaths2 = count_total_arg_removal_paths(trees2);
+        RemovalPaths *removal_paths2 = new RemovalPaths(trees2);
+        count_arg_removal_paths(trees2, *removal_paths2);
+        double npaths2 = count_total_arg_removal_paths(*removal_paths2);
 
         // perform reject if needed
         double accept_prob = exp(npaths - npaths2);
         bool accept = (frand() < accept_prob);
-        if (!accept)
+        if (!accept) {
             trees2->copy(old_trees2);
-        else
+            delete removal_paths2;
+        } else {
             accepts++;
+            delete removal_paths;
+            removal_paths = removal_paths2;
+        }
 
         // logging
         printLog(LOG_LOW, "accept_prob = exp(%lf - %lf) = %f, accept = %d\n",
                  npaths, npaths2, accept_prob, (int) accept);
     }
 
+    delete removal_paths;
+
     // remove stub if it exists
     if (stub) {
         trees2->trees.back().blocklen -= 1;
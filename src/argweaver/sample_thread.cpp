@@ -2,6 +2,7 @@
 #include <list>
 #include <vector>
 #include <string.h>
+#include <pthread.h>
 
 // arghmm includes
 #include "common.h"
@@ -13,6 +14,7 @@
 #include "model.h"
 #include "recomb.h"
 #include "sample_thread.h"
+#include "scratch.h"
 #include "sequences.h"
 #include "sequences.h"
 #include "states.h"
@@ -181,14 +183,91 @@ void arghmm_forward_block_new(const LocalTree *tree, const int ntimes,
 */
 
 
+// Returns the transition probability mass into state k from the previous
+// forward column, given the precomputed sums over time groups
+static inline double forward_state_sum(
+    const int k, const States &states, const int *ages1, const int *ages2,
+    const int *indexes, const double *tmatrix_fgroups,
+    const double *const *tmatrix2, const double *col1)
+{
+    const int b = states[k].time;
+    const int node2 = states[k].node;
+    const int age1 = ages1[node2];
+    const int age2 = ages2[node2];
+
+    assert(!isnan(col1[k]));
+
+    // same branch case
+    double sum = tmatrix_fgroups[b];
+    const int j1 = indexes[node2];
+    for (int j=j1, a=age1; a<=age2; j++, a++)
+        sum += tmatrix2[a][k] * col1[j];
+    return sum;
+}
+
+
+// Prunes states of a normalized forward column that have stayed below the
+// pruning threshold for long enough.  Returns the new number of active
+// states.  If pruning becomes disabled all states are made active again.
+static int prune_forward_column(double *col, int nstates,
+                                int *active, int nactive, int *lowrun,
+                                ForwardPruning *pruning)
+{
+    if (!pruning->active()) {
+        // restore full state space, pruned states start again from zero
+        for (int k=0; k<nstates; k++)
+            active[k] = k;
+        return nstates;
+    }
+
+    // never prune the most probable state
+    double top = 0.0;
+    for (int kk=0; kk<nactive; kk++)
+        top = max(top, col[active[kk]]);
+
+    int nactive2 = 0;
+    double kept = 0.0, discarded = 0.0;
+    for (int kk=0; kk<nactive; kk++) {
+        const int k = active[kk];
+        if (col[k] < pruning->threshold && col[k] < top) {
+            if (++lowrun[k] >= pruning->runlen) {
+                discarded += col[k];
+                col[k] = 0.0;
+                continue;
+            }
+        } else {
+            lowrun[k] = 0;
+        }
+        kept += col[k];
+        active[nactive2++] = k;
+    }
+
+    // renormalize, so that thresholds at later sites apply to the same scale
+    if (nactive2 < nactive) {
+        pruning->discard(discarded / (kept + discarded), nactive - nactive2);
+        for (int kk=0; kk<nactive2; kk++)
+            col[active[kk]] /= kept;
+    }
+
+    return nactive2;
+}
+
+
 // compute one block of forward algorithm with compressed transition matrices
 // NOTE: first column of forward table should be pre-populated
-void arghmm_forward_block(const LocalTree *tree, const int ntimes,
-                          const int blocklen, const States &states,
-                          const LineageCounts &lineages,
-                          const TransMatrix *matrix,
-                          const double* const *emit, double **fw)
+//
+// NTIMES > 0 fixes the number of time points at compile-time, so that the
+// time matrices live in fixed-size aligned arrays and the loops over time
+// can be fully unrolled and vectorized.  NTIMES = 0 is the generic kernel.
+template <int NTIMES>
+void arghmm_forward_block_kernel(const LocalTree *tree, const int _ntimes,
+                                 const int blocklen, const States &states,
+                                 const LineageCounts &lineages,
+                                 const TransMatrix *matrix,
+                                 const double* const *emit, double **fw,
+                                 ForwardPruning *pruning)
 {
+    const int ntimes = (NTIMES > 0 ? NTIMES : _ntimes);
     const int nstates = states.size();
     const LocalNode *nodes = tree->nodes;
 
@@ -206,13 +285,24 @@ void arghmm_forward_block(const LocalTree *tree, const int ntimes,
         }
     }
 
+    // temp matrices are drawn from the scratch arena unless their size is
+    // known at compile-time
+    ScratchArena &arena = get_scratch_arena();
+    ScratchFrame frame(arena);
+    const int NFIXED = (NTIMES > 0 ? NTIMES : 1);
+    double tmatrix_fixed[NFIXED * NFIXED] __attribute__((aligned(64)));
+    double fgroups_fixed[NFIXED] __attribute__((aligned(64)));
+    double tmatrix_fgroups_fixed[NFIXED] __attribute__((aligned(64)));
+
     // compute ntimes*ntimes and ntime*nstates temp matrices
-    double tmatrix[ntimes][ntimes];
-    double tmatrix2[ntimes][nstates];
+    // tmatrix is stored row-major as tmatrix[a*ntimes + b]
+    double *tmatrix = (NTIMES > 0 ? tmatrix_fixed :
+                       arena.alloc<double>(ntimes * ntimes));
+    double **tmatrix2 = arena.alloc_matrix<double>(ntimes, nstates);
     for (int a=0; a<ntimes-1; a++) {
         for (int b=0; b<ntimes-1; b++) {
-            tmatrix[a][b] = matrix->get_time(a, b, 0, minage, false);
-            assert(!isnan(tmatrix[a][b]));
+            tmatrix[a*ntimes + b] = matrix->get_time(a, b, 0, minage, false);
+            assert(!isnan(tmatrix[a*ntimes + b]));
         }
 
         for (int k=0; k<nstates; k++) {
@@ -233,9 +323,9 @@ void arghmm_forward_block(const LocalTree *tree, const int ntimes,
 
     // get branch ages
     NodeStateLookup state_lookup(states, tree->nnodes);
-    int ages1[tree->nnodes];
-    int ages2[tree->nnodes];
-    int indexes[tree->nnodes];
+    int *ages1 = arena.alloc<int>(tree->nnodes);
+    int *ages2 = arena.alloc<int>(tree->nnodes);
+    int *indexes = arena.alloc<int>(tree->nnodes);
     for (int i=0; i<tree->nnodes; i++) {
         ages1[i] = max(nodes[i].age, minage);
         indexes[i] = state_lookup.lookup(i, ages1[i]);
@@ -247,51 +337,130 @@ void arghmm_forward_block(const LocalTree *tree, const int ntimes,
     }
 
 
-    double tmatrix_fgroups[ntimes];
-    double fgroups[ntimes];
+    double *tmatrix_fgroups = (NTIMES > 0 ? tmatrix_fgroups_fixed :
+                               arena.alloc<double>(ntimes));
+    double *fgroups = (NTIMES > 0 ? fgroups_fixed :
+                       arena.alloc<double>(ntimes));
+
+    // states that have not been pruned, in increasing order
+    int *active = arena.alloc<int>(nstates);
+    int nactive = nstates;
+    for (int k=0; k<nstates; k++)
+        active[k] = k;
+
+    // number of consecutive sites each state has been below threshold
+    int *lowrun = NULL;
+    if (pruning && pruning->active()) {
+        lowrun = arena.alloc<int>(nstates);
+        for (int k=0; k<nstates; k++)
+            lowrun[k] = 0;
+    }
+
     for (int i=1; i<blocklen; i++) {
         const double *col1 = fw[i-1];
         double *col2 = fw[i];
         const double *emit2 = emit[i];
 
+        // pruned states keep zero probability
+        if (nactive < nstates)
+            fill(col2, col2 + nstates, 0.0);
+
         // precompute the fgroup sums
-        fill(fgroups, fgroups+ntimes, 0.0);
-        for (int j=0; j<nstates; j++) {
-            const int a = states[j].time;
-            fgroups[a] += col1[j];
+        for (int a=0; a<ntimes; a++)
+            fgroups[a] = 0.0;
+        if (nactive == nstates) {
+            for (int j=0; j<nstates; j++)
+                fgroups[states[j].time] += col1[j];
+        } else {
+            for (int jj=0; jj<nactive; jj++) {
+                const int j = active[jj];
+                fgroups[states[j].time] += col1[j];
+            }
         }
 
         // multiply tmatrix and fgroups together
-        for (int b=0; b<ntimes-1; b++) {
-            double sum = 0.0;
-            for (int a=0; a<ntimes-1; a++)
-                sum += tmatrix[a][b] * fgroups[a];
-            tmatrix_fgroups[b] = sum;
+        // NOTE: loops are ordered so that the inner loop is contiguous,
+        // while each sum still accumulates over 'a' in increasing order
+        for (int b=0; b<ntimes-1; b++)
+            tmatrix_fgroups[b] = 0.0;
+        for (int a=0; a<ntimes-1; a++) {
+            const double fgroup = fgroups[a];
+            const double *row = &tmatrix[a*ntimes];
+            for (int b=0; b<ntimes-1; b++)
+                tmatrix_fgroups[b] += row[b] * fgroup;
         }
 
         // fill in one column of forward table
         double norm = 0.0;
-        for (int k=0; k<nstates; k++) {
-            const int b = states[k].time;
-            const int node2 = states[k].node;
-            const int age1 = ages1[node2];
-            const int age2 = ages2[node2];
+        if (nactive == nstates) {
+            for (int k=0; k<nstates; k++) {
+                col2[k] = forward_state_sum(
+                    k, states, ages1, ages2, indexes,
+                    tmatrix_fgroups, tmatrix2, col1) * emit2[k];
+                norm += col2[k];
+            }
 
-            assert(!isnan(col1[k]));
+            // normalize column for numerical stability
+            for (int k=0; k<nstates; k++)
+                col2[k] /= norm;
+        } else {
+            // only visit states that have not been pruned
+            for (int kk=0; kk<nactive; kk++) {
+                const int k = active[kk];
+                col2[k] = forward_state_sum(
+                    k, states, ages1, ages2, indexes,
+                    tmatrix_fgroups, tmatrix2, col1) * emit2[k];
+                norm += col2[k];
+            }
+            for (int kk=0; kk<nactive; kk++)
+                col2[active[kk]] /= norm;
+        }
 
-            // same branch case
-            double sum = tmatrix_fgroups[b];
-            const int j1 = indexes[node2];
-            for (int j=j1, a=age1; a<=age2; j++, a++)
-                sum += tmatrix2[a][k] * col1[j];
+        if (lowrun)
+            nactive = prune_forward_column(col2, nstates, active, nactive,
+                                           lowrun, pruning);
+    }
+}
 
-            col2[k] = sum * emit2[k];
-            norm += col2[k];
-        }
 
-        // normalize column for numerical stability
-        for (int k=0; k<nstates; k++)
-            col2[k] /= norm;
+// compute one block of forward algorithm with compressed transition matrices
+// NOTE: first column of forward table should be pre-populated
+//
+// Dispatches to a kernel specialized for common numbers of time points,
+// and to the generic kernel otherwise.
+void arghmm_forward_block(const LocalTree *tree, const int ntimes,
+                          const int blocklen, const States &states,
+                          const LineageCounts &lineages,
+                          const TransMatrix *matrix,
+                          const double* const *emit, double **fw,
+                          ForwardPruning *pruning=NULL)
+{
+    switch (ntimes) {
+    case 16:
+        arghmm_forward_block_kernel<16>(tree, ntimes, blocklen, states,
+                                        lineages, matrix, emit, fw,
+                                        pruning);
+        break;
+    case 20:
+        arghmm_forward_block_kernel<20>(tree, ntimes, blocklen, states,
+                                        lineages, matrix, emit, fw,
+                                        pruning);
+        break;
+    case 32:
+        arghmm_forward_block_kernel<32>(tree, ntimes, blocklen, states,
+                                        lineages, matrix, emit, fw,
+                                        pruning);
+        break;
+    case 40:
+        arghmm_forward_block_kernel<40>(tree, ntimes, blocklen, states,
+                                        lineages, matrix, emit, fw,
+                                        pruning);
+        break;
+    default:
+        arghmm_forward_block_kernel<0>(tree, ntimes, blocklen, states,
+                                       lineages, matrix, emit, fw,
+                                        pruning);
+        break;
     }
 }
 
@@ -354,20 +523,36 @@ void arghmm_forward_switch(const double *col1, double* col2,
     for (int k=0; k<nstates2; k++)
         col2[k] = 0.0;
 
-    // add deterministic transitions
+    // add deterministic transitions, skipping states of zero probability
+    // (e.g. pruned states)
     for (int j=0; j<nstates1; j++) {
         int k = matrix->determ[j];
-        if (j != matrix->recombsrc && j != matrix->recoalsrc && k != -1)
+        if (col1[j] != 0.0 && j != matrix->recombsrc &&
+            j != matrix->recoalsrc && k != -1)
             col2[k] += col1[j] * matrix->determprob[j];
     }
 
-    // add recombination and recoalescing transitions
+    // add recombination and recoalescing transitions, skipping rows whose
+    // source state has zero probability
+    const int recombsrc = matrix->recombsrc;
+    const int recoalsrc = matrix->recoalsrc;
+    if (recombsrc != -1 && col1[recombsrc] != 0.0) {
+        const double p = col1[recombsrc];
+        for (int k=0; k<nstates2; k++) {
+            if (matrix->recombrow[k] > 0.0)
+                col2[k] += p * matrix->recombrow[k];
+        }
+    }
+    if (recoalsrc != -1 && col1[recoalsrc] != 0.0) {
+        const double p = col1[recoalsrc];
+        for (int k=0; k<nstates2; k++) {
+            if (matrix->recoalrow[k] > 0.0)
+                col2[k] += p * matrix->recoalrow[k];
+        }
+    }
+
     double norm = 0.0;
     for (int k=0; k<nstates2; k++) {
-        if (matrix->recombsrc != -1 && matrix->recombrow[k] > 0.0)
-            col2[k] += col1[matrix->recombsrc] * matrix->recombrow[k];
-        if (matrix->recoalsrc != -1 && matrix->recoalrow[k] > 0.0)
-            col2[k] += col1[matrix->recoalsrc] * matrix->recoalrow[k];
         col2[k] *= emit[k];
         norm += col2[k];
     }
@@ -396,12 +581,29 @@ void arghmm_forward_alg(const LocalTrees *trees, const ArgModel *model,
     ArgHmmForwardTable *forward, PhaseProbs *phase_pr,
     bool prior_given, bool internal, bool slow) 
 {
+    // the parallel forward algorithm does not support phasing or pruning
+    if (model->forward_threads > 1 && !phase_pr && !slow &&
+        !(model->pruning && model->pruning->active())) {
+        arghmm_forward_alg_parallel(trees, model, matrix_iter, forward,
+                                    prior_given, internal);
+        return;
+    }
+
     LineageCounts lineages(model->ntimes);
     States states;
     ArgModel local_model;
 
     double **fw = forward->get_table();
 
+    // optional beam pruning of unlikely states
+    ForwardPruning *pruning = NULL;
+    long npruned = 0;
+    if (model->pruning && model->pruning->active() && !slow) {
+        pruning = model->pruning;
+        pruning->begin_pass();
+        npruned = pruning->nstates_pruned;
+    }
+
     // forward algorithm over local trees
     for (matrix_iter->begin(); matrix_iter->more(); matrix_iter->next()) {
         // get block information
@@ -409,7 +611,7 @@ void arghmm_forward_alg(const LocalTrees *trees, const ArgModel *model,
         ArgHmmMatrices &matrices = matrix_iter->ref_matrices(phase_pr);
         int pos = matrix_iter->get_block_start();
         int blocklen = matrices.blocklen;
-        model->get_local_model(pos, local_model);
+        matrix_iter->get_local_model(local_model);
         double **emit = matrices.emit;
 
         // allocate the forward table
@@ -451,30 +653,248 @@ void arghmm_forward_alg(const LocalTrees *trees, const ArgModel *model,
         else
             arghmm_forward_block(tree, model->ntimes, blocklen,
                                  states, lineages, matrices.transmat,
-                                 emit, fw_block);
+                                 emit, fw_block, pruning);
 
         // safety check
         double top2 = max_array(fw[pos + matrices.blocklen - 1], nstates);
         assert(top2 > 0.0);
     }
+
+    if (pruning) {
+        pruning->end_pass();
+        forward->pruned = (pruning->nstates_pruned > npruned);
+        if (!pruning->active())
+            printLog(LOG_LOW, "forward pruning disabled: discarded "
+                     "fraction %e exceeds tolerance %e\n",
+                     pruning->pass_discarded, pruning->tolerance);
+    }
 }
 
 
 
 
+//=============================================================================
+// Parallel forward algorithm
+//
+// The blocks are split into segments of about equal length, one per
+// thread.  In a first pass, all segments are computed in parallel, each
+// starting from the prior of the states of its first block, since the
+// true forward column at its start is not yet known.  In a second pass,
+// segments are corrected in order: blocks are recomputed from the
+// corrected end of the previous segment until the last column of a block
+// is identical to the first pass.  The remaining blocks of the segment
+// are then computed from the same column as in the serial algorithm, so
+// the table equals the serial one exactly.  Although the HMM forgets its
+// starting column, rounding rarely makes the columns identical, so most
+// of a segment is usually recomputed.  With ArgModel::forward_tol > 0,
+// the correction stops once every state agrees within that relative
+// tolerance instead, which gives most of the speedup but only agrees with
+// the serial algorithm approximately.
+
+
+// Computes the forward columns of the current block of matrix_iter.  If
+// 'restart' is true, the block starts from the prior of its states
+// instead of from the last column of the previous block.
+static void arghmm_forward_alg_block(
+    const LocalTrees *trees, const ArgModel *model,
+    ArgHmmMatrixIter *matrix_iter, double **fw,
+    bool prior_given, bool internal, bool restart)
+{
+    LineageCounts lineages(model->ntimes);
+    States states;
+    ArgModel local_model;
+
+    LocalTree *tree = matrix_iter->get_tree_spr()->tree;
+    ArgHmmMatrices &matrices = matrix_iter->ref_matrices();
+    int pos = matrix_iter->get_block_start();
+    int blocklen = matrices.blocklen;
+    matrix_iter->get_local_model(local_model);
+    double **emit = matrices.emit;
+    double **fw_block = &fw[pos];
+
+    matrices.states_model.get_coal_states(tree, states);
+    lineages.count(tree, internal);
+
+    if (pos == trees->start_coord || restart) {
+        if (!prior_given || pos > trees->start_coord)
+            calc_state_priors(states, &lineages, &local_model,
+                              fw[pos], matrices.states_model.minage);
+    } else if (matrices.transmat_switch) {
+        arghmm_forward_switch(fw[pos-1], fw[pos],
+            matrices.transmat_switch, matrices.emit[0]);
+    } else {
+        // same state space as the previous block
+        fw_block = &fw[pos-1];
+        emit--;
+        blocklen++;
+    }
+
+    arghmm_forward_block(tree, model->ntimes, blocklen, states, lineages,
+                         matrices.transmat, emit, fw_block);
+}
+
+
+// A segment of blocks [start, end) computed by one thread
+struct ForwardSegment
+{
+    const LocalTrees *trees;
+    const ArgModel *model;
+    ArgHmmMatrixIter *matrix_iter;
+    double **fw;
+    bool prior_given;
+    bool internal;
+    int start;
+    int end;
+};
+
+
+static void *forward_segment_main(void *data)
+{
+    ForwardSegment *seg = (ForwardSegment*) data;
+    for (int i=seg->start; i<seg->end; i++) {
+        seg->matrix_iter->seek(i);
+        arghmm_forward_alg_block(seg->trees, seg->model, seg->matrix_iter,
+                                 seg->fw, seg->prior_given, seg->internal,
+                                 i == seg->start && i > 0);
+    }
+    free_scratch_arena();
+    return NULL;
+}
+
+
+void arghmm_forward_alg_parallel(const LocalTrees *trees,
+    const ArgModel *model, ArgHmmMatrixIter *matrix_iter,
+    ArgHmmForwardTable *forward, bool prior_given, bool internal)
+{
+    double **fw = forward->get_table();
+    States states;
+
+    // allocate the forward table
+    matrix_iter->begin();
+    const int nblocks = matrix_iter->num_blocks();
+    for (int i=0; i<nblocks; i++) {
+        matrix_iter->seek(i);
+        int pos = matrix_iter->get_block_start();
+        matrix_iter->get_coal_states(states);
+        if (pos > trees->start_coord || !prior_given)
+            forward->new_block(pos, matrix_iter->get_block_end(),
+                               states.size());
+    }
+
+    // split blocks into segments of about equal length
+    const int nsegs = min(model->forward_threads, nblocks);
+    vector<ForwardSegment> segs(nsegs);
+    const double seglen = double(trees->length()) / nsegs;
+    int block = 0;
+    for (int k=0; k<nsegs; k++) {
+        ForwardSegment &seg = segs[k];
+        seg.trees = trees;
+        seg.model = model;
+        seg.matrix_iter = matrix_iter;
+        seg.fw = fw;
+        seg.prior_given = prior_given;
+        seg.internal = internal;
+        seg.start = block;
+        const int nleft = nsegs - k - 1;
+        block++;
+        while (block < nblocks - nleft) {
+            matrix_iter->seek(block);
+            if (matrix_iter->get_block_start() - trees->start_coord >=
+                (k + 1) * seglen)
+                break;
+            block++;
+        }
+        seg.end = (k == nsegs - 1 ? nblocks : block);
+    }
+
+    // first pass: compute segments in parallel, each thread with its own
+    // matrix iterator
+    vector<pthread_t> threads(nsegs);
+    for (int k=1; k<nsegs; k++)
+        segs[k].matrix_iter = matrix_iter->clone();
+    for (int k=1; k<nsegs; k++) {
+        if (pthread_create(&threads[k], NULL, forward_segment_main,
+                           &segs[k]) != 0) {
+            printError("cannot create forward thread");
+            abort();
+        }
+    }
+    for (int i=segs[0].start; i<segs[0].end; i++) {
+        matrix_iter->seek(i);
+        arghmm_forward_alg_block(trees, model, matrix_iter, fw, prior_given,
+                                 internal, false);
+    }
+    for (int k=1; k<nsegs; k++) {
+        pthread_join(threads[k], NULL);
+        delete segs[k].matrix_iter;
+    }
+
+    // second pass: correct segments from the end of the previous one
+    int ncorrected = 0;
+    vector<double> last_col;
+    for (int k=1; k<nsegs; k++) {
+        for (int i=segs[k].start; i<segs[k].end; i++) {
+            matrix_iter->seek(i);
+            const int end = matrix_iter->get_block_end();
+            matrix_iter->get_coal_states(states);
+            const int nstates = max((int) states.size(), 1);
+            last_col.assign(fw[end-1], fw[end-1] + nstates);
+
+            arghmm_forward_alg_block(trees, model, matrix_iter, fw,
+                                     prior_given, internal, false);
+            ncorrected++;
+
+            bool agree = true;
+            for (int j=0; j<nstates; j++) {
+                const double a = fw[end-1][j], b = last_col[j];
+                if (a != b && fabs(a - b) > model->forward_tol * max(a, b)) {
+                    agree = false;
+                    break;
+                }
+            }
+            if (agree)
+                break;
+        }
+    }
+
+    printLog(LOG_HIGH, "parallel forward: %d segments, %d of %d blocks "
+             "corrected\n", nsegs, ncorrected, nblocks);
+}
+
+
+
 //=============================================================================
 // Sample thread paths
 
 
 
+// Returns state k, or if it has zero weight a[k] * b[k] (b may be NULL),
+// the nearest following state of nonzero weight, else the nearest
+// preceding one.  sample() lands on an item of zero weight only at the
+// edges of the running sum, but after forward pruning such items can be
+// states outside the beam.
+static int skip_pruned_state(const double *a, const double *b, int n, int k)
+{
+    if (a[k] * (b ? b[k] : 1.0) > 0.0)
+        return k;
+    for (int j=k+1; j<n; j++)
+        if (a[j] * (b ? b[j] : 1.0) > 0.0)
+            return j;
+    for (int j=k-1; j>=0; j--)
+        if (a[j] * (b ? b[j] : 1.0) > 0.0)
+            return j;
+    return k;
+}
+
+
 double sample_hmm_posterior(
     int blocklen, const LocalTree *tree, const States &states,
-    const TransMatrix *matrix, const double *const *fw, int *path)
+    const TransMatrix *matrix, const double *const *fw, int *path,
+    bool pruned)
 {
     // NOTE: path[n-1] must already be sampled
 
     const int nstates = max(states.size(), (size_t)1);
-    double A[nstates];
     double trans[nstates];
     int last_k = -1;
     double lnl = 0.0;
@@ -490,9 +910,9 @@ double sample_hmm_posterior(
             last_k = k;
         }
 
-        for (int j=0; j<nstates; j++)
-            A[j] = fw[i][j] * trans[j];
-        path[i] = sample(A, nstates);
+        path[i] = sample_product(fw[i], trans, nstates);
+        if (pruned)
+            path[i] = skip_pruned_state(fw[i], trans, nstates, path[i]);
         //lnl += log(A[path[i]]);
 
         // DEBUG
@@ -504,7 +924,7 @@ double sample_hmm_posterior(
 
 
 int sample_hmm_posterior_step(const TransMatrixSwitch *matrix,
-                              const double *col1, int state2)
+                              const double *col1, int state2, bool pruned)
 {
     const int nstates1 = max(matrix->nstates1, 1);
     double A[nstates1];
@@ -512,6 +932,8 @@ int sample_hmm_posterior_step(const TransMatrixSwitch *matrix,
     for (int j=0; j<nstates1; j++)
         A[j] = col1[j] * matrix->get(j, state2);
     int k = sample(A, nstates1);
+    if (pruned)
+        k = skip_pruned_state(A, NULL, nstates1, k);
 
     // DEBUG
     assert(matrix->get(k, state2) != 0.0);
@@ -522,7 +944,8 @@ int sample_hmm_posterior_step(const TransMatrixSwitch *matrix,
 double stochastic_traceback(
     const LocalTrees *trees, const ArgModel *model,
     ArgHmmMatrixIter *matrix_iter,
-    double **fw, int *path, bool last_state_given, bool internal)
+    double **fw, int *path, bool last_state_given, bool internal,
+    bool pruned)
 {
     States states;
     double lnl = 0.0;
@@ -535,6 +958,9 @@ double stochastic_traceback(
         ArgHmmMatrices &mat = matrix_iter->ref_matrices();
         const int nstates = max(mat.nstates2, 1);
         path[pos-1] = sample(fw[pos-1], nstates);
+        if (pruned)
+            path[pos-1] = skip_pruned_state(fw[pos-1], NULL, nstates,
+                                            path[pos-1]);
         lnl = fw[pos-1][path[pos-1]];
     }
 
@@ -546,7 +972,8 @@ double stochastic_traceback(
         pos -= mat.blocklen;
 
         lnl += sample_hmm_posterior(mat.blocklen, tree, states,
-                                    mat.transmat, &fw[pos], &path[pos]);
+                                    mat.transmat, &fw[pos], &path[pos],
+                                    pruned);
 
         // fill in last col of next block
         if (pos > trees->start_coord) {
@@ -554,13 +981,13 @@ double stochastic_traceback(
                 // use switch matrix
                 int i = pos - 1;
                 path[i] = sample_hmm_posterior_step(
-                    mat.transmat_switch, fw[i], path[i+1]);
+                    mat.transmat_switch, fw[i], path[i+1], pruned);
                 lnl += log(fw[i][path[i]] *
                            mat.transmat_switch->get(path[i], path[i+1]));
             } else {
                 // use normal matrix
                 lnl += sample_hmm_posterior(2, tree, states,
-                    mat.transmat, &fw[pos-1], &path[pos-1]);
+                    mat.transmat, &fw[pos-1], &path[pos-1], pruned);
             }
         }
     }
@@ -569,6 +996,183 @@ double stochastic_traceback(
 }
 
 
+// sample several thread paths from the same forward table; paths[k] is
+// indexed by coordinate like the path of stochastic_traceback()
+// Samples like sample_product() from the weights a[i] * b[i] (b may be
+// NULL), drawing the random number with rand_r() from 'seed'
+static int sample_product_r(const double *a, const double *b, int n,
+                            unsigned int *seed)
+{
+    double total = 0.0;
+    for (int i=0; i<n; i++)
+        total += a[i] * (b ? b[i] : 1.0);
+
+    const double pick = rand_r(seed) / double(RAND_MAX) * total;
+    double x = 0.0;
+    for (int i=0; i<n; i++) {
+        x += a[i] * (b ? b[i] : 1.0);
+        if (x >= pick)
+            return i;
+    }
+    return n - 1;
+}
+
+
+void stochastic_traceback_paths(
+    const LocalTrees *trees, const ArgModel *model,
+    ArgHmmMatrixIter *matrix_iter,
+    double **fw, int **paths, int npaths, unsigned int *seed, bool pruned)
+{
+    States states;
+
+    // choose last column first
+    matrix_iter->rbegin();
+    int pos = trees->end_coord;
+    {
+        ArgHmmMatrices &mat = matrix_iter->ref_matrices();
+        const int nstates = max(mat.nstates2, 1);
+        for (int k=0; k<npaths; k++) {
+            paths[k][pos-1] = sample_product_r(fw[pos-1], NULL, nstates,
+                                               seed);
+            if (pruned)
+                paths[k][pos-1] = skip_pruned_state(
+                    fw[pos-1], NULL, nstates, paths[k][pos-1]);
+        }
+    }
+
+    // iterate backward through blocks, computing each block's matrices
+    // once for all paths.  Sites are visited one at a time for all paths,
+    // so that each forward column is read from memory once.
+    vector<double> trans_alloc;
+    vector<int> last_k(npaths);
+    for (; matrix_iter->more(); matrix_iter->prev()) {
+        ArgHmmMatrices &mat = matrix_iter->ref_matrices();
+        LocalTree *tree = matrix_iter->get_tree_spr()->tree;
+        mat.states_model.get_coal_states(tree, states);
+        const int nstates = max(states.size(), (size_t)1);
+        const int end = pos;
+        pos -= mat.blocklen;
+
+        // the last column of the previous block uses this block's
+        // transition matrix, unless there is a switch matrix
+        int start = pos;
+        if (pos > trees->start_coord && !mat.transmat_switch)
+            start = pos - 1;
+
+        trans_alloc.resize(npaths * nstates);
+        fill(last_k.begin(), last_k.end(), -1);
+        for (int i=end-2; i>=start; i--) {
+            for (int p=0; p<npaths; p++) {
+                double *trans = &trans_alloc[p * nstates];
+                const int k = paths[p][i+1];
+                if (k != last_k[p]) {
+                    for (int j=0; j<nstates; j++)
+                        trans[j] = mat.transmat->get(tree, states, j, k);
+                    last_k[p] = k;
+                }
+                paths[p][i] = sample_product_r(fw[i], trans, nstates, seed);
+                if (pruned)
+                    paths[p][i] = skip_pruned_state(fw[i], trans, nstates,
+                                                    paths[p][i]);
+            }
+        }
+
+        // fill in last col of next block using the switch matrix
+        if (pos > trees->start_coord && mat.transmat_switch) {
+            const int i = pos - 1;
+            const int nstates1 = max(mat.transmat_switch->nstates1, 1);
+            vector<double> trans(nstates1);
+            for (int p=0; p<npaths; p++) {
+                for (int j=0; j<nstates1; j++)
+                    trans[j] = mat.transmat_switch->get(j, paths[p][i+1]);
+                paths[p][i] = sample_product_r(fw[i], &trans[0], nstates1,
+                                               seed);
+                if (pruned)
+                    paths[p][i] = skip_pruned_state(fw[i], &trans[0],
+                                                    nstates1, paths[p][i]);
+            }
+        }
+    }
+}
+
+
+
+//=============================================================================
+// Thread posterior
+
+
+// Monte Carlo estimate of the posterior of the coalescence time of a
+// chromosome's thread: the fraction of 'npaths' paths sampled from one
+// forward table that coalesce at each time.  Paths are drawn with
+// rand_r() from 'seed', and the ARG is left unchanged.
+void sample_thread_time_posterior(
+    const ArgModel *model, const Sequences *sequences,
+    const LocalTrees *trees, int chrom, int npaths, unsigned int *seed,
+    ThreadTimePosterior *posterior)
+{
+    // remove chromosome from a copy of the ARG
+    LocalTrees trees2;
+    trees2.copy(*trees);
+    remove_arg_thread(&trees2, chrom);
+
+    // compute forward table
+    Timer time;
+    const int seqlen = trees2.length();
+    ArgHmmForwardTable forward(trees2.start_coord, seqlen);
+    ArgHmmMatrixIter matrix_iter(model, sequences, &trees2, chrom);
+    arghmm_forward_alg(&trees2, model, sequences, &matrix_iter, &forward);
+
+    // sample paths
+    int *paths_alloc = new int [(size_t) npaths * seqlen];
+    int **paths = new int* [npaths];
+    for (int k=0; k<npaths; k++)
+        paths[k] = &paths_alloc[(size_t) k * seqlen - trees2.start_coord];
+    ArgHmmMatrixIter matrix_iter2(model, NULL, &trees2, chrom);
+    stochastic_traceback_paths(&trees2, model, &matrix_iter2,
+                               forward.get_table(), paths, npaths, seed,
+                               forward.pruned);
+
+    // count paths per coalescence time, merging runs of equal counts
+    const int ntimes = model->ntimes;
+    posterior->start_coord = trees2.start_coord;
+    posterior->ntimes = ntimes;
+    posterior->npaths = npaths;
+    posterior->run_ends.clear();
+    posterior->counts.clear();
+
+    States states;
+    vector<int> counts(ntimes);
+    int end = trees2.start_coord;
+    for (LocalTrees::iterator it=trees2.begin(); it != trees2.end(); ++it) {
+        int start = end;
+        end = start + it->blocklen;
+        matrix_iter.states_model.get_coal_states(it->tree, states);
+
+        for (int i=start; i<end; i++) {
+            fill(counts.begin(), counts.end(), 0);
+            for (int k=0; k<npaths; k++)
+                counts[states[paths[k][i]].time]++;
+
+            int nruns = posterior->run_ends.size();
+            if (nruns > 0 && equal(counts.begin(), counts.end(),
+                                   posterior->counts.end() - ntimes)) {
+                posterior->run_ends[nruns - 1] = i + 1;
+            } else {
+                posterior->run_ends.push_back(i + 1);
+                posterior->counts.insert(posterior->counts.end(),
+                                         counts.begin(), counts.end());
+            }
+        }
+    }
+    printTimerLog(time, LOG_LOW, "thread posterior (%d paths, %d runs):",
+                  npaths, posterior->get_num_runs());
+
+    // clean up
+    delete [] paths;
+    delete [] paths_alloc;
+}
+
+
 
 //=============================================================================
 // ARG sampling
@@ -606,7 +1210,8 @@ void sample_arg_thread(const ArgModel *model, Sequences *sequences,
     time.start();
     double **fw = forward.get_table();
     ArgHmmMatrixIter matrix_iter2(model, NULL, trees, new_chrom);
-    stochastic_traceback(trees, model, &matrix_iter2, fw, thread_path);
+    stochastic_traceback(trees, model, &matrix_iter2, fw, thread_path,
+                         false, false, forward.pruned);
     printTimerLog(time, LOG_LOW,
                   "trace:                              ");
 
@@ -668,7 +1273,7 @@ void sample_arg_thread_internal(
     ArgHmmMatrixIter matrix_iter2(model, NULL, trees);
     matrix_iter2.set_internal(internal, minage);
     stochastic_traceback(trees, model, &matrix_iter2, fw, thread_path,
-                         false, internal);
+                         false, internal, forward.pruned);
     printTimerLog(time, LOG_LOW,
                   "trace:                              ");
 
@@ -741,7 +1346,8 @@ void cond_sample_arg_thread(const ArgModel *model, const Sequences *sequences,
 
     // traceback
     time.start();
-    stochastic_traceback(trees, model, &matrix_list, fw, thread_path, true);
+    stochastic_traceback(trees, model, &matrix_list, fw, thread_path, true,
+                         false, forward.pruned);
     printf("trace:       %e s\n", time.time());
     assert(fw[trees->start_coord][thread_path[trees->start_coord]] == 1.0);
 
@@ -840,7 +1446,7 @@ void cond_sample_arg_thread_internal(
     ArgHmmMatrixIter matrix_iter2(model, NULL, trees);
     matrix_iter2.set_internal(internal);
     stochastic_traceback(trees, model, &matrix_iter2, fw, thread_path,
-                         last_state_given, internal);
+                         last_state_given, internal, forward.pruned);
     printTimerLog(time, LOG_LOW,
                   "trace:                              ");
     if (!start_state.is_null())
@@ -949,7 +1555,8 @@ intstate *arghmm_sample_posterior(
     // traceback
     int *ipath = new int [seqlen];
     stochastic_traceback(&trees, &model, &matrix_list,
-                         forward.get_table(), ipath);
+                         forward.get_table(), ipath, false, false,
+                         forward.pruned);
 
     // convert path
     if (path == NULL)
@@ -1002,7 +1609,7 @@ void arghmm_sample_arg_thread_internal(LocalTrees *trees,
     ArgHmmMatrixIter matrix_iter2(&model, NULL, trees);
     matrix_iter2.set_internal(internal);
     stochastic_traceback(trees, &model, &matrix_iter2, fw, thread_path,
-                         false, internal);
+                         false, internal, forward.pruned);
 }
 
 
@@ -37,7 +37,8 @@ class ArgHmmForwardTable
 public:
     ArgHmmForwardTable(int start_coord, int seqlen) :
         start_coord(start_coord),
-        seqlen(seqlen)
+        seqlen(seqlen),
+        pruned(false)
     {
         fw = new double *[seqlen];
     }
@@ -90,6 +91,7 @@ public:
 
     int start_coord;
     int seqlen;
+    bool pruned;  // true if forward pruning zeroed states of the table
 
 protected:
     double **fw;
@@ -124,6 +126,93 @@ public:
 };
 
 
+//=============================================================================
+// Approximate forward algorithm
+
+
+// Settings and bookkeeping for beam pruning of the forward algorithm.
+//
+// Within a block, a state whose normalized forward probability stays below
+// 'threshold' for 'runlen' consecutive sites is pruned: its probability is
+// set to zero and it is skipped for the rest of the block.  Each pruned
+// column keeps a fraction of its probability, and the product of these
+// fractions over a forward pass bounds how much of the forward
+// probability of the pass is kept.  If the discarded part, 1 minus the
+// product, ever exceeds 'tolerance' pruning is disabled for good.  Since
+// pruned states have zero forward probability, the stochastic traceback
+// never samples them.
+class ForwardPruning
+{
+public:
+    ForwardPruning(double threshold=0.0, int runlen=100,
+                   double tolerance=1e-3) :
+        threshold(threshold),
+        runlen(runlen),
+        tolerance(tolerance),
+        enabled(threshold > 0.0),
+        pass_log_kept(0.0),
+        pass_discarded(0.0)
+    {
+        reset_stats();
+    }
+
+    // Returns true if pruning should be performed
+    bool active() const
+    {
+        return enabled;
+    }
+
+    // Starts a new forward pass
+    void begin_pass()
+    {
+        pass_log_kept = 0.0;
+        pass_discarded = 0.0;
+    }
+
+    // Ends a forward pass
+    void end_pass()
+    {
+        npasses++;
+        total_discarded += pass_discarded;
+        max_discarded = max(max_discarded, pass_discarded);
+    }
+
+    // Records that 'nstates' states holding the fraction 'mass' of a
+    // column's probability have been pruned.  Returns false if pruning has
+    // been disabled because the tolerance is exceeded.
+    bool discard(double mass, int nstates)
+    {
+        pass_log_kept += log1p(-mass);
+        pass_discarded = -expm1(pass_log_kept);
+        nstates_pruned += nstates;
+        if (pass_discarded > tolerance)
+            enabled = false;
+        return enabled;
+    }
+
+    void reset_stats()
+    {
+        npasses = 0;
+        nstates_pruned = 0;
+        total_discarded = 0.0;
+        max_discarded = 0.0;
+    }
+
+    double threshold;  // min normalized forward probability of a state
+    int runlen;        // number of sites a state must stay below threshold
+    double tolerance;  // max discarded fraction per forward pass
+    bool enabled;
+
+    // statistics
+    double pass_log_kept;   // log of the fraction kept in this pass
+    double pass_discarded;  // fraction discarded in this pass
+    int npasses;
+    long nstates_pruned;
+    double total_discarded;
+    double max_discarded;
+};
+
+
 //=============================================================================
 // Forward algorithm for thread path
 
@@ -132,10 +221,64 @@ void arghmm_forward_alg(const LocalTrees *trees, const ArgModel *model,
     ArgHmmForwardTable *forward, PhaseProbs *phase_pr=NULL,
     bool prior_given=false, bool internal=false, bool slow=false);
 
+// Forward algorithm over segments of blocks in parallel threads (see
+// ArgModel::forward_threads)
+void arghmm_forward_alg_parallel(const LocalTrees *trees,
+    const ArgModel *model, ArgHmmMatrixIter *matrix_iter,
+    ArgHmmForwardTable *forward, bool prior_given=false,
+    bool internal=false);
+
 double stochastic_traceback(
     const LocalTrees *trees, const ArgModel *model,
     ArgHmmMatrixIter *matrix_iter,
-    double **fw, int *path, bool last_state_given=false, bool internal=false);
+    double **fw, int *path, bool last_state_given=false, bool internal=false,
+    bool pruned=false);
+
+// Samples 'npaths' paths from one forward table, drawing random numbers
+// with rand_r() from 'seed' instead of the global random stream
+void stochastic_traceback_paths(
+    const LocalTrees *trees, const ArgModel *model,
+    ArgHmmMatrixIter *matrix_iter,
+    double **fw, int **paths, int npaths, unsigned int *seed,
+    bool pruned=false);
+
+
+//=============================================================================
+// Thread posterior
+
+// Posterior distribution of the coalescence time of one chromosome's
+// thread, a Monte Carlo estimate from paths sampled from a single forward
+// table, so each probability is a multiple of 1/npaths.  Consecutive
+// sites with the same distribution are merged into runs.
+class ThreadTimePosterior
+{
+public:
+    ThreadTimePosterior() : start_coord(0), ntimes(0), npaths(0) {}
+
+    int get_num_runs() const { return run_ends.size(); }
+    int get_run_start(int run) const
+    {
+        return run == 0 ? start_coord : run_ends[run - 1];
+    }
+    int get_run_end(int run) const { return run_ends[run]; }
+
+    // fraction of paths that coalesce at time index 'time' within a run
+    double get_prob(int run, int time) const
+    {
+        return double(counts[run * ntimes + time]) / npaths;
+    }
+
+    int start_coord;
+    int ntimes;
+    int npaths;
+    vector<int> run_ends;  // end coordinate of each run
+    vector<int> counts;    // number of paths per run and time index
+};
+
+void sample_thread_time_posterior(
+    const ArgModel *model, const Sequences *sequences,
+    const LocalTrees *trees, int chrom, int npaths, unsigned int *seed,
+    ThreadTimePosterior *posterior);
 
 //=============================================================================
 // ARG thread sampling
@@ -0,0 +1,183 @@
+//=============================================================================
+// scratch memory for per-block temporaries
+
+#include <pthread.h>
+
+#include "common.h"
+#include "scratch.h"
+
+namespace argweaver {
+
+
+static inline size_t align_size(size_t nbytes)
+{
+    return (nbytes + ScratchArena::ALIGN - 1) & ~(ScratchArena::ALIGN - 1);
+}
+
+
+static char *new_chunk(size_t nbytes)
+{
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, ScratchArena::ALIGN, nbytes) != 0)
+        return NULL;
+    return (char*) ptr;
+}
+
+
+void ScratchArena::reserve(size_t capacity)
+{
+    capacity = align_size(capacity);
+
+    // arena must be empty in order to resize
+    if (chunk != 0 || offset != 0)
+        return;
+    if (chunks.size() == 1 && chunk_sizes[0] >= capacity)
+        return;
+
+    // replace all chunks with one chunk of the requested size
+    size_t total = max(capacity, this->capacity());
+    free_chunks();
+    chunks.push_back(new_chunk(total));
+    chunk_sizes.push_back(total);
+    assert(chunks[0]);
+}
+
+
+void *ScratchArena::alloc_bytes(size_t nbytes)
+{
+    nbytes = align_size(max(nbytes, (size_t) 1));
+
+    // find a chunk with enough space
+    while (chunk < int(chunks.size()) &&
+           offset + nbytes > chunk_sizes[chunk]) {
+        chunk++;
+        offset = 0;
+    }
+
+    // grow arena by adding a new chunk
+    if (chunk == int(chunks.size())) {
+        size_t size = chunks.size() > 0 ? 2 * chunk_sizes.back() : 0;
+        size = max(size, nbytes);
+        chunks.push_back(new_chunk(size));
+        chunk_sizes.push_back(size);
+        assert(chunks.back());
+    }
+
+    char *ptr = chunks[chunk] + offset;
+    offset += nbytes;
+    return ptr;
+}
+
+
+void ScratchArena::release(const Mark &m)
+{
+    chunk = m.chunk;
+    offset = m.offset;
+
+    // when the arena empties, consolidate overflow chunks so that the next
+    // round of allocations fits in one chunk
+    if (chunk == 0 && offset == 0 && chunks.size() > 1)
+        merge_chunks();
+}
+
+
+size_t ScratchArena::capacity() const
+{
+    size_t total = 0;
+    for (unsigned int i=0; i<chunk_sizes.size(); i++)
+        total += chunk_sizes[i];
+    return total;
+}
+
+
+void ScratchArena::free_chunks()
+{
+    for (unsigned int i=0; i<chunks.size(); i++)
+        free(chunks[i]);
+    chunks.clear();
+    chunk_sizes.clear();
+    chunk = 0;
+    offset = 0;
+}
+
+
+void ScratchArena::merge_chunks()
+{
+    size_t total = capacity();
+    free_chunks();
+    chunks.push_back(new_chunk(total));
+    chunk_sizes.push_back(total);
+    assert(chunks[0]);
+}
+
+
+// one arena per thread, created on first use and freed when the thread
+// exits through the destructor of a thread-specific key
+static __thread ScratchArena *thread_arena = NULL;
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+
+static void delete_arena(void *arena)
+{
+    delete (ScratchArena*) arena;
+}
+
+
+static void make_arena_key()
+{
+    pthread_key_create(&arena_key, delete_arena);
+}
+
+
+ScratchArena &get_scratch_arena()
+{
+    if (!thread_arena) {
+        pthread_once(&arena_key_once, make_arena_key);
+        thread_arena = new ScratchArena();
+        pthread_setspecific(arena_key, thread_arena);
+    }
+    return *thread_arena;
+}
+
+
+void free_scratch_arena()
+{
+    if (!thread_arena)
+        return;
+    pthread_setspecific(arena_key, NULL);
+    delete thread_arena;
+    thread_arena = NULL;
+}
+
+
+size_t get_scratch_block_size(int nnodes, int ntimes, int blocklen)
+{
+    // new branch adds two nodes to the tree
+    const size_t n = nnodes + 2;
+    const size_t nstates = n * ntimes;
+    const size_t pad = ScratchArena::ALIGN;
+
+    // emissions: site flags, site patterns and their hash table,
+    // 6 likelihood tables (two phasings), per-state branch probabilities,
+    // infinite sites table
+    size_t emit = 4 * (blocklen + pad) +
+        5 * blocklen * sizeof(int) +
+        4 * (blocklen * n * 4 * sizeof(double) + blocklen * sizeof(void*)) +
+        2 * (blocklen * 4 * sizeof(double) + blocklen * sizeof(void*)) +
+        nstates * (sizeof(int) + 7 * sizeof(double)) +
+        blocklen * (nstates + sizeof(void*)) +
+        24 * pad;
+
+    // forward algorithm: time and state transition matrices, node tables
+    size_t forward = (ntimes * ntimes + ntimes * nstates +
+                      2 * ntimes) * sizeof(double) +
+        (2 * ntimes) * sizeof(void*) +
+        (6 * n + nstates) * sizeof(int) +
+        16 * pad;
+
+    return emit + forward;
+}
+
+
+} // namespace argweaver
@@ -0,0 +1,144 @@
+//=============================================================================
+// scratch memory for per-block temporaries
+
+#ifndef ARGWEAVER_SCRATCH_H
+#define ARGWEAVER_SCRATCH_H
+
+// c++ includes
+#include <stdlib.h>
+#include <vector>
+
+
+namespace argweaver {
+
+using namespace std;
+
+
+// A stack-like arena for short-lived temporary arrays.
+//
+// The emission and transition code needs many arrays whose size depends on
+// the block (nnodes, ntimes, nstates, blocklen) and whose lifetime ends when
+// the block has been processed.  Instead of going to the heap for each of
+// them, they are carved out of a few large chunks that are reused from block
+// to block.  Allocations are released in LIFO order with mark()/release(),
+// which is most easily done with a ScratchFrame on the stack.
+class ScratchArena
+{
+public:
+    // A position in the arena that can be released back to
+    struct Mark
+    {
+        int chunk;
+        size_t offset;
+    };
+
+    ScratchArena(size_t capacity=0) :
+        chunk(0),
+        offset(0)
+    {
+        if (capacity > 0)
+            reserve(capacity);
+    }
+
+    ~ScratchArena()
+    {
+        free_chunks();
+    }
+
+    // Ensures that at least 'capacity' bytes are available in one chunk.
+    // Only has an effect while nothing is allocated from the arena.
+    void reserve(size_t capacity);
+
+    // Allocates 'nbytes' bytes aligned to ALIGN bytes
+    void *alloc_bytes(size_t nbytes);
+
+    // Allocates an uninitialized array of 'n' elements of type T
+    // NOTE: T must not need a destructor
+    template <class T>
+    T *alloc(size_t n)
+    {
+        return (T*) alloc_bytes(n * sizeof(T));
+    }
+
+    // Allocates a matrix of 'nrows' by 'ncols' elements of type T
+    // in the same layout as new_matrix()
+    template <class T>
+    T **alloc_matrix(int nrows, int ncols)
+    {
+        T **mat = alloc<T*>(nrows);
+        T *block = alloc<T>(size_t(nrows) * ncols);
+        for (int i=0; i<nrows; i++)
+            mat[i] = &block[size_t(i)*ncols];
+        return mat;
+    }
+
+    // Returns the current allocation position
+    Mark mark() const
+    {
+        Mark m;
+        m.chunk = chunk;
+        m.offset = offset;
+        return m;
+    }
+
+    // Releases all allocations made since mark 'm' was taken
+    void release(const Mark &m);
+
+    // Returns total number of bytes held by the arena
+    size_t capacity() const;
+
+    // alignment of every allocation (cache line)
+    static const size_t ALIGN = 64;
+
+protected:
+    void free_chunks();
+    void merge_chunks();
+
+    vector<char*> chunks;       // memory chunks
+    vector<size_t> chunk_sizes; // size of each chunk
+    int chunk;                  // index of current chunk
+    size_t offset;              // first free byte in current chunk
+
+private:
+    // arenas are not copyable
+    ScratchArena(const ScratchArena &other);
+    ScratchArena &operator=(const ScratchArena &other);
+};
+
+
+// Releases all allocations made in an arena during the lifetime of
+// this object.
+class ScratchFrame
+{
+public:
+    explicit ScratchFrame(ScratchArena &arena) :
+        arena(arena),
+        start(arena.mark())
+    {}
+
+    ~ScratchFrame()
+    {
+        arena.release(start);
+    }
+
+protected:
+    ScratchArena &arena;
+    ScratchArena::Mark start;
+};
+
+
+// Returns the scratch arena of the calling thread.  The arena is freed
+// when the thread exits.
+ScratchArena &get_scratch_arena();
+
+// Frees the scratch arena of the calling thread early
+void free_scratch_arena();
+
+// Returns the number of bytes of scratch space needed for processing
+// one block of the threading HMM
+size_t get_scratch_block_size(int nnodes, int ntimes, int blocklen);
+
+
+} // namespace argweaver
+
+#endif // ARGWEAVER_SCRATCH_H
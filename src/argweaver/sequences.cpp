@@ -348,12 +348,16 @@ void apply_mask_sequences<NullValue>(Sequences *sequences,
                                      const TrackNullValue &maskmap)
 {
     const char maskchar = 'N';
+    const int seqlen = sequences->length();
 
+    // mask each region as a contiguous run of every sequence
     for (unsigned int k=0; k<maskmap.size(); k++) {
-        for (int i=maskmap[k].start; i<maskmap[k].end; i++) {
-            for (int j=0; j<sequences->get_num_seqs(); j++)
-                sequences->seqs[j][i] = maskchar;
-        }
+        const int start = max(maskmap[k].start, 0);
+        const int end = min(maskmap[k].end, seqlen);
+        if (start >= end)
+            continue;
+        for (int j=0; j<sequences->get_num_seqs(); j++)
+            memset(&sequences->seqs[j][start], maskchar, end - start);
     }
 }
 
@@ -7,6 +7,7 @@
 
 #include "common.h"
 #include "local_tree.h"
+#include "scratch.h"
 
 namespace argweaver {
 
@@ -50,10 +51,15 @@ typedef vector<State> States;
 
 // This data structure provides a mapping from (node, time) tuples to
 // the corresponding state index.
+//
+// Lookup arrays are drawn from the thread's scratch arena and released when
+// the lookup is destroyed, so lookups must be destroyed in reverse order of
+// construction (e.g. as local variables).
 class NodeStateLookup
 {
 public:
     NodeStateLookup(const States &states, int nnodes) :
+        frame(get_scratch_arena()),
         states(states),
         nstates(states.size()),
         nnodes(nnodes)
@@ -62,9 +68,10 @@ public:
         const int MAXTIME = 1000000;
 
         // allocate lookup arrays
-        node_offset = new int[nnodes];
-        state_lookup = new int[nstates];
-        nstates_per_node = new int[nnodes];
+        ScratchArena &arena = get_scratch_arena();
+        node_offset = arena.alloc<int>(nnodes);
+        state_lookup = arena.alloc<int>(nstates);
+        nstates_per_node = arena.alloc<int>(nnodes);
 
         // count number of states per node and mintime per node
         int node_mintimes[nnodes];
@@ -97,14 +104,6 @@ public:
         }
     }
 
-    ~NodeStateLookup()
-    {
-        // clean up lookup arrays
-        delete [] node_offset;
-        delete [] state_lookup;
-        delete [] nstates_per_node;
-    }
-
     // Returns the state index for state (node, time)
     inline int lookup(int node, int time) const {
         if (nstates_per_node[node] == 0)
@@ -122,6 +121,7 @@ public:
     }
 
 protected:
+    ScratchFrame frame;
     const States &states;
     int nstates;
     int nnodes;
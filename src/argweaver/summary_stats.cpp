@@ -0,0 +1,134 @@
+//=============================================================================
+// streaming summaries of scores
+
+#include <algorithm>
+
+#include "IntervalIterator.h"
+#include "summary_stats.h"
+
+
+namespace argweaver {
+
+
+QuantileSketch::QuantileSketch(int max_exact, double compression) :
+    max_exact(max_exact),
+    compression(compression),
+    exact(true),
+    n(0),
+    minval(0.0),
+    maxval(0.0)
+{}
+
+
+void QuantileSketch::add(double x)
+{
+    if (n == 0 || x < minval)
+        minval = x;
+    if (n == 0 || x > maxval)
+        maxval = x;
+    n++;
+    values.push_back(x);
+
+    if (exact) {
+        if ((int) values.size() > max_exact) {
+            exact = false;
+            flush();
+        }
+    } else if (values.size() >= 5 * compression) {
+        flush();
+    }
+}
+
+
+// Merges the buffered values into the centroids.  Neighboring centroids
+// are merged as long as they span at most one unit of the scale function
+// k(q) = compression / (2 pi) * asin(2q - 1), which keeps centroids small
+// near the tails.
+void QuantileSketch::flush()
+{
+    if (values.size() == 0)
+        return;
+
+    vector<Centroid> items(centroids);
+    for (unsigned int i=0; i<values.size(); i++)
+        items.push_back(Centroid(values[i], 1.0));
+    values.clear();
+    sort(items.begin(), items.end());
+
+    const double total = n;
+    const double scale = compression / (2.0 * M_PI);
+    centroids.clear();
+    Centroid cur = items[0];
+    double before = 0.0;  // weight of the centroids before cur
+    double k0 = scale * asin(-1.0);
+    for (unsigned int i=1; i<items.size(); i++) {
+        const double q = (before + cur.weight + items[i].weight) / total;
+        const double k = scale * asin(2.0 * min(q, 1.0) - 1.0);
+        if (k - k0 <= 1.0) {
+            cur.weight += items[i].weight;
+            cur.mean += (items[i].mean - cur.mean) * items[i].weight /
+                cur.weight;
+        } else {
+            centroids.push_back(cur);
+            before += cur.weight;
+            k0 = scale * asin(2.0 * min(before / total, 1.0) - 1.0);
+            cur = items[i];
+        }
+    }
+    centroids.push_back(cur);
+}
+
+
+// Interpolates a quantile between the centers of the centroids
+double QuantileSketch::quantile(double q) const
+{
+    const double target = q * n;
+    const Centroid &first = centroids.front();
+    const Centroid &last = centroids.back();
+
+    if (target < first.weight / 2.0) {
+        if (first.weight <= 1.0)
+            return first.mean;
+        return minval + (first.mean - minval) * target / (first.weight / 2.0);
+    }
+    if (target > n - last.weight / 2.0) {
+        if (last.weight <= 1.0)
+            return last.mean;
+        return maxval - (maxval - last.mean) * (n - target) /
+            (last.weight / 2.0);
+    }
+
+    double center = first.weight / 2.0;
+    for (unsigned int i=0; i+1<centroids.size(); i++) {
+        const double next = center + (centroids[i].weight +
+                                      centroids[i+1].weight) / 2.0;
+        if (target <= next) {
+            const double f = (target - center) / (next - center);
+            return centroids[i].mean +
+                f * (centroids[i+1].mean - centroids[i].mean);
+        }
+        center = next;
+    }
+    return last.mean;
+}
+
+
+vector<double> QuantileSketch::quantiles(const vector<double> &q)
+{
+    if (exact)
+        return compute_quantiles(values, q);
+
+    flush();
+    vector<double> result(q.size());
+    for (unsigned int i=0; i<q.size(); i++) {
+        if (q[i] < 0 || q[i] > 1) {
+            printError("Error: quantiles expects values between 0 and 1\n");
+            abort();
+        }
+        result[i] = quantile(q[i]);
+    }
+    return result;
+}
+
+
+} // namespace argweaver
@@ -0,0 +1,105 @@
+//=============================================================================
+// streaming summaries of scores
+//
+// These accumulators summarize a stream of values in constant memory, so
+// that summaries over many MCMC samples do not need to keep every value.
+
+#ifndef ARGWEAVER_SUMMARY_STATS_H
+#define ARGWEAVER_SUMMARY_STATS_H
+
+// c/c++ includes
+#include <math.h>
+#include <vector>
+
+
+namespace argweaver {
+
+using namespace std;
+
+
+// default number of values for which quantiles are kept exact
+const int DEFAULT_MAX_EXACT_QUANTILES = 1000;
+
+// default compression of a t-digest (roughly the number of centroids)
+const double DEFAULT_DIGEST_COMPRESSION = 200;
+
+
+// Mean and variance of a stream of values.  The mean is the plain sum
+// over n, as by compute_mean, while the variance uses Welford's algorithm
+// and agrees with compute_stdev up to rounding.
+class RunningMoments
+{
+public:
+    RunningMoments() : n(0), sum(0.0), meanval(0.0), m2(0.0) {}
+
+    void add(double x)
+    {
+        n++;
+        sum += x;
+        const double diff = x - meanval;
+        meanval += diff / n;
+        m2 += diff * (x - meanval);
+    }
+
+    int count() const { return n; }
+    double mean() const { return sum / n; }
+
+    // sample standard deviation
+    double stdev() const { return sqrt(m2 / (n - 1)); }
+
+protected:
+    int n;
+    double sum;
+    double meanval; // running mean for the variance update
+    double m2;
+};
+
+
+// Quantiles of a stream of values.  While there are at most 'max_exact'
+// values, they are kept and quantiles are exact (as by compute_quantiles).
+// Beyond that, values are summarized by a merging t-digest, which is most
+// accurate for the tails.
+class QuantileSketch
+{
+public:
+    QuantileSketch(int max_exact=DEFAULT_MAX_EXACT_QUANTILES,
+                   double compression=DEFAULT_DIGEST_COMPRESSION);
+
+    void add(double x);
+    int count() const { return n; }
+    bool is_exact() const { return exact; }
+
+    // Returns the quantiles q (between 0 and 1) of the values
+    vector<double> quantiles(const vector<double> &q);
+
+protected:
+    struct Centroid
+    {
+        Centroid(double mean=0.0, double weight=0.0) :
+            mean(mean), weight(weight) {}
+        bool operator<(const Centroid &other) const
+        {
+            return mean < other.mean;
+        }
+
+        double mean;
+        double weight;
+    };
+
+    void flush();
+    double quantile(double q) const;
+
+    int max_exact;
+    double compression;
+    bool exact;
+    int n;
+    double minval;
+    double maxval;
+    vector<double> values;       // all values, or those not yet merged
+    vector<Centroid> centroids;  // t-digest, sorted by mean
+};
+
+
+} // namespace argweaver
+
+#endif // ARGWEAVER_SUMMARY_STATS_H
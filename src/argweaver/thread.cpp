@@ -414,6 +414,9 @@ void add_arg_thread(LocalTrees *trees, const StatesModel &states_model,
             last_state.node = displaced;
     }
 
+    // every block has changed
+    trees->invalidate_cache();
+
     assert_trees(trees);
 }
 
@@ -550,6 +553,9 @@ void remove_arg_thread(LocalTrees *trees, int remove_seqid)
     // remove extra trees
     remove_null_sprs(trees);
 
+    // every block has changed
+    trees->invalidate_cache();
+
     assert_trees(trees);
 }
 
@@ -910,42 +916,81 @@ void sample_arg_removal_path_recomb(
 //=============================================================================
 // sample removal paths uniformly
 
+// calc the counts column of a tree from the column of the previous tree
+static inline void count_removal_paths_column(
+    const double *prev_counts, const RemovalPaths::next_row *backptrs,
+    double *counts, int nnodes)
+{
+    for (int j=0; j<nnodes; j++) {
+        const int *ptrs = backptrs[j];
+        if (ptrs[1] == -1)
+            counts[j] = prev_counts[ptrs[0]];
+        else
+            counts[j] = logadd(prev_counts[ptrs[0]], prev_counts[ptrs[1]]);
+    }
+}
+
+
 // count number of removal paths
 void count_arg_removal_paths(const LocalTrees *trees,
                              RemovalPaths &removal_paths)
 {
     const int ntrees = trees->get_num_trees();
     const int nnodes = trees->nnodes;
+    const int step = removal_paths.step;
     double **counts = removal_paths.counts;
     RemovalPaths::next_row **backptrs = removal_paths.backptrs;
 
+    // checkpointed tables keep a rolling column and back pointers
+    double *column = NULL, *prev_column = NULL;
+    RemovalPaths::next_row *column_ptrs = NULL;
+    if (step > 0) {
+        column = new double [nnodes];
+        prev_column = new double [nnodes];
+        column_ptrs = new RemovalPaths::next_row [nnodes];
+    }
+
     // calculate first column
-    fill(counts[0], counts[0] + nnodes, 0.0);
+    LocalTrees::const_iterator it= trees->begin();
+    if (step > 0) {
+        fill(column, column + nnodes, 0.0);
+        std::copy(column, column + nnodes, counts[0]);
+    } else {
+        fill(counts[0], counts[0] + nnodes, 0.0);
+    }
 
     // compute forward table
-    LocalTrees::const_iterator it= trees->begin();
     LocalTree const *last_tree = it->tree;
     ++it;
     for (int i=1; i<ntrees; i++, ++it) {
         LocalTree const *tree = it->tree;
         const int *mapping = it->mapping;
 
-        // get back pointers
-        get_all_prev_removal_nodes(last_tree, tree, it->spr, mapping,
-                                   backptrs[i]);
-
-        // calc counts column
-        for (int j=0; j<nnodes; j++) {
-            int *ptrs = backptrs[i][j];
-            if (ptrs[1] == -1)
-                counts[i][j] = counts[i-1][ptrs[0]];
-            else
-                counts[i][j] = logadd(counts[i-1][ptrs[0]],
-                                      counts[i-1][ptrs[1]]);
+        if (step == 0) {
+            // get back pointers and calc counts column
+            get_all_prev_removal_nodes(last_tree, tree, it->spr, mapping,
+                                       backptrs[i]);
+            count_removal_paths_column(counts[i-1], backptrs[i], counts[i],
+                                       nnodes);
+        } else {
+            swap(column, prev_column);
+            get_all_prev_removal_nodes(last_tree, tree, it->spr, mapping,
+                                       column_ptrs);
+            count_removal_paths_column(prev_column, column_ptrs, column,
+                                       nnodes);
+            if (i % step == 0)
+                std::copy(column, column + nnodes, counts[i / step]);
         }
 
         last_tree = tree;
     }
+
+    if (step > 0) {
+        std::copy(column, column + nnodes, removal_paths.last_counts);
+        delete [] column;
+        delete [] prev_column;
+        delete [] column_ptrs;
+    }
 }
 
 
@@ -953,54 +998,115 @@ void count_arg_removal_paths(const LocalTrees *trees,
 double count_total_arg_removal_paths(const RemovalPaths &removal_paths)
 {
     // count total number of paths
-    return logsum(removal_paths.counts[removal_paths.ntrees - 1],
-                  removal_paths.nnodes);
+    return logsum(removal_paths.last_counts, removal_paths.nnodes);
 }
 
 
-
-// sample a removal path uniformly from all paths and return total path count
-double sample_arg_removal_path_uniform(const LocalTrees *trees, int *path)
+// trace back a removal path from path[i] to path[i-1]
+static inline void sample_removal_path_traceback(
+    const double *prev_counts, const RemovalPaths::next_row *backptrs,
+    int *path, int i)
 {
-    // compute path counts table
-    RemovalPaths removal_paths(trees);
-    count_arg_removal_paths(trees, removal_paths);
+    const int *ptrs = backptrs[path[i]];
+    if (ptrs[1] == -1) {
+        // single trace back
+        path[i-1] = ptrs[0];
+    } else {
+        // sample traceback
+        const double p1 = prev_counts[ptrs[0]];
+        const double p2 = prev_counts[ptrs[1]];
 
+        if (log(frand()) < (p1 - logadd(p1, p2)))
+            path[i-1] = ptrs[0];
+        else
+            path[i-1] = ptrs[1];
+    }
+}
+
+
+// sample a removal path uniformly from all paths counted in a table of
+// trees and return total path count
+double sample_arg_removal_path_uniform(const LocalTrees *trees,
+                                       const RemovalPaths &removal_paths,
+                                       int *path)
+{
     // convenience variables
-    const int ntrees = trees->get_num_trees();
-    const int nnodes = trees->nnodes;
+    const int ntrees = removal_paths.ntrees;
+    const int nnodes = removal_paths.nnodes;
+    const int step = removal_paths.step;
     double **counts = removal_paths.counts;
     RemovalPaths::next_row **backptrs = removal_paths.backptrs;
 
     // sample last branch of path first weighted by path counts
     double weights[nnodes];
-    double norm = logsum(counts[ntrees - 1], nnodes);
+    double norm = logsum(removal_paths.last_counts, nnodes);
     for (int j=0; j<nnodes; j++)
-        weights[j] = exp(counts[ntrees - 1][j] - norm);
+        weights[j] = exp(removal_paths.last_counts[j] - norm);
     path[ntrees - 1] = sample(weights, nnodes);
 
-    for (int i=ntrees-1; i>0; i--) {
-        const int *ptrs = backptrs[i][path[i]];
-        if (ptrs[1] == -1) {
-            // single trace back
-            path[i-1] = ptrs[0];
-        } else {
-            // sample traceback
-            const double p1 = counts[i-1][ptrs[0]];
-            const double p2 = counts[i-1][ptrs[1]];
+    if (step == 0) {
+        for (int i=ntrees-1; i>0; i--)
+            sample_removal_path_traceback(counts[i-1], backptrs[i], path, i);
+        return count_total_arg_removal_paths(removal_paths);
+    }
 
-            if (log(frand()) < (p1 - logadd(p1, p2)))
-                path[i-1] = ptrs[0];
-            else
-                path[i-1] = ptrs[1];
+    // find the tree of each checkpoint
+    const int ncheckpoints = removal_paths.num_checkpoints();
+    vector<LocalTrees::const_iterator> checkpoints;
+    checkpoints.reserve(ncheckpoints);
+    LocalTrees::const_iterator it = trees->begin();
+    for (int i=0; i<ntrees; i++, ++it) {
+        if (i % step == 0)
+            checkpoints.push_back(it);
+    }
+
+    // Recompute the columns of each segment from its checkpoint, from the
+    // last segment to the first.  Segment [start, end) traces back from
+    // tree end (or the last tree) to tree start.
+    double **seg_counts = new_matrix<double>(step, nnodes);
+    RemovalPaths::next_row **seg_backptrs =
+        new_matrix<RemovalPaths::next_row>(step + 1, nnodes);
+    for (int k=ncheckpoints-1; k>=0; k--) {
+        const int start = k * step;
+        const int end = min(start + step, ntrees - 1);
+
+        std::copy(counts[k], counts[k] + nnodes, seg_counts[0]);
+        it = checkpoints[k];
+        LocalTree const *last_tree = it->tree;
+        ++it;
+        for (int i=start+1; i<=end; i++, ++it) {
+            LocalTree const *tree = it->tree;
+            get_all_prev_removal_nodes(last_tree, tree, it->spr, it->mapping,
+                                       seg_backptrs[i - start]);
+            if (i - start < step)
+                count_removal_paths_column(
+                    seg_counts[i-1 - start], seg_backptrs[i - start],
+                    seg_counts[i - start], nnodes);
+            last_tree = tree;
         }
+
+        for (int i=end; i>start; i--)
+            sample_removal_path_traceback(
+                seg_counts[i-1 - start], seg_backptrs[i - start], path, i);
     }
+    delete_matrix<double>(seg_counts, step);
+    delete_matrix<RemovalPaths::next_row>(seg_backptrs, step + 1);
 
     // count total number of paths
     return count_total_arg_removal_paths(removal_paths);
 }
 
 
+// sample a removal path uniformly from all paths and return total path count
+double sample_arg_removal_path_uniform(const LocalTrees *trees, int *path)
+{
+    // compute path counts table
+    RemovalPaths removal_paths(trees);
+    count_arg_removal_paths(trees, removal_paths);
+    return sample_arg_removal_path_uniform(trees, removal_paths, path);
+}
+
+
 // count total number of removal paths
 double count_total_arg_removal_paths(const LocalTrees *trees)
 {
@@ -1443,6 +1549,9 @@ void add_arg_thread_path(LocalTrees *trees, const StatesModel &states_model,
         last_subtree_root = subtree_root;
     }
 
+    // every block has changed
+    trees->invalidate_cache();
+
     assert_trees(trees);
 }
 
@@ -1668,6 +1777,9 @@ void remove_arg_thread_path(LocalTrees *trees, const int *removal_path,
     // remove extra trees
     remove_null_sprs(trees);
 
+    // every block has changed
+    trees->invalidate_cache();
+
     assert_trees(trees);
 }
 
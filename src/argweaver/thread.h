@@ -48,21 +48,35 @@ void remove_arg_thread_path(LocalTrees *trees, const int *removal_path,
 // removal paths
 
 
+// Path counts tables with more cells than this are checkpointed
+const int MAX_DENSE_REMOVAL_PATHS = 1 << 20;
+
+
+// Counts of removal paths ending at each node of each local tree, with
+// back pointers to the nodes of the previous tree.
+//
+// For long ARGs the table can be checkpointed: only every step-th column
+// of counts is kept, along with the last one, and no back pointers.
+// Sampling then recomputes the columns of each segment from its
+// checkpoint, so memory is O((ntrees / step + step) nnodes).
 class RemovalPaths
 {
 public:
+    // Checkpoints the table if it is large (step = sqrt(ntrees))
     RemovalPaths(const LocalTrees *trees) :
         counts(NULL),
-        backptrs(NULL)
+        backptrs(NULL),
+        last_counts(NULL)
     {
         alloc(trees);
     }
 
-    RemovalPaths(int nnodes, int ntrees) :
+    RemovalPaths(int nnodes, int ntrees, int step=0) :
         counts(NULL),
-        backptrs(NULL)
+        backptrs(NULL),
+        last_counts(NULL)
     {
-        alloc(nnodes, ntrees);
+        alloc(nnodes, ntrees, step);
     }
 
     ~RemovalPaths()
@@ -74,26 +88,44 @@ public:
 
     void alloc(const LocalTrees *trees)
     {
-        alloc(trees->nnodes, trees->get_num_trees());
+        const int _nnodes = trees->nnodes;
+        const int _ntrees = trees->get_num_trees();
+        int _step = 0;
+        if ((double) _nnodes * _ntrees > MAX_DENSE_REMOVAL_PATHS)
+            _step = max(int(ceil(sqrt(double(_ntrees)))), 1);
+        alloc(_nnodes, _ntrees, _step);
     }
 
-    void alloc(int _nnodes, int _ntrees)
+    void alloc(int _nnodes, int _ntrees, int _step=0)
     {
         clear();
 
         nnodes = _nnodes;
         ntrees = _ntrees;
+        step = _step;
 
         // allocate path counts and traceback tables
-        counts = new_matrix<double>(ntrees, nnodes);
-        backptrs = new_matrix<next_row>(ntrees, nnodes);
+        if (step == 0) {
+            counts = new_matrix<double>(ntrees, nnodes);
+            backptrs = new_matrix<next_row>(ntrees, nnodes);
+            last_counts = counts[ntrees - 1];
+        } else {
+            counts = new_matrix<double>(num_checkpoints(), nnodes);
+            last_counts = new double [nnodes];
+        }
     }
 
     void clear()
     {
         if (counts) {
-            delete_matrix<double>(counts, ntrees);
+            if (step == 0)
+                delete_matrix<double>(counts, ntrees);
+            else {
+                delete_matrix<double>(counts, num_checkpoints());
+                delete [] last_counts;
+            }
             counts = NULL;
+            last_counts = NULL;
         }
         if (backptrs) {
             delete_matrix<next_row>(backptrs, ntrees);
@@ -101,11 +133,17 @@ public:
         }
     }
 
+    bool is_checkpointed() const { return step > 0; }
+
+    int num_checkpoints() const { return (ntrees - 1) / step + 1; }
+
 
     int nnodes;
     int ntrees;
-    double **counts;
-    next_row **backptrs;
+    int step;
+    double **counts;     // all columns, or those of the checkpoints
+    next_row **backptrs; // NULL if checkpointed
+    double *last_counts; // counts of the last tree
 };
 
 
@@ -128,6 +166,9 @@ double count_total_arg_removal_paths(const RemovalPaths &removal_paths);
 
 // sample a removal path uniformly from all paths and return total path count
 double sample_arg_removal_path_uniform(const LocalTrees *trees, int *path);
+double sample_arg_removal_path_uniform(const LocalTrees *trees,
+                                       const RemovalPaths &removal_paths,
+                                       int *path);
 
 // count total number of removal paths
 double count_total_arg_removal_paths(const LocalTrees *trees);
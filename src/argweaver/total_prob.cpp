@@ -8,6 +8,7 @@
 #include "emit.h"
 #include "local_tree.h"
 #include "sequences.h"
+#include "total_prob.h"
 #include "trans.h"
 
 
@@ -16,91 +17,125 @@ using namespace std;
 namespace argweaver {
 
 
+//=============================================================================
+// ARG likelihood
+
+
+// Returns the log likelihood of the block [start, end) of a local tree.
+// With a sites mapping, trees should be uncompressed and sequences
+// compressed.
+static double calc_block_likelihood(
+    const ArgModel *model, const Sequences *sequences,
+    const LocalTrees *trees, const LocalTree *tree, int start, int end,
+    const SitesMapping* sites_mapping)
+{
+    const int nseqs = sequences->get_num_seqs();
+    char *seqs[nseqs];
+
+    if (!sites_mapping) {
+        for (int j=0; j<nseqs; j++)
+            seqs[j] = sequences->seqs[trees->seqids[j]];
+        return likelihood_tree(tree, model, seqs, nseqs, start, end);
+    }
+
+    // get sequences for trees
+    const int blocklen = end - start;
+    const char default_char = 'A';
+    char *matrix = new char [blocklen*nseqs];
+    for (int j=0; j<nseqs; j++)
+        seqs[j] = &matrix[j*blocklen];
+
+    // find first site within this block
+    unsigned int i2 = 0;
+
+    // copy sites into new alignment
+    for (int i=start; i<end; i++) {
+        while (i2 < sites_mapping->all_sites.size() &&
+               sites_mapping->all_sites[i2] < i)
+            i2++;
+        if (i2 < sites_mapping->all_sites.size() &&
+            i == sites_mapping->all_sites[i2]) {
+            // copy site
+            for (int j=0; j<nseqs; j++)
+                seqs[j][i-start] = sequences->seqs[trees->seqids[j]][i2];
+        } else {
+            // copy non-variant site
+            for (int j=0; j<nseqs; j++)
+                seqs[j][i-start] = default_char;
+        }
+    }
+
+    double lnl = likelihood_tree(tree, model, seqs, nseqs, 0, blocklen);
+    delete [] matrix;
+    return lnl;
+}
+
+
 double calc_arg_likelihood(const ArgModel *model, const Sequences *sequences,
                            const LocalTrees *trees)
+{
+    return calc_arg_likelihood(model, sequences, trees, NULL);
+}
+
+
+// NOTE: trees should be uncompressed and sequences compressed
+double calc_arg_likelihood(const ArgModel *model, const Sequences *sequences,
+                           const LocalTrees *trees,
+                           const SitesMapping* sites_mapping)
 {
     double lnl = 0.0;
-    int nseqs = sequences->get_num_seqs();
 
     // special case for truck genealogies
     if (trees->nnodes < 3)
         return lnl += log(.25) * sequences->length();
 
-    // get sequences for trees
-    char *seqs[nseqs];
-    for (int j=0; j<nseqs; j++)
-        seqs[j] = sequences->seqs[trees->seqids[j]];
-
     int end = trees->start_coord;
     for (LocalTrees::const_iterator it=trees->begin(); it!=trees->end(); ++it) {
         int start = end;
         end = start + it->blocklen;
-        LocalTree *tree = it->tree;
-
-        lnl += likelihood_tree(tree, model, seqs, nseqs, start, end);
+        lnl += calc_block_likelihood(model, sequences, trees, it->tree,
+                                     start, end, sites_mapping);
     }
 
     return lnl;
 }
 
 
-// NOTE: trees should be uncompressed and sequences compressed
-double calc_arg_likelihood(const ArgModel *model, const Sequences *sequences,
-                           const LocalTrees *trees,
-                           const SitesMapping* sites_mapping)
+// calculate the likelihood of an ARG, reusing the likelihoods of blocks
+// that are unchanged since the last call
+double calc_arg_likelihood_cached(const ArgModel *model,
+                                  const Sequences *sequences,
+                                  LocalTrees *trees,
+                                  const SitesMapping* sites_mapping)
 {
-    if (!sites_mapping)
-        return calc_arg_likelihood(model, sequences, trees);
-
     double lnl = 0.0;
-    int nseqs = sequences->get_num_seqs();
-    const char default_char = 'A';
 
     // special case for truck genealogies
     if (trees->nnodes < 3)
         return lnl += log(.25) * sequences->length();
 
     int end = trees->start_coord;
-    for (LocalTrees::const_iterator it=trees->begin(); it!=trees->end(); ++it) {
+    for (LocalTrees::iterator it=trees->begin(); it!=trees->end(); ++it) {
         int start = end;
-        int blocklen = it->blocklen;
-        end = start + blocklen;
-        LocalTree *tree = it->tree;
+        end = start + it->blocklen;
 
-        // get sequences for trees
-        char *seqs[nseqs];
-        char *matrix = new char [blocklen*nseqs];
-        for (int j=0; j<nseqs; j++)
-            seqs[j] = &matrix[j*blocklen];
-
-        // find first site within this block
-        unsigned int i2 = 0;
-
-        // copy sites into new alignment
-        for (int i=start; i<end; i++) {
-            while (i2 < sites_mapping->all_sites.size() &&
-                   sites_mapping->all_sites[i2] < i)
-                i2++;
-            if (i2 < sites_mapping->all_sites.size() &&
-                i == sites_mapping->all_sites[i2]) {
-                // copy site
-                for (int j=0; j<nseqs; j++)
-                    seqs[j][i-start] = sequences->seqs[trees->seqids[j]][i2];
-            } else {
-                // copy non-variant site
-                for (int j=0; j<nseqs; j++)
-                    seqs[j][i-start] = default_char;
-            }
+        // blocks also change when their neighbors are split or merged
+        if (!it->likelihood_valid || it->likelihood_start != start ||
+            it->likelihood_end != end) {
+            it->likelihood = calc_block_likelihood(
+                model, sequences, trees, it->tree, start, end,
+                sites_mapping);
+            it->likelihood_start = start;
+            it->likelihood_end = end;
+            it->likelihood_valid = true;
         }
-
-        lnl += likelihood_tree(tree, model, seqs, nseqs, 0, end-start);
-
-        delete [] matrix;
+        lnl += it->likelihood;
     }
 
     return lnl;
 }
 
+
 //=============================================================================
 // ARG prior
 
@@ -299,6 +334,60 @@ double calc_arg_prior(const ArgModel *model, const LocalTrees *trees)
 }
 
 
+// calculate the probability of an ARG given the model parameters, reusing
+// the terms of unchanged blocks
+double calc_arg_prior_cached(const ArgModel *model, LocalTrees *trees)
+{
+    double lnl = 0.0;
+    LineageCounts lineages(model->ntimes);
+
+    // previous block, if it ends with a recombination
+    LocalTrees::iterator last = trees->end();
+    bool last_valid = false;
+
+    int end = trees->start_coord;
+    for (LocalTrees::iterator it=trees->begin(); it != trees->end(); ++it) {
+        end += it->blocklen;
+        const bool valid = it->prior_valid;
+
+        // probability of the SPR from the previous tree
+        if (last != trees->end()) {
+            if (!valid || !last_valid)
+                it->prior_spr_lnl = calc_spr_prob(
+                    model, last->tree, it->spr, lineages,
+                    last->prior_treelen);
+            lnl += it->prior_spr_lnl;
+        }
+
+        if (!valid)
+            it->prior_treelen = get_treelen(it->tree, model->times,
+                                            model->ntimes, false);
+
+        // calculate probability P(blocklen | T_{i-1})
+        double recomb_rate = max(model->rho * it->prior_treelen, model->rho);
+
+        // a block without an SPR term is not cached, since it gains one
+        // if a block is joined in front of it
+        it->prior_valid = (last != trees->end());
+        last_valid = valid;
+
+        if (end < trees->end_coord) {
+            // not last block
+            // probability of recombining after blocklen
+            lnl += log(recomb_rate) - recomb_rate * it->blocklen;
+            last = it;
+        } else {
+            // last block
+            // probability of not recombining after blocklen
+            lnl += - recomb_rate * it->blocklen;
+            last = trees->end();
+        }
+    }
+
+    return lnl;
+}
+
+
 // calculate the probability of the sequences given an ARG
 double calc_arg_joint_prob(const ArgModel *model, const Sequences *sequences,
                            const LocalTrees *trees)
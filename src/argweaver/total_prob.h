@@ -22,7 +22,22 @@ double calc_arg_likelihood(const ArgModel *model, const Sequences *sequences,
                            const LocalTrees *trees,
                            const SitesMapping* sites_mapping);
 
+// Same value as calc_arg_likelihood(), but the likelihoods of blocks that
+// have not changed since the last call are taken from the blocks (see
+// LocalTreeSpr::invalidate_cache).
+// NOTE: cached likelihoods are only valid for one model and alignment
+double calc_arg_likelihood_cached(const ArgModel *model,
+                                  const Sequences *sequences,
+                                  LocalTrees *trees,
+                                  const SitesMapping* sites_mapping=NULL);
+
 double calc_arg_prior(const ArgModel *model, const LocalTrees *trees);
+
+// Same value as calc_arg_prior(), but the tree lengths and SPR
+// probabilities of blocks that have not changed since the last call are
+// taken from the blocks (see LocalTreeSpr::invalidate_cache).
+// NOTE: cached terms are only valid for one model
+double calc_arg_prior_cached(const ArgModel *model, LocalTrees *trees);
 double calc_arg_joint_prob(const ArgModel *model, const Sequences *sequences,
                            const LocalTrees *trees);
 
@@ -94,26 +94,45 @@ public:
 
     // Returns value of region containing position pos
     T find(int pos, const T &default_value) const {
-        for (unsigned int i=0; i<Track<T>::size(); i++) {
-            const RegionValue<T> &region = Track<T>::at(i);
-            if (region.start <= pos && pos < region.end)
-                return region.value;
-        }
-        // region not found
-        return default_value;
+        const int i = index(pos);
+        if (i == -1)
+            return default_value;
+        return Track<T>::at(i).value;
     }
 
     // Returns index of region containing position pos
+    //
+    // Returns -1 if no region contains pos.
+    // NOTE: regions must be sorted by start and non-overlapping, as
+    // required of map files (see complete_map)
     int index(int pos) const {
-        for (unsigned int i=0; i<Track<T>::size(); i++) {
-            const RegionValue<T> &region = Track<T>::at(i);
-            if (region.start <= pos && pos < region.end)
-                return i;
-        }
+        const int i = search(pos);
+        if (contains(i, pos))
+            return i;
         // region not found
         return -1;
     }
 
+    // Returns index of region containing position pos, starting the search
+    // at region 'hint'.  Positions near the hint are found in constant time,
+    // which makes monotone scans linear overall.
+    int index(int pos, int hint) const {
+        if (contains(hint, pos))
+            return hint;
+        if (contains(hint + 1, pos))
+            return hint + 1;
+        if (contains(hint - 1, pos))
+            return hint - 1;
+        return index(pos);
+    }
+
+    // Returns true if region i exists and contains position pos
+    bool contains(int i, int pos) const {
+        if (i < 0 || i >= int(Track<T>::size()))
+            return false;
+        const RegionValue<T> &region = Track<T>::at(i);
+        return region.start <= pos && pos < region.end;
+    }
     // Adds one region to the track
     void append(string chrom, int start, int end, T value) {
         this->push_back(RegionValue<T>(chrom, start, end, value));
@@ -131,6 +150,55 @@ public:
         append(chrom, start, end, value);
         return true;
     }
+
+protected:
+    // Returns the index of the last region with start <= pos, or -1
+    // NOTE: assumes regions are sorted by start
+    int search(int pos) const {
+        int low = 0, high = Track<T>::size();
+        while (low < high) {
+            const int mid = (low + high) / 2;
+            if (Track<T>::at(mid).start <= pos)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        return low - 1;
+    }
+};
+
+
+// A cursor for looking up regions of a track at a sequence of positions.
+//
+// The cursor remembers the last region found, so that lookups at
+// increasing (or decreasing) positions cost O(1) amortized.
+template <class T>
+class TrackCursor {
+public:
+    TrackCursor(const Track<T> &track) :
+        track(track),
+        current(0)
+    {}
+
+    // Returns index of region containing position pos
+    int index(int pos) {
+        const int i = track.index(pos, current);
+        if (i != -1)
+            current = i;
+        return i;
+    }
+
+    // Returns value of region containing position pos
+    T find(int pos, const T &default_value) {
+        const int i = index(pos);
+        if (i == -1)
+            return default_value;
+        return track[i].value;
+    }
+
+protected:
+    const Track<T> &track;
+    int current;
 };
 
 
@@ -112,6 +112,49 @@ void calc_transition_probs(const LocalTree *tree, const ArgModel *model,
         matrix->norecombs[b] = exp(-max(rho * treelen2, rho));
     }
     matrix->E[ntimes-2] = 1.0 / ncoals[ntimes-2];
+
+    matrix->expand();
+}
+
+
+// Fills the expanded tables of the transition matrix
+//
+// The tables hold the terms of get_time_direct() in the same arithmetic
+// order, so table lookups give identical probabilities.
+void TransMatrix::expand()
+{
+    const int n = ntimes - 1;
+
+    fill(diff_kernel, diff_kernel + ntimes * ntimes, 0.0);
+    fill(same_kernel, same_kernel + ntimes * ntimes, 0.0);
+    fill(c_terms, c_terms + ntimes * ntimes, 0.0);
+    fill(minage_terms, minage_terms + ntimes, 0.0);
+
+    for (int b=0; b<n; b++) {
+        if (minage > 0)
+            minage_terms[b] = exp(lnG4[b] + lnB[minage-1]);
+        for (int c=1; c<ntimes; c++)
+            c_terms[b*ntimes + c] = exp(lnG4[b] + lnB[c-1]);
+    }
+
+    for (int a=0; a<n; a++) {
+        for (int b=0; b<n; b++) {
+            double kernel;
+            if (a < b)
+                kernel = exp(lnE2[b] + lnB[a]) - exp(lnE2[b] + lnNegG1[a]);
+            else if (a == b)
+                kernel = (b > 0 ? exp(lnE2[b] + lnB[b-1]) : 0.0) + G3[b];
+            else
+                kernel = (b > 0 ? exp(lnE2[b] + lnB[b-1]) : 0.0) + G2[b];
+
+            const int ab = a * ntimes + b;
+            same_kernel[ab] = 2 * kernel;
+            if (a >= minage && b >= minage)
+                diff_kernel[ab] = D[a] * E[b] * (kernel - minage_terms[b]);
+        }
+    }
+
+    expanded = true;
 }
 
 
@@ -440,6 +483,28 @@ void calc_recoal_sums(const ArgModel *model, const LineageCounts *lineages,
 }
 
 
+// Calculates the running sums over half time steps m >= 2k of the rate of
+// not coalescing, for a lineage that recombined at time k from state time
+// 'a'.  sums[m] is the sum over [2k, m), which is the same value (in the
+// same order of additions) as the sum in calc_recomb_recoal() for a
+// coalescence at time (m+1)/2.
+static void calc_recomb_recoal_sums(
+    const ArgModel *model, const LineageCounts *lineages, int k, int a,
+    int recomb_parent_age, double *sums)
+{
+    const int *nbranches = lineages->nbranches;
+    double sum = 0.0;
+    sums[2*k] = sum;
+    for (int m=2*k; m<2*model->ntimes-3; m++) {
+        int nbranches_m = nbranches[m/2] - int(m/2<recomb_parent_age)
+            + int(m/2 < a);
+        sum += model->coal_time_steps[m] * nbranches_m /
+            (2.0 * model->popsizes[m/2]);
+        sums[m+1] = sum;
+    }
+}
+
+
 double calc_recoal(
     const LocalTree *last_tree, const ArgModel *model,
     const LineageCounts *lineages,
@@ -620,15 +685,29 @@ void calc_transition_probs_switch(
         recoals[a] = calc_recoal(last_tree, model, lineages, spr,
                                  a, recomb_parent_age, last_treelen);
 
+    // For states above the recombination on its branch, the recombination
+    // parent is the state itself, so the rate of not coalescing before
+    // the coal time does not depend on the state and is computed once.
+    const int nsums = 2*model->ntimes;
+    double recomb_branch_sums[nsums];
+    calc_recomb_recoal_sums(model, lineages, spr.recomb_time, 0, 0,
+                            recomb_branch_sums);
+    const double recomb_branch_sum = (2*spr.coal_time-1 > 2*spr.recomb_time ?
+        recomb_branch_sums[2*spr.coal_time-1] : 0.0);
+
     for (int i=0; i<nstates1; i++) {
         int j = transmat_switch->determ[i];
         if (j >= 0) {
             if (states1[i].node == spr.recomb_node &&
                 states1[i].time > spr.recomb_time) {
                 recomb_parent_age = states1[i].time;
-                transmat_switch->determprob[i] =
-                calc_recomb_recoal(last_tree, model, lineages, spr,
+                double p = calc_recomb(last_tree, model, lineages, spr,
                     states1[i], recomb_parent_age, last_treelen, internal);
+                p *= exp(-recomb_branch_sum);
+                p *= calc_recoal(last_tree, model, lineages, spr,
+                    states1[i].time, recomb_parent_age, last_treelen,
+                    internal);
+                transmat_switch->determprob[i] = p;
             } else {
                 recomb_parent_age = last_tree->nodes[
                     last_tree->nodes[spr.recomb_node].parent].age;
@@ -717,6 +796,14 @@ void calc_transition_probs_switch(
     int parent = tree->nodes[mapping[spr.recomb_node]].parent;
     assert(parent == tree->nodes[node3].parent);
 
+    // all entries of the row share the sums of not coalescing, up to
+    // their coal time
+    recomb_parent_age = last_tree->nodes[last_tree->nodes[spr.recomb_node].parent].age;
+    const int nsums2 = 2*model->ntimes;
+    double recoal_sums[nsums2];
+    calc_recomb_recoal_sums(model, lineages, spr.recomb_time, time1,
+                            recomb_parent_age, recoal_sums);
+
     for (int j=0; j<nstates2; j++) {
         const int node2 = states2[j].node;
         const int time2 = states2[j].time;
@@ -729,12 +816,16 @@ void calc_transition_probs_switch(
             // not a probabilistic transition
             continue;
 
-        recomb_parent_age = last_tree->nodes[last_tree->nodes[spr.recomb_node].parent].age;
         Spr spr2 = spr;
         spr2.coal_time = time2;
-        transmat_switch->recoalrow[j] = calc_recomb_recoal(
-            last_tree, model, lineages, spr2, states1[recoalsrc],
-            recomb_parent_age, last_treelen, internal);
+        double p = calc_recomb(last_tree, model, lineages, spr2,
+                               states1[recoalsrc], recomb_parent_age,
+                               last_treelen, internal);
+        p *= exp(-(2*time2-1 > 2*spr.recomb_time ?
+                   recoal_sums[2*time2-1] : 0.0));
+        p *= calc_recoal(last_tree, model, lineages, spr2, time1,
+                         recomb_parent_age, last_treelen, internal);
+        transmat_switch->recoalrow[j] = p;
     }
 }
 
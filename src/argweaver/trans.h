@@ -23,7 +23,9 @@ public:
         ntimes(ntimes),
         nstates(nstates),
         own_data(false),
-        internal(false)
+        expanded(false),
+        internal(false),
+        minage(0)
     {
         if (alloc)
             allocate(ntimes);
@@ -31,35 +33,37 @@ public:
 
     ~TransMatrix()
     {
-        if (own_data) {
+        if (own_data)
             delete [] D;
-            delete [] E;
-            delete [] lnB;
-            delete [] lnE2;
-            delete [] lnNegG1;
-            delete [] G2;
-            delete [] G3;
-            delete [] lnG4;
-            delete [] norecombs;
-        }
     }
 
     // allocate space for transition matrix
+    // All terms and expanded tables share one allocation.
     void allocate(int _ntimes)
     {
         ntimes = _ntimes;
         own_data = true;
-        D = new double [ntimes];
-        E = new double [ntimes];
-        lnB = new double [ntimes];
-        lnE2 = new double [ntimes];
-        lnNegG1 = new double [ntimes];
-        G2 = new double [ntimes];
-        G3 = new double [ntimes];
-        lnG4 = new double [ntimes];
-        norecombs = new double [ntimes];
+        expanded = false;
+        const int ntimes2 = ntimes * ntimes;
+        D = new double [(NTERMS + 1) * ntimes + 3 * ntimes2];
+        E = &D[ntimes];
+        lnB = &D[2*ntimes];
+        lnE2 = &D[3*ntimes];
+        lnNegG1 = &D[4*ntimes];
+        G2 = &D[5*ntimes];
+        G3 = &D[6*ntimes];
+        lnG4 = &D[7*ntimes];
+        norecombs = &D[8*ntimes];
+        minage_terms = &D[NTERMS*ntimes];
+        diff_kernel = &D[(NTERMS+1)*ntimes];
+        same_kernel = &diff_kernel[ntimes2];
+        c_terms = &same_kernel[ntimes2];
     }
 
+    // Fills the expanded tables from the per-time terms, so that get_time()
+    // becomes table lookups for this matrix's minage.
+    void expand();
+
     // Probability of transition from state i to state j.
     inline double get(
         const LocalTree *tree, const States &states, int i, int j) const
@@ -88,6 +92,24 @@ public:
     // a minimum age ('minage') allowed for the state.
     inline double get_time(int a, int b, int c,
                            int minage, bool same_node) const
+    {
+        if (!expanded || minage != this->minage)
+            return get_time_direct(a, b, c, minage, same_node);
+
+        if (a < minage || b < minage)
+            return 0.0;
+        const int ab = a * ntimes + b;
+        if (!same_node)
+            return diff_kernel[ab];
+        const double p = D[a] * E[b] * (same_kernel[ab] -
+                                        c_terms[b * ntimes + c] -
+                                        minage_terms[b]);
+        return (a == b) ? p + norecombs[a] : p;
+    }
+
+    // Same as get_time(), but computed directly from the per-time terms.
+    inline double get_time_direct(int a, int b, int c,
+                                  int minage, bool same_node) const
     {
         if (a < minage || b < minage)
             return 0.0;
@@ -135,6 +157,8 @@ public:
     }
 
 
+    static const int NTERMS = 9;  // Number of per-time terms stored
+
     int ntimes;     // Number of time steps in model.
     int nstates;    // Number of states in HMM.
     bool own_data;  // If true, delete matrix data when object is deleted
@@ -149,6 +173,13 @@ public:
     double *lnG4;
     double *norecombs;
 
+    // Expanded tables (ntimes x ntimes, indexed [a*ntimes + b])
+    bool expanded;        // If true, expanded tables are filled in
+    double *diff_kernel;  // get_time(a, b, *, minage, false)
+    double *same_kernel;  // Time-dependent part of same node transitions
+    double *c_terms;      // Node age terms, indexed [b*ntimes + c]
+    double *minage_terms; // Minimum age term for each time b
+
     bool internal;  // If true, this matrix is for threading an internal branch.
     int minage;     // Minimum age of a state we can consider (due to threading
                     // an internal branch).
@@ -176,8 +207,6 @@ public:
         if (own_data) {
             delete [] determ;
             delete [] determprob;
-            delete [] recoalrow;
-            delete [] recombrow;
         }
     }
 
@@ -190,11 +219,14 @@ public:
         // NOTE: nstates1 and nstates2 might be zero
         // we still calculate transitions for a state space of size zero
 
+        // all probability rows share one allocation
         own_data = true;
-        determ = new int [max(nstates1, 1)];
-        determprob = new double [max(nstates1, 1)];
-        recoalrow = new double [max(nstates2, 1)];
-        recombrow = new double [max(nstates2, 1)];
+        const int n1 = max(nstates1, 1);
+        const int n2 = max(nstates2, 1);
+        determ = new int [n1];
+        determprob = new double [n1 + 2*n2];
+        recoalrow = &determprob[n1];
+        recombrow = &determprob[n1 + n2];
     }
 
     // Log probability of transition from state i to state j.
@@ -0,0 +1,137 @@
+#include "getopt.h"
+#include <set>
+
+// argweaver includes
+#include "argweaver/compress.h"
+#include "argweaver/local_tree.h"
+#include "argweaver/logging.h"
+#include "argweaver/parsing.h"
+
+
+using namespace argweaver;
+
+void print_usage() {
+    printf("smc2argb: This program converts an smc file into the indexed\n"
+           "  binary ARG format (*.argb).  Binary ARG files store each\n"
+           "  local tree as an SPR applied to the previous tree, with a\n"
+           "  whole tree at regular intervals and an index of their\n"
+           "  coordinates for random access.  Use argb2smc to convert back.\n\n");
+    printf("Usage: ./smc2argb [OPTIONS] <smc-file> <argb-file>\n"
+           "  smc-file can be gzipped\n"
+           " OPTIONS:\n"
+           " --times <times.txt>\n"
+           "   File giving the discrete times used.  By default the times\n"
+           "   are collected from the node ages and SPRs of the smc file.\n");
+}
+
+
+// Collect all time points that appear in an smc file
+bool scan_smc_times(const char *filename, vector<double> &times)
+{
+    CompressStream stream(filename, "r");
+    if (!stream.stream) {
+        printError("cannot read '%s'", filename);
+        return false;
+    }
+
+    set<double> times2;
+    char *line;
+    while ((line = fgetline(stream.stream))) {
+        if (strncmp(line, "TREE", 4) == 0) {
+            double t;
+            for (char *p = strstr(line, "age="); p; p = strstr(p, "age=")) {
+                p += 4;
+                if (sscanf(p, "%lf", &t) == 1)
+                    times2.insert(t);
+            }
+        } else if (strncmp(line, "SPR", 3) == 0) {
+            int pos, recomb_node, coal_node;
+            double recomb_time, coal_time;
+            if (sscanf(&line[4], "%d\t%d\t%lf\t%d\t%lf",
+                       &pos, &recomb_node, &recomb_time,
+                       &coal_node, &coal_time) == 5) {
+                times2.insert(recomb_time);
+                times2.insert(coal_time);
+            }
+        }
+        delete [] line;
+    }
+
+    times.assign(times2.begin(), times2.end());
+    return true;
+}
+
+
+int main(int argc, char *argv[]) {
+    char c;
+    int opt_idx;
+    char *timesfile = NULL;
+    vector<double> times;
+    struct option long_opts[] = {
+        {"times", 1, 0, 't'},
+        {"help", 0, 0, 'h'},
+        {0,0,0,0}};
+    while ((c = (char)getopt_long(argc, argv, "t:h", long_opts, &opt_idx))
+           != -1) {
+        switch (c) {
+        case 't':
+            timesfile = optarg;
+            break;
+        case 'h':
+            print_usage();
+            return 0;
+        case '?':
+            fprintf(stderr, "unknown option. Try --help\n");
+            return 1;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "Bad arguments. Try --help\n");
+        return 1;
+    }
+    const char *smc_file = argv[optind];
+    const char *argb_file = argv[optind + 1];
+
+    // get time points
+    if (timesfile != NULL) {
+        FILE *infile = fopen(timesfile, "r");
+        double t;
+        if (infile == NULL) {
+            fprintf(stderr, "Error opening %s.\n", timesfile);
+            return 1;
+        }
+        while (fscanf(infile, "%lf", &t) == 1)
+            times.push_back(t);
+        std::sort(times.begin(), times.end());
+        fclose(infile);
+    } else if (!scan_smc_times(smc_file, times)) {
+        return 1;
+    }
+    if (times.size() == 0) {
+        fprintf(stderr, "error: no time points found\n");
+        return 1;
+    }
+
+    // read ARG
+    LocalTrees trees;
+    vector<string> seqnames;
+    CompressStream instream(smc_file, "r");
+    if (!instream.stream ||
+        !read_local_trees(instream.stream, &times[0], times.size(),
+                          &trees, seqnames)) {
+        fprintf(stderr, "error: could not read '%s'\n", smc_file);
+        return 1;
+    }
+    instream.close();
+
+    // write binary ARG
+    vector<const char*> names;
+    for (unsigned int i=0; i<seqnames.size(); i++)
+        names.push_back(seqnames[i].c_str());
+    if (!write_local_trees_binary(argb_file, &trees,
+                                  names.size() ? &names[0] : NULL,
+                                  &times[0], times.size()))
+        return 1;
+
+    return 0;
+}
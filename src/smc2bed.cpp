@@ -2,8 +2,10 @@
 #include <iostream>
 #include <fstream>
 #include <assert.h>
+#include <queue>
 
 // argweaver includes
+#include "argweaver/bgzf.h"
 #include "argweaver/Tree.h"
 #include "argweaver/compress.h"
 #include "argweaver/parsing.h"
@@ -13,23 +15,28 @@ using namespace spidir;
 using namespace argweaver;
 
 void print_usage() {
-    printf("smc2bed: This program converts a single smc file into a\n"
-           "  bed file. The bed file format is chrom,start,end,sample,tree.\n"
+    printf("smc2bed: This program converts smc files into a bed file.\n"
+           "  The bed file format is chrom,start,end,sample,tree.\n"
            "  The tree nodes are labelled with NHX-style comments indicating\n"
            "  the nodes and times of the recombination event which leads to\n"
            "  the next tree.\n\n"
-           "This program is intended for use combining multiple SMC files\n"
-           "  from different MCMC samples; the pipeline for doing this is to\n"
-           "  run smc2bed on each file, piping the results to sort-bed, then\n"
-           "  bgzip. The resulting file can be indexed using tabix.\n\n");
-    printf("Usage: ./smc2bed [OPTIONS] <smc-file>\n"
-           "  smc-file can be gzipped\n"
+           "This program is intended for combining multiple SMC files\n"
+           "  from different MCMC samples. Given several files, their trees\n"
+           "  are merged in sorted order. With --output, the result is\n"
+           "  written with bgzip compression together with a tabix index,\n"
+           "  ready for arg-summarize.\n\n");
+    printf("Usage: ./smc2bed [OPTIONS] <smc-file> [<smc-file> ...]\n"
+           "  smc-files can be gzipped\n"
            " OPTIONS:\n"
            " --region START-END\n"
            "   Process only these coordinates (1-based)\n"
            " --sample <sample>\n"
-           "   Give the sample number for this file; this is important\n"
-           "   when combining multiple smc files.\n"
+           "   Give the sample number for a single file. With several\n"
+           "   files, sample numbers are taken from file names of the\n"
+           "   form <prefix>.<sample>.smc[.gz].\n"
+           " --output <out.bed.gz>\n"
+           "   Write bgzip-compressed output and its tabix index\n"
+           "   (<out.bed.gz>.tbi) instead of printing to stdout\n"
 	   " --times <times.txt>\n"
 	   "   File giving the discrete times used; will help avoid"
            "   rounding error\n"
@@ -37,29 +44,269 @@ void print_usage() {
 }
 
 
+// Returns the sample number in a file name of the form
+// <prefix>.<sample>.smc[.gz], or -1 if there is none
+int get_sample_from_filename(const char *filename) {
+    string name = filename;
+    size_t end = name.rfind(".smc");
+    if (end == string::npos)
+        return -1;
+    size_t start = name.rfind('.', end - 1);
+    if (start == string::npos || start + 1 == end)
+        return -1;
+    for (size_t i=start+1; i<end; i++) {
+        if (!isdigit(name[i]))
+            return -1;
+    }
+    return atoi(name.substr(start + 1, end - start - 1).c_str());
+}
+
+
+// Reads the local trees of an SMC file as bed lines
+class SmcBedReader {
+public:
+    SmcBedReader(const char *filename, int sample, const int *region,
+                 const vector<double> &times) :
+        sample(sample), error(false), done(false), region(region),
+        times(times), tree(NULL), spr(NULL), instream(filename, "r") {
+        fprintf(stderr, "opening %s\n", filename);
+        if (instream.stream == NULL) {
+            fprintf(stderr, "error opening %s\n", filename);
+            error = true;
+            return;
+        }
+        char *line = fgetline(instream.stream);
+        if (line == NULL || strncmp(line, "NAMES", 5) != 0) {
+            fprintf(stderr,
+                    "error: Expected first line of input to be NAMES\n");
+            error = true;
+            delete [] line;
+            return;
+        }
+        chomp(line);
+        split(&line[6], "\t", names);
+        delete [] line;
+        line = fgetline(instream.stream);
+        if (line == NULL || strncmp(line, "REGION", 6) != 0) {
+            fprintf(stderr,
+                    "error: Expected second line of input to be REGION\n");
+            error = true;
+            delete [] line;
+            return;
+        }
+        chomp(line);
+        if (sscanf(&line[7], "%1000s\t%d\t%d", chrom, &orig_start,
+                   &orig_end) != 3) {
+            fprintf(stderr, "error parsing REGION string in second line\n");
+            error = true;
+        }
+        delete [] line;
+    }
+    ~SmcBedReader() {
+        if (tree != NULL) delete tree;
+        if (spr != NULL) delete spr;
+        instream.close();
+    }
+
+    // Moves to the next tree.  Returns false at the end of the file or on
+    // error.
+    bool next() {
+        char *line;
+        if (done || error)
+            return false;
+        while ((line = fgetline(instream.stream))) {
+            chomp(line);
+            if (strncmp(line, "TREE", 4)==0) {
+                int result = read_tree(line);
+                if (result == TREE_SKIPPED)
+                    continue;
+                if (result == TREE_END)
+                    done = true;
+                return result == TREE_READ;
+            }
+            delete [] line;
+        }
+        done = true;
+        return false;
+    }
+
+    int sample;
+    char chrom[1001];
+    int start;
+    int end;
+    string newick;  // tree of the current line
+    bool error;
+
+protected:
+    enum { TREE_READ, TREE_SKIPPED, TREE_END };
+
+    // Reads a TREE line and the SPR line after it.  Returns TREE_SKIPPED
+    // for trees before the region and TREE_END at the end of the region or
+    // on error.
+    int read_tree(char *line) {
+        int recomb_node=-1, coal_node=-1;
+
+        if (2 != sscanf(&line[5], "%d\t%d", &start, &end)) {
+            fprintf(stderr, "error processing TREE line\n");
+            error = true;
+            delete [] line;
+            return TREE_END;
+        }
+        start--;  //0-based
+        if (region[1] >= 0 && start >= region[1]) {
+            delete [] line;
+            return TREE_END;
+        }
+        if (region[0] >= 0 && end <= region[0]) {
+            delete [] line;
+            line = fgetline(instream.stream);
+            if (line==NULL) return TREE_END;
+            if (strncmp(line, "SPR", 3)==0) {
+                delete [] line;
+                return TREE_SKIPPED;
+            }
+            fprintf(stderr, "error: expected SPR after TREE line\n");
+            error = true;
+            delete [] line;
+            return TREE_END;
+        }
+
+        char *newick_end = line + strlen(line);
+        char *newick_str = find(line+5, newick_end, '\t')+1;
+        newick_str = find(newick_str, newick_end, '\t')+1;
+        if (tree == NULL || spr->recomb_node == NULL) {
+            if (tree != NULL) delete tree;
+            if (spr != NULL) delete spr;
+            tree = new Tree(string(newick_str), times);
+            spr = new NodeSpr(tree, newick_str, times);
+
+            //have to rename all leaf nodes and remove NHX comments
+            for (int i=0; i < tree->nnodes; i++) {
+                int nodenum = atoi(tree->nodes[i]->longname.c_str());
+                if (tree->nodes[i]->nchildren == 0) {
+                    assert(nodenum >= 0 &&
+                           (unsigned int)nodenum < names.size());
+                    tree->nodes[i]->longname = names[nodenum];
+                }
+            }
+        } else {
+            tree->apply_spr(spr);
+        }
+        delete [] line;
+
+        line=fgetline(instream.stream);
+        if (line == NULL) {
+            spr->recomb_node = NULL;
+            spr->coal_node = NULL;
+            done = true;
+        } else if (strncmp(line, "SPR", 3)==0) {
+            int tempend;
+            if (5 != sscanf(&line[4], "%d\t%d\t%lf\t%d\t%lf",
+                            &tempend, &recomb_node, &(spr->recomb_time),
+                            &coal_node, &(spr->coal_time))) {
+                fprintf(stderr, "error parsing SPR line\n");
+                error = true;
+                delete [] line;
+                return TREE_END;
+            }
+            if (tempend != end) {
+                fprintf(stderr, "error: SPR pos does not equal TREE end\n");
+                error = true;
+                delete [] line;
+                return TREE_END;
+            }
+            if (region[1] >= 0 && tempend >= region[1]) {
+                coal_node = -1;
+                recomb_node = -1;
+            }
+            delete [] line;
+        } else {
+            fprintf(stderr, "error: expected SPR after TREE line\n");
+            error = true;
+            delete [] line;
+            return TREE_END;
+        }
+
+        //now have to rename all leaf nodes and remove all NHX comments
+        char tmpStr[1000];
+        if (recomb_node >= 0) {
+            sprintf(tmpStr, "%i", recomb_node);
+            spr->recomb_node =
+                tree->nodes[tree->nodename_map[string(tmpStr)]];
+            sprintf(tmpStr, "%i", coal_node);
+            spr->coal_node = tree->nodes[tree->nodename_map[string(tmpStr)]];
+
+            if (spr->recomb_node->age-1 > spr->recomb_time)
+                assert(0);
+            if (spr->recomb_node != tree->root) {
+                if (spr->recomb_node->parent->age+1 < spr->recomb_time)
+                    assert(0);
+            }
+            if (spr->coal_node->age-1 > spr->coal_time)
+                assert(0);
+            if (spr->coal_node != tree->root) {
+                if (spr->coal_node->parent->age+1 < spr->coal_time) {
+                    assert(0);
+                }
+            }
+            if (times.size() > 0) spr->correct_recomb_times(times);
+        }
+        if (region[0] >= 0 && start < region[0])
+            start = region[0];
+        if (region[1] >= 0 && end >= region[1]) {
+            end = region[1];
+            spr->recomb_node = spr->coal_node = NULL;
+        }
+        newick = tree->format_newick(false, true, 1, spr);
+        return TREE_READ;
+    }
+
+    bool done;
+    const int *region;
+    const vector<double> &times;
+    vector<string> names;
+    int orig_start;
+    int orig_end;
+    Tree *tree;
+    NodeSpr *spr;
+    CompressStream instream;
+};
+
+
+// Orders readers by their current line, so that a priority queue returns
+// the first line in sorted bed order
+struct CompareReaders
+{
+    bool operator()(const SmcBedReader *r1, const SmcBedReader *r2) const
+    {
+        int cmp = strcmp(r1->chrom, r2->chrom);
+        if (cmp != 0)
+            return cmp > 0;
+        if (r1->start != r2->start)
+            return r1->start > r2->start;
+        if (r1->end != r2->end)
+            return r1->end > r2->end;
+        return r1->sample > r2->sample;
+    }
+};
 
 
 int main(int argc, char *argv[]) {
     char c;
-    int region[2]={-1,-1}, orig_start, orig_end, start, end;
-    vector<string> names;
-    string currstr;
-    char *line = NULL;
-    char chrom[1000];
-    char *newick=NULL;
-    Tree *tree=NULL;
-    NodeSpr *spr=NULL;
+    int region[2]={-1,-1};
     char *timesfile=NULL;
-    int recomb_node, coal_node, sample=0, opt_idx;
+    char *outfile=NULL;
+    int sample=-1, opt_idx;
     vector<double> times;
     struct option long_opts[] = {
         {"region", 1, 0, 'r'},
         {"sample", 1, 0, 's'},
+        {"output", 1, 0, 'o'},
 	{"times", 1, 0, 't'},
         {"help", 0, 0, 'h'},
         {0,0,0,0}};
-    while ((c = (char)getopt_long(argc, argv, "r:s:t:h", long_opts, &opt_idx))
-           != -1) {
+    while ((c = (char)getopt_long(argc, argv, "r:s:o:t:h", long_opts,
+                                  &opt_idx)) != -1) {
         switch (c) {
         case 'r':
             if (2 != (sscanf(optarg, "%d-%d", &region[0], &region[1]))) {
@@ -71,6 +318,9 @@ int main(int argc, char *argv[]) {
         case 's':
             sample = atoi(optarg);
             break;
+        case 'o':
+            outfile = optarg;
+            break;
 	case 't':
 	    timesfile = optarg;
 	    break;
@@ -82,10 +332,15 @@ int main(int argc, char *argv[]) {
             return 1;
         }
     }
-    if (optind != argc - 1) {
+    if (optind >= argc) {
         fprintf(stderr, "Bad arguments. Try --help\n");
         return 1;
     }
+    const int nfiles = argc - optind;
+    if (sample != -1 && nfiles > 1) {
+        fprintf(stderr, "error: --sample can only be used with one file\n");
+        return 1;
+    }
 
     if (timesfile != NULL) {
 	FILE *infile = fopen(timesfile, "r");
@@ -100,130 +355,81 @@ int main(int argc, char *argv[]) {
 	fclose(infile);
 	//      fprintf(stderr, "read %i times\n", (int)times.size());
     }
-    CompressStream instream(argv[optind], "r");
-    fprintf(stderr, "opening %s\n", argv[optind]);
-    line = fgetline(instream.stream);
-    chomp(line);
-    if (strncmp(line, "NAMES", 5) != 0) {
-        fprintf(stderr, "error: Expected first line of input to be NAMES");
-        return 1;
-    }
-    split(&line[6], "\t", names);
-    line= fgetline(instream.stream);
-    chomp(line);
-    if (strncmp(line, "REGION", 6) != 0) {
-        fprintf(stderr, "error: Expected second line of input to be REGION");
-    }
-    if (sscanf(&line[7], "%1000s\t%d\t%d", chrom, &orig_start, &orig_end) != 3) {
-        fprintf(stderr, "error parsing REGION string in second line\n");
-        return 1;
-    }
-    while ((line = fgetline(instream.stream))) {
-        chomp(line);
-        if (strncmp(line, "TREE", 4)==0) {
-            if (2 != sscanf(&line[5], "%d\t%d", &start, &end)) {
-                fprintf(stderr, "error processing TREE line\n");
-                return 1;
-            }
-            start--;  //0-based
-            if (region[1] >= 0 && start >= region[1])
+
+    // open all files
+    vector<SmcBedReader*> readers;
+    priority_queue<SmcBedReader*, vector<SmcBedReader*>, CompareReaders> queue;
+    int status = 0;
+    for (int i=0; i<nfiles; i++) {
+        const char *filename = argv[optind + i];
+        int file_sample = sample;
+        if (nfiles > 1) {
+            file_sample = get_sample_from_filename(filename);
+            if (file_sample == -1) {
+                fprintf(stderr, "error: cannot find sample number in file"
+                        " name %s\n", filename);
+                status = 1;
                 break;
-            if (region[0] >= 0 && end <= region[0]) {
-                delete [] line;
-                line = fgetline(instream.stream);
-                if (line==NULL) break;
-                if (strncmp(line, "SPR", 3)==0) {
-                    delete [] line;
-                    continue;
-                }
-                fprintf(stderr, "error: expected SPR after TREE line\n");
-                return 1;
             }
+        } else if (file_sample == -1) {
+            file_sample = 0;
+        }
+        SmcBedReader *reader = new SmcBedReader(filename, file_sample,
+                                                region, times);
+        readers.push_back(reader);
+        if (reader->next())
+            queue.push(reader);
+        if (reader->error) {
+            status = 1;
+            break;
+        }
+    }
 
-            char *newick_end = line + strlen(line);
-            newick = find(line+5, newick_end, '\t')+1;
-            newick = find(newick, newick_end, '\t')+1;
-	    if (tree == NULL || spr->recomb_node == NULL) {
-	      if (tree != NULL) delete tree;
-	      tree = new Tree(string(newick), times);
-              spr = new NodeSpr(tree, newick, times);
+    BgzfWriter out;
+    TabixIndexer index;
+    if (status == 0 && outfile != NULL && !out.open(outfile))
+        status = 1;
 
-	      //have to rename all leaf nodes and remove NHX comments
-	      for (int i=0; i < tree->nnodes; i++) {
-                int nodenum = atoi(tree->nodes[i]->longname.c_str());
-                if (tree->nodes[i]->nchildren == 0) {
-		  assert(nodenum >= 0 && (unsigned int)nodenum < names.size());
-		  tree->nodes[i]->longname = names[nodenum];
-                }
-	      }
-	    } else {
-	      tree->apply_spr(spr);
-	    }
-            delete [] line;
+    // merge trees in sorted order
+    while (status == 0 && !queue.empty()) {
+        SmcBedReader *reader = queue.top();
+        queue.pop();
 
-            line=fgetline(instream.stream);
-            if (line == NULL) {
-	      spr->recomb_node = NULL;
-	      spr->coal_node = NULL;
-            } else if (strncmp(line, "SPR", 3)==0) {
-	      int tempend;
-	      if (5 != sscanf(&line[4], "%d\t%d\t%lf\t%d\t%lf",
-			      &tempend, &recomb_node, &(spr->recomb_time),
-			      &coal_node, &(spr->coal_time))) {
-		fprintf(stderr, "error parsing SPR line\n");
-		return 1;
-	      }
-	      if (tempend != end) {
-		fprintf(stderr, "error: SPR pos does not equal TREE end\n");
-		return 1;
-	      }
-	      if (region[1] >= 0 && tempend >= region[1]) {
-		coal_node = -1;
-		recomb_node = -1;
-	      }
-            } else {
-	      fprintf(stderr, "error: expected SPR after TREE line\n");
-	      return 1;
-            }
+        char fields[64];
+        snprintf(fields, sizeof(fields), "\t%i\t%i\t%i\t",
+                 reader->start, reader->end, reader->sample);
+        if (outfile != NULL) {
+            uint64_t vstart = out.tell();
+            out.write(reader->chrom, strlen(reader->chrom));
+            out.write(fields, strlen(fields));
+            out.write(reader->newick);
+            out.write("\n", 1);
+            if (!index.add(reader->chrom, reader->start, reader->end,
+                           vstart, out.tell()))
+                status = 1;
+        } else {
+            printf("%s%s%s\n", reader->chrom, fields,
+                   reader->newick.c_str());
+        }
 
-            //now have to rename all leaf nodes and remove all NHX comments
-	    char tmpStr[1000];
-	    if (recomb_node >= 0) {
-	      sprintf(tmpStr, "%i", recomb_node);
-	      //	    char *tmpStr = itoa(recomb_node);
-	      spr->recomb_node =
-                  tree->nodes[tree->nodename_map[string(tmpStr)]];
-	      sprintf(tmpStr, "%i", coal_node);
-	      spr->coal_node = tree->nodes[tree->nodename_map[string(tmpStr)]];
-
-	      if (spr->recomb_node->age-1 > spr->recomb_time)
-		assert(0);
-	      if (spr->recomb_node != tree->root) {
-		if (spr->recomb_node->parent->age+1 < spr->recomb_time)
-		  assert(0);
-	      }
-	      if (spr->coal_node->age-1 > spr->coal_time)
-		assert(0);
-	      if (spr->coal_node != tree->root) {
-		if (spr->coal_node->parent->age+1 < spr->coal_time) {
-		    assert(0);
-		  }
-	       }
-	      if (times.size() > 0) spr->correct_recomb_times(times);
-	    }
-            if (region[0] >= 0 && start < region[0])
-                start = region[0];
-            if (region[1] >= 0 && end >= region[1]) {
-                end = region[1];
-		spr->recomb_node = spr->coal_node = NULL;
-	    }
-            printf("%s\t%i\t%i\t%i\t", chrom, start, end, sample);
-            tree->write_newick(stdout, false, true, 1, spr);
-            printf("\n");
-            if (line == NULL) break;
-            delete [] line;
+        if (reader->next())
+            queue.push(reader);
+        if (reader->error)
+            status = 1;
+    }
+
+    if (outfile != NULL && out.is_open()) {
+        if (!out.close()) {
+            fprintf(stderr, "error writing %s\n", outfile);
+            status = 1;
+        } else if (status == 0) {
+            string indexfile = string(outfile) + ".tbi";
+            if (!index.write(indexfile.c_str()))
+                status = 1;
         }
     }
-    instream.close();
-    return 0;
+
+    for (unsigned int i=0; i<readers.size(); i++)
+        delete readers[i];
+    return status;
 }
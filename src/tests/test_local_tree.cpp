@@ -1,6 +1,11 @@
+#include <stdlib.h>
+#include <unistd.h>
+
 #include "gtest/gtest.h"
 
+#include "argweaver/arg_archive.h"
 #include "argweaver/local_tree.h"
+#include "argweaver/Tree.h"
 
 
 namespace argweaver {
@@ -80,4 +85,302 @@ TEST(LocalTreeTest, parse_local_tree_extra_meta_data)
 }
 
 
+// Write and read local trees in binary format.
+TEST(LocalTreeTest, binary_local_trees)
+{
+    const char *smc =
+        "NAMES\ta\tb\tc\n"
+        "REGION\tchr\t1\t100\n"
+        "TREE\t1\t50\t((0[&&NHX:age=0],1[&&NHX:age=0])3[&&NHX:age=10],2[&&NHX:age=0])4[&&NHX:age=30];\n"
+        "SPR\t50\t2\t10\t3\t20\n"
+        "TREE\t51\t100\t((0[&&NHX:age=0],1[&&NHX:age=0])3[&&NHX:age=10],2[&&NHX:age=0])4[&&NHX:age=20];\n";
+    int ntimes = 5;
+    double times[] = {0, 10, 20, 30, 40};
+
+    FILE *text = tmpfile();
+    fputs(smc, text);
+    rewind(text);
+    LocalTrees trees;
+    vector<string> seqnames;
+    EXPECT_TRUE(read_local_trees(text, times, ntimes, &trees, seqnames));
+    fclose(text);
+
+    const char *names[] = {"a", "b", "c"};
+    FILE *binary = tmpfile();
+    write_local_trees_binary(binary, &trees, names, times, ntimes);
+
+    // Assert whole ARG.
+    rewind(binary);
+    LocalTrees trees2;
+    vector<string> seqnames2;
+    EXPECT_TRUE(read_local_trees_binary(binary, times, ntimes,
+                                        &trees2, seqnames2));
+    EXPECT_EQ(seqnames2, seqnames);
+    EXPECT_EQ(trees2.start_coord, 0);
+    EXPECT_EQ(trees2.end_coord, 100);
+    EXPECT_EQ(trees2.get_num_trees(), 2);
+    LocalTrees::iterator it2 = trees2.begin();
+    for (LocalTrees::iterator it=trees.begin(); it != trees.end();
+         ++it, ++it2) {
+        EXPECT_EQ(it->blocklen, it2->blocklen);
+        EXPECT_EQ(it->spr.recomb_node, it2->spr.recomb_node);
+        EXPECT_EQ(it->spr.coal_time, it2->spr.coal_time);
+        for (int i=0; i<trees.nnodes; i++) {
+            EXPECT_EQ(it->tree->nodes[i].parent, it2->tree->nodes[i].parent);
+            EXPECT_EQ(it->tree->nodes[i].age, it2->tree->nodes[i].age);
+        }
+    }
+
+    // Assert region.
+    rewind(binary);
+    LocalTrees trees3;
+    EXPECT_TRUE(read_local_trees_binary_region(binary, times, ntimes, 60, 80,
+                                               &trees3, seqnames2));
+    EXPECT_EQ(trees3.start_coord, 60);
+    EXPECT_EQ(trees3.end_coord, 80);
+    EXPECT_EQ(trees3.get_num_trees(), 1);
+    EXPECT_EQ(trees3.front().tree->nodes[4].age, 2);
+    fclose(binary);
+}
+
+
+// Reject binary records with out of range nodes or times.
+TEST(LocalTreeTest, binary_record_checks)
+{
+    // ((0,1)3,2)4
+    BinaryNode nodes[] = {{3, 0}, {3, 0}, {4, 0}, {4, 1}, {-1, 3}};
+    EXPECT_TRUE(check_binary_nodes(nodes, 5, 5));
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 3));
+    nodes[2].parent = 3;
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 5));
+    nodes[2].parent = 7;
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 5));
+    nodes[2].parent = 4;
+    nodes[4].parent = 4;
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 5));
+    nodes[4].parent = -1;
+
+    // leaf with a child
+    nodes[2].parent = 0;
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 5));
+    nodes[2].parent = 4;
+
+    // parent younger than its child
+    nodes[3].age = 4;
+    EXPECT_FALSE(check_binary_nodes(nodes, 5, 5));
+    nodes[3].age = 1;
+    EXPECT_TRUE(check_binary_nodes(nodes, 5, 5));
+
+    // (0,1)6 with the cycle 4 <-> 5 detached from the root
+    BinaryNode cycle[] = {{6, 0}, {6, 0}, {4, 0}, {5, 0},
+                          {5, 2}, {4, 2}, {-1, 3}};
+    EXPECT_FALSE(check_binary_nodes(cycle, 7, 5));
+
+    EXPECT_TRUE(check_binary_header(5, 3, 5));
+    EXPECT_FALSE(check_binary_header(4, 3, 5));
+    EXPECT_FALSE(check_binary_header(-1, 0, 5));
+    EXPECT_FALSE(check_binary_header(5, 3, -1));
+    EXPECT_FALSE(check_binary_header(2 * BINARY_MAX_LEAVES + 1,
+                                     BINARY_MAX_LEAVES + 1, 5));
+
+    BinarySpr spr = {10, 2, 0, 3, 2};
+    EXPECT_TRUE(check_binary_spr(spr, 5, 5));
+    spr.coal_time = 5;
+    EXPECT_FALSE(check_binary_spr(spr, 5, 5));
+    spr.coal_time = 2;
+    spr.coal_node = -2;
+    EXPECT_FALSE(check_binary_spr(spr, 5, 5));
+    spr.set_null();
+    EXPECT_TRUE(check_binary_spr(spr, 5, 5));
+
+    // SPRs on ((0,1)3,2)4
+    int ptree[] = {3, 3, 4, 4, -1};
+    int ages[] = {0, 0, 0, 10, 30};
+    LocalTree tree(ptree, 5, ages);
+    EXPECT_TRUE(check_spr_on_tree(&tree, Spr(0, 5, 2, 20)));
+    EXPECT_TRUE(check_spr_on_tree(&tree, Spr(0, 5, 3, 10)));
+    // recombination above its branch or on the root branch
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(0, 15, 2, 20)));
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(4, 30, 2, 30)));
+    // coalescence before the recombination or above its branch
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(0, 8, 2, 5)));
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(0, 5, 1, 20)));
+    // coalescence within the pruned subtree
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(3, 10, 0, 10)));
+    EXPECT_FALSE(check_spr_on_tree(&tree, Spr(3, 10, 3, 20)));
+}
+
+
+// Write and read samples of an ARG archive.
+TEST(LocalTreeTest, arg_archive)
+{
+    const char *smc =
+        "NAMES\ta\tb\tc\n"
+        "REGION\tchr\t1\t100\n"
+        "TREE\t1\t50\t((0[&&NHX:age=0],1[&&NHX:age=0])3[&&NHX:age=10],2[&&NHX:age=0])4[&&NHX:age=30];\n"
+        "SPR\t50\t2\t10\t3\t20\n"
+        "TREE\t51\t100\t((0[&&NHX:age=0],1[&&NHX:age=0])3[&&NHX:age=10],2[&&NHX:age=0])4[&&NHX:age=20];\n";
+    int ntimes = 5;
+    double times[] = {0, 10, 20, 30, 40};
+
+    FILE *text = tmpfile();
+    fputs(smc, text);
+    rewind(text);
+    LocalTrees trees;
+    vector<string> seqnames;
+    EXPECT_TRUE(read_local_trees(text, times, ntimes, &trees, seqnames));
+    fclose(text);
+
+    // Write the same sample twice, with chunks [0,30), [30,60), ...
+    char filename[] = "/tmp/arg_archive_XXXXXX";
+    close(mkstemp(filename));
+    const char *names[] = {"a", "b", "c"};
+    ArgArchiveWriter writer(30);
+    EXPECT_TRUE(writer.open(filename, &trees, names, times, ntimes));
+    EXPECT_TRUE(writer.write_sample(&trees, 0));
+    EXPECT_TRUE(writer.write_sample(&trees, 10));
+    writer.close();
+    EXPECT_EQ(writer.nchunks_written, 8);
+
+    // Appending requires the same time points.
+    double times2[] = {0, 10, 20, 30, 50};
+    EXPECT_FALSE(writer.open(filename, &trees, names, times2, ntimes, true));
+    EXPECT_TRUE(writer.open(filename, &trees, names, times, ntimes, true));
+    EXPECT_TRUE(writer.write_sample(&trees, 20));
+    writer.close();
+
+    // Assert whole sample.
+    ArgArchiveReader reader;
+    EXPECT_TRUE(reader.open(filename, times, ntimes));
+    EXPECT_EQ(reader.seqnames, seqnames);
+    EXPECT_EQ(reader.get_num_samples(), 3);
+    EXPECT_EQ(reader.find_sample(10), 1);
+    EXPECT_EQ(reader.find_sample(20), 2);
+    LocalTrees trees2;
+    EXPECT_TRUE(reader.read_sample(1, &trees2));
+    EXPECT_EQ(trees2.start_coord, 0);
+    EXPECT_EQ(trees2.end_coord, 100);
+    EXPECT_EQ(trees2.get_num_trees(), 2);
+    EXPECT_EQ(trees2.front().blocklen, 50);
+    EXPECT_EQ(trees2.back().blocklen, 50);
+    EXPECT_EQ(trees2.front().tree->get_root().age, 3);
+    EXPECT_EQ(trees2.back().tree->get_root().age, 2);
+    EXPECT_FALSE(trees2.back().spr.is_null());
+
+    // Assert region.
+    LocalTrees trees3;
+    EXPECT_TRUE(reader.read_sample(0, &trees3, 20, 70));
+    EXPECT_EQ(trees3.start_coord, 20);
+    EXPECT_EQ(trees3.end_coord, 70);
+    EXPECT_EQ(trees3.get_num_trees(), 2);
+    EXPECT_EQ(trees3.front().blocklen, 30);
+    EXPECT_EQ(trees3.back().blocklen, 20);
+
+    // Assert walking the trees across chunks.
+    ArgArchiveCursor cursor(&reader, 1);
+    EXPECT_TRUE(cursor.next());
+    EXPECT_EQ(cursor.start, 0);
+    EXPECT_EQ(cursor.end, 50);
+    EXPECT_FALSE(cursor.spr.is_null());
+    LocalTree tree(*cursor.tree);
+    apply_spr(&tree, cursor.spr);
+    EXPECT_TRUE(cursor.next());
+    EXPECT_EQ(cursor.start, 50);
+    EXPECT_EQ(cursor.end, 100);
+    EXPECT_TRUE(cursor.spr.is_null());
+    for (int i=0; i<tree.nnodes; i++) {
+        EXPECT_EQ(tree[i].parent, (*cursor.tree)[i].parent);
+        EXPECT_EQ(tree[i].age, (*cursor.tree)[i].age);
+    }
+    EXPECT_FALSE(cursor.next());
+    EXPECT_FALSE(cursor.error);
+    reader.close();
+    unlink(filename);
+}
+
+
+// Keep tree statistics up to date across SPRs.
+TEST(LocalTreeTest, tree_stats)
+{
+    spidir::Tree tree("(((a:10,b:10):10,c:20):20,(d:30,e:30):10);");
+    spidir::TreeStats stats(&tree);
+    spidir::Node *b = tree.nodes[tree.nodename_map["b"]];
+    spidir::Node *c = tree.nodes[tree.nodename_map["c"]];
+    spidir::Node *d = tree.nodes[tree.nodename_map["d"]];
+
+    // Move b next to d, then c above the root.
+    spidir::NodeSpr spr1(&tree, b->name, 5, d->name, 5);
+    spidir::NodeSpr spr2(&tree, c->name, 10, tree.root->name, 50);
+    spidir::NodeSpr *sprs[] = {&spr1, &spr2};
+    for (int i=0; i<2; i++) {
+        stats.apply_spr(sprs[i]);
+        EXPECT_DOUBLE_EQ(stats.total_branchlength(),
+                         tree.total_branchlength());
+        EXPECT_DOUBLE_EQ(stats.tmrca(), tree.tmrca());
+        EXPECT_DOUBLE_EQ(stats.tmrca_half(), tree.tmrca_half());
+        EXPECT_DOUBLE_EQ(stats.popsize(), tree.popsize());
+        EXPECT_DOUBLE_EQ(stats.num_zero_branches(),
+                         tree.num_zero_branches());
+        EXPECT_DOUBLE_EQ(stats.distBetweenLeaves("a", "d"),
+                         tree.distBetweenLeaves("a", "d"));
+        EXPECT_DOUBLE_EQ(stats.distBetweenLeaves("b", "d"),
+                         tree.distBetweenLeaves("b", "d"));
+    }
+    EXPECT_DOUBLE_EQ(stats.tmrca(), 50);
+    EXPECT_DOUBLE_EQ(stats.distBetweenLeaves("b", "d"), 10);
+}
+
+
+TEST(LocalTreeTest, tree_lca)
+{
+    spidir::Tree tree("(((a:10,b:10):10,c:20):20,(d:30,e:30):10);");
+    spidir::Node *a = tree.nodes[tree.nodename_map["a"]];
+    spidir::Node *b = tree.nodes[tree.nodename_map["b"]];
+    spidir::Node *c = tree.nodes[tree.nodename_map["c"]];
+    spidir::Node *d = tree.nodes[tree.nodename_map["d"]];
+    spidir::Node *e = tree.nodes[tree.nodename_map["e"]];
+
+    set<spidir::Node*> derived, lca;
+    derived.insert(a);
+    derived.insert(b);
+    derived.insert(c);
+    lca = tree.lca(derived);
+    EXPECT_EQ(lca.size(), 1u);
+    EXPECT_EQ(*lca.begin(), c->parent);
+
+    derived.erase(b);
+    derived.insert(d);
+    lca = tree.lca(derived);
+    EXPECT_EQ(lca.size(), 3u);
+    EXPECT_TRUE(lca.count(a) && lca.count(c) && lca.count(d));
+
+    // all leaves are split at the root
+    derived.insert(b);
+    derived.insert(e);
+    lca = tree.lca(derived);
+    EXPECT_EQ(lca.size(), 2u);
+    EXPECT_TRUE(lca.count(c->parent) && lca.count(d->parent));
+
+    // a comb with more leaves than bits in a word
+    const int nleaves = 70;
+    string newick = "l0:1";
+    for (int i=1; i < nleaves; i++) {
+        char leaf[20];
+        snprintf(leaf, 20, ",l%d:%d):1", i, i);
+        newick = "(" + newick + leaf;
+    }
+    spidir::Tree comb(newick + ";");
+    derived.clear();
+    for (int i=0; i < 66; i++) {
+        char leaf[20];
+        snprintf(leaf, 20, "l%d", i);
+        derived.insert(comb.nodes[comb.nodename_map[leaf]]);
+    }
+    lca = comb.lca(derived);
+    spidir::Node *l65 = comb.nodes[comb.nodename_map["l65"]];
+    EXPECT_EQ(lca.size(), 1u);
+    EXPECT_EQ(*lca.begin(), l65->parent);
+}
+
+
 }  // namespace
@@ -2,11 +2,16 @@
 
 #include "argweaver/common.h"
 #include "argweaver/local_tree.h"
+#include "argweaver/matrices.h"
 #include "argweaver/model.h"
 #include "argweaver/recomb.h"
+#include "argweaver/sample_arg.h"
+#include "argweaver/sample_thread.h"
+#include "argweaver/sequences.h"
 #include "argweaver/states.h"
 #include "argweaver/thread.h"
 #include "argweaver/total_prob.h"
+#include "argweaver/trans.h"
 
 
 namespace argweaver {
@@ -274,4 +279,224 @@ TEST(ProbTest, test_sample_recomb_internal)
 }
 
 
+// The cached ARG prior and likelihood should equal the full computations
+// after every kind of ARG resampling.
+TEST(ProbTest, test_calc_arg_prob_cached)
+{
+    // Setup model.
+    ArgModel model(10, 200000, 1e4, 1.5e-8, 2.5e-8);
+    srand(0);
+
+    // Make random sequences.
+    const int nseqs = 6;
+    const int seqlen = 20000;
+    const char *dna = "ACGT";
+    vector<string> seqs(nseqs, string(seqlen, 'A'));
+    for (int i=0; i<seqlen; i += 20) {
+        char allele = dna[irand(4)];
+        for (int j=0; j<nseqs; j++)
+            if (frand() < .3)
+                seqs[j][i] = allele;
+    }
+    char *seqs2[nseqs];
+    for (int j=0; j<nseqs; j++)
+        seqs2[j] = &seqs[j][0];
+    Sequences sequences(seqs2, nseqs, seqlen);
+
+    LocalTrees trees(0, seqlen);
+    sample_arg_seq(&model, &sequences, &trees);
+    EXPECT_EQ(calc_arg_prior_cached(&model, &trees),
+              calc_arg_prior(&model, &trees));
+    EXPECT_EQ(calc_arg_likelihood_cached(&model, &sequences, &trees),
+              calc_arg_likelihood(&model, &sequences, &trees));
+
+    for (int i=0; i<10; i++) {
+        if (i % 3 == 0)
+            resample_arg(&model, &sequences, &trees);
+        else if (i % 3 == 1)
+            resample_arg_all(&model, &sequences, &trees, .1);
+        else
+            resample_arg_region(&model, &sequences, &trees,
+                                5000, 10000, 2);
+        EXPECT_EQ(calc_arg_prior_cached(&model, &trees),
+                  calc_arg_prior(&model, &trees));
+        EXPECT_EQ(calc_arg_likelihood_cached(&model, &sequences, &trees),
+                  calc_arg_likelihood(&model, &sequences, &trees));
+    }
+
+    // Blocks outside of a resampled region keep their cached terms.
+    resample_arg_region(&model, &sequences, &trees, 5000, 10000, 2);
+    int ncached = 0, ncached2 = 0;
+    for (LocalTrees::iterator it=trees.begin(); it!=trees.end(); ++it) {
+        ncached += it->prior_valid;
+        ncached2 += it->likelihood_valid;
+    }
+    EXPECT_GT(ncached, 0);
+    EXPECT_GT(ncached2, 0);
+    EXPECT_EQ(calc_arg_prior_cached(&model, &trees),
+              calc_arg_prior(&model, &trees));
+    EXPECT_EQ(calc_arg_likelihood_cached(&model, &sequences, &trees),
+              calc_arg_likelihood(&model, &sequences, &trees));
+}
+
+
+
+// The parallel forward algorithm should give the same table as the
+// serial one.
+TEST(ProbTest, test_forward_alg_parallel)
+{
+    // Setup model.
+    ArgModel model(10, 200000, 1e4, 1.5e-8, 2.5e-8);
+    srand(0);
+
+    // Make random sequences.
+    const int nseqs = 6;
+    const int seqlen = 20000;
+    const char *dna = "ACGT";
+    vector<string> seqs(nseqs, string(seqlen, 'A'));
+    for (int i=0; i<seqlen; i += 20) {
+        char allele = dna[irand(4)];
+        for (int j=0; j<nseqs; j++)
+            if (frand() < .3)
+                seqs[j][i] = allele;
+    }
+    char *seqs2[nseqs];
+    for (int j=0; j<nseqs; j++)
+        seqs2[j] = &seqs[j][0];
+    Sequences sequences(seqs2, nseqs, seqlen);
+
+    // Remove a thread to compute its forward table.
+    LocalTrees trees(0, seqlen);
+    sample_arg_seq(&model, &sequences, &trees);
+    const int chrom = nseqs - 1;
+    remove_arg_thread(&trees, chrom);
+
+    ArgHmmForwardTable forward(0, seqlen);
+    ArgHmmMatrixIter matrix_iter(&model, &sequences, &trees, chrom);
+    arghmm_forward_alg(&trees, &model, &sequences, &matrix_iter, &forward);
+    double **fw = forward.get_table();
+
+    // Precomputed matrices are shared with the threads.
+    model.forward_threads = 4;
+    ArgHmmForwardTable forward2(0, seqlen);
+    ArgHmmMatrixList matrix_list(&model, &sequences, &trees, chrom);
+    matrix_list.setup();
+    arghmm_forward_alg(&trees, &model, &sequences, &matrix_list, &forward2);
+    double **fw2 = forward2.get_table();
+
+    EXPECT_GT(matrix_iter.num_blocks(), 4);
+    States states;
+    int ndiff = 0;
+    for (matrix_iter.begin(); matrix_iter.more(); matrix_iter.next()) {
+        matrix_iter.get_coal_states(states);
+        for (int i=matrix_iter.get_block_start();
+             i<matrix_iter.get_block_end(); i++)
+            for (unsigned int j=0; j<states.size(); j++)
+                ndiff += (fw[i][j] != fw2[i][j]);
+    }
+    EXPECT_EQ(ndiff, 0);
+}
+
+
+
+// Checkpointed removal path counts should sample the same paths as the
+// dense table.
+TEST(ProbTest, test_removal_paths_checkpointed)
+{
+    // Setup model.
+    ArgModel model(10, 200000, 1e4, 1.5e-8, 2.5e-8);
+    srand(0);
+
+    // Make random sequences.
+    const int nseqs = 6;
+    const int seqlen = 20000;
+    const char *dna = "ACGT";
+    vector<string> seqs(nseqs, string(seqlen, 'A'));
+    for (int i=0; i<seqlen; i += 20) {
+        char allele = dna[irand(4)];
+        for (int j=0; j<nseqs; j++)
+            if (frand() < .3)
+                seqs[j][i] = allele;
+    }
+    char *seqs2[nseqs];
+    for (int j=0; j<nseqs; j++)
+        seqs2[j] = &seqs[j][0];
+    Sequences sequences(seqs2, nseqs, seqlen);
+
+    LocalTrees trees(0, seqlen);
+    sample_arg_seq(&model, &sequences, &trees);
+    const int ntrees = trees.get_num_trees();
+    EXPECT_GT(ntrees, 10);
+
+    RemovalPaths dense(trees.nnodes, ntrees, 0);
+    count_arg_removal_paths(&trees, dense);
+    const double total = count_total_arg_removal_paths(dense);
+
+    const int steps[] = {1, 3, int(ceil(sqrt(double(ntrees)))), ntrees};
+    vector<int> path(ntrees), path2(ntrees);
+    for (int k=0; k<4; k++) {
+        RemovalPaths checkpointed(trees.nnodes, ntrees, steps[k]);
+        count_arg_removal_paths(&trees, checkpointed);
+        EXPECT_EQ(count_total_arg_removal_paths(checkpointed), total);
+
+        for (int seed=1; seed<=5; seed++) {
+            srand(seed);
+            EXPECT_EQ(sample_arg_removal_path_uniform(&trees, dense,
+                                                      &path[0]), total);
+            srand(seed);
+            EXPECT_EQ(sample_arg_removal_path_uniform(&trees, checkpointed,
+                                                      &path2[0]), total);
+            EXPECT_EQ(path, path2);
+        }
+    }
+}
+
+
+
+// The expanded tables of the transition matrix should give the same
+// probabilities as the per-time terms.
+TEST(ProbTest, test_trans_matrix_expand)
+{
+    // Setup model.
+    int ntimes = 8;
+    double times[] = {0, 10, 20, 30, 40, 60, 80, 100};
+    double rho = 1e-6;
+    double mu = 2.5e-9;
+    double popsize = 1e4;
+    ArgModel model(ntimes, times, NULL, rho, mu);
+    model.set_popsizes(popsize, ntimes);
+
+    // Read tree.
+    const char *newick =
+        "((0,1)5[&&NHX:age=10],((2,3)6[&&NHX:age=20],4)7[&&NHX:age=30])8[&&NHX:age=60]";
+    LocalTree tree;
+    parse_local_tree(newick, &tree, times, ntimes);
+
+    LineageCounts lineages(ntimes);
+    lineages.count(&tree);
+    States states;
+    get_coal_states_external(&tree, ntimes, states);
+
+    const int minages[] = {0, 2};
+    for (int m=0; m<2; m++) {
+        const int minage = minages[m];
+        TransMatrix matrix(ntimes, states.size());
+        calc_transition_probs(&tree, &model, states, &lineages, &matrix,
+                              false, minage);
+        EXPECT_TRUE(matrix.expanded);
+        EXPECT_EQ(matrix.minage, minage);
+
+        int ndiff = 0;
+        for (int a=0; a<ntimes-1; a++)
+            for (int b=0; b<ntimes-1; b++)
+                for (int c=0; c<ntimes; c++)
+                    for (int same=0; same<2; same++)
+                        ndiff += (matrix.get_time(a, b, c, minage, same) !=
+                                  matrix.get_time_direct(a, b, c, minage,
+                                                         same));
+        EXPECT_EQ(ndiff, 0);
+    }
+}
+
+
 }  // namespace
@@ -0,0 +1,63 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+
+#include "argweaver/IntervalIterator.h"
+#include "argweaver/summary_stats.h"
+
+
+namespace argweaver {
+
+
+// Compute running moments.
+TEST(SummaryStatsTest, running_moments)
+{
+    vector<double> values;
+    RunningMoments moments;
+    for (int i=0; i<100; i++) {
+        values.push_back(1e6 + i % 7);
+        moments.add(values.back());
+    }
+
+    double mean = compute_mean(values);
+    EXPECT_EQ(moments.count(), 100);
+    EXPECT_NEAR(moments.mean(), mean, 1e-6);
+    EXPECT_NEAR(moments.stdev(), compute_stdev(values, mean), 1e-9);
+}
+
+
+// Compute quantiles exactly for few values and approximately for many.
+TEST(SummaryStatsTest, quantile_sketch)
+{
+    vector<double> q;
+    q.push_back(0.0);
+    q.push_back(0.025);
+    q.push_back(0.5);
+    q.push_back(0.975);
+    q.push_back(1.0);
+
+    // Assert exact quantiles.
+    vector<double> values;
+    QuantileSketch exact(100);
+    srand(0);
+    for (int i=0; i<100; i++) {
+        values.push_back(rand() % 1000);
+        exact.add(values.back());
+    }
+    EXPECT_TRUE(exact.is_exact());
+    EXPECT_EQ(exact.quantiles(q), compute_quantiles(values, q));
+
+    // Assert approximate quantiles of a uniform sample.
+    QuantileSketch sketch(100);
+    const int n = 100000;
+    for (int i=0; i<n; i++)
+        sketch.add((double) ((i * 7919) % n) / n);
+    EXPECT_FALSE(sketch.is_exact());
+    vector<double> result = sketch.quantiles(q);
+    for (unsigned int i=0; i<q.size(); i++)
+        EXPECT_NEAR(result[i], q[i], 0.002);
+}
+
+
+}  // namespace
@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include "argweaver/track.h"
+
+
+namespace argweaver {
+
+
+// Look up regions of a sorted track.
+TEST(TrackTest, find_sorted)
+{
+    Track<double> track;
+    track.append("chr", 0, 10, 1.0);
+    track.append("chr", 10, 20, 2.0);
+    track.append("chr", 25, 30, 3.0);
+
+    // Assert indexes.
+    EXPECT_EQ(track.index(0), 0);
+    EXPECT_EQ(track.index(9), 0);
+    EXPECT_EQ(track.index(10), 1);
+    EXPECT_EQ(track.index(29), 2);
+
+    // Assert positions outside of regions.
+    EXPECT_EQ(track.index(-1), -1);
+    EXPECT_EQ(track.index(22), -1);
+    EXPECT_EQ(track.index(30), -1);
+    EXPECT_EQ(track.find(22, -1.0), -1.0);
+    EXPECT_EQ(track.find(15, -1.0), 2.0);
+}
+
+
+// Look up regions with a cursor at increasing and decreasing positions.
+TEST(TrackTest, cursor)
+{
+    Track<double> track;
+    for (int i=0; i<100; i++)
+        track.append("chr", 10*i, 10*(i+1), i);
+
+    TrackCursor<double> cursor(track);
+    for (int pos=0; pos<1000; pos+=3)
+        EXPECT_EQ(cursor.index(pos), pos / 10);
+    for (int pos=999; pos>=0; pos-=7)
+        EXPECT_EQ(cursor.find(pos, -1.0), pos / 10);
+
+    // Assert jumps and misses.
+    EXPECT_EQ(cursor.index(5), 0);
+    EXPECT_EQ(cursor.index(995), 99);
+    EXPECT_EQ(cursor.index(1000), -1);
+    EXPECT_EQ(cursor.index(994), 99);
+}
+
+
+}  // namespace